@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Generate synthetic SysY programs of a given shape and size.
+
+usage: gen_sysy.py <shape> <size>
+
+shapes:
+  funcs     <size> functions calling each other
+  nesting   if/while statements nested <size> deep
+  array     global and local arrays with <size> element initializers
+  expr      expressions chaining <size> operators
+  globals   <size> global variables used by main
+"""
+import sys
+
+
+def gen_funcs(n):
+    out = []
+    out.append("int f0(int a, int b) {\n  return a + b;\n}\n")
+    for i in range(1, n):
+        out.append(
+            "int f%d(int a, int b) {\n"
+            "  int t = a * %d;\n"
+            "  if (t > b) t = t - b;\n"
+            "  return f%d(t, b + 1);\n"
+            "}\n" % (i, i % 7 + 1, i - 1))
+    out.append("int main() {\n  putint(f%d(1, 2));\n  return 0;\n}\n" % (n - 1))
+    return "".join(out)
+
+
+def gen_nesting(n):
+    out = ["int main() {\n  int x = getint();\n  int s = 0;\n"]
+    for i in range(n):
+        ind = "  " * (i + 1)
+        if i % 2 == 0:
+            out.append("%sif (x > %d) {\n" % (ind, i))
+        else:
+            out.append("%swhile (x > %d) {\n%s  x = x - 1;\n" % (ind, i, ind))
+        out.append("%s  s = s + %d;\n" % (ind, i))
+    for i in reversed(range(n)):
+        out.append("  " * (i + 1) + "}\n")
+    out.append("  putint(s);\n  return 0;\n}\n")
+    return "".join(out)
+
+
+def gen_array(n):
+    elems = ", ".join(str((i * 37) % 101) for i in range(n))
+    rows = max(1, n // 16)
+    nested = ", ".join(
+        "{" + ", ".join(str((r + c) % 9) for c in range(16)) + "}" for r in range(rows))
+    return (
+        "int g[%d] = {%s};\n"
+        "int h[%d][16] = {%s};\n"
+        "int main() {\n"
+        "  int l[%d] = {%s};\n"
+        "  int m[%d][16] = {%s};\n"
+        "  putint(g[%d] + h[%d][3] + l[%d] + m[%d][5]);\n"
+        "  return 0;\n"
+        "}\n" % (n, elems, rows, nested, n, elems, rows, nested,
+                 n - 1, rows - 1, n // 2, rows - 1))
+
+
+def gen_expr(n):
+    ops = ["+", "-", "*", "/", "%"]
+    terms = []
+    for i in range(n):
+        terms.append("(a %s %d)" % (ops[i % 2], i % 13 + 1))
+        terms.append(ops[i % len(ops)] if i % len(ops) < 3 else "+")
+    terms.append("b")
+    cond = " && ".join("a != %d" % i for i in range(max(1, n // 4)))
+    return (
+        "int main() {\n"
+        "  int a = getint();\n"
+        "  int b = getint();\n"
+        "  int c = %s;\n"
+        "  if (%s) c = c + 1;\n"
+        "  putint(c);\n"
+        "  return 0;\n"
+        "}\n" % (" ".join(terms), cond))
+
+
+def gen_globals(n):
+    out = []
+    for i in range(n):
+        if i % 3 == 0:
+            out.append("const int c%d = %d;\n" % (i, i))
+        else:
+            out.append("int v%d = %d;\n" % (i, i % 11))
+    out.append("int main() {\n  int s = 0;\n")
+    for i in range(n):
+        out.append("  s = s + %s%d;\n" % ("c" if i % 3 == 0 else "v", i))
+    out.append("  putint(s);\n  return 0;\n}\n")
+    return "".join(out)
+
+
+SHAPES = {
+    "funcs": gen_funcs,
+    "nesting": gen_nesting,
+    "array": gen_array,
+    "expr": gen_expr,
+    "globals": gen_globals,
+}
+
+
+def main():
+    if len(sys.argv) != 3 or sys.argv[1] not in SHAPES:
+        sys.stderr.write(__doc__)
+        sys.exit(1)
+    sys.stdout.write(SHAPES[sys.argv[1]](int(sys.argv[2])))
+
+
+if __name__ == "__main__":
+    main()
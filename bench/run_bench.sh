@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Compile time and memory of the compiler on synthetic programs.
+# usage: bench/run_bench.sh [compiler] [mode]
+#   SHAPES and SIZES override what is measured, e.g.
+#   SHAPES="funcs expr" SIZES="100 1000" bench/run_bench.sh
+
+compiler=${1:-./build/compiler}
+mode=${2:--riscv}
+shapes=${SHAPES:-funcs nesting array expr globals}
+sizes=${SIZES:-100 1000 10000}
+bench_dir=$(dirname "$0")
+work_dir=${BENCH_DIR:-./build/bench}
+
+mkdir -p "$work_dir"
+printf "%-10s %8s %10s %12s %12s %14s\n" shape size bytes "wall (ms)" "cpu (ms)" "peak rss (KB)"
+for shape in $shapes; do
+    for size in $sizes; do
+        src=$work_dir/${shape}_${size}.c
+        python3 "$bench_dir/gen_sysy.py" "$shape" "$size" > "$src"
+        # the compiler reports its own totals, bypass the compile cache
+        report=$(SYSY_CACHE_DIR= "$compiler" "$mode" "$src" -o "$work_dir/${shape}_${size}.out" \
+                 -ftime-report 2>&1 | grep "^total ")
+        if [ -z "$report" ]; then
+            printf "%-10s %8s %10s %12s\n" "$shape" "$size" "$(wc -c < "$src")" failed
+            continue
+        fi
+        set -- $report
+        printf "%-10s %8s %10s %12s %12s %14s\n" "$shape" "$size" "$(wc -c < "$src")" "$3" "$4" "$5"
+    done
+done
@@ -0,0 +1,253 @@
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "koopa.h"
+#include "pass.h"
+#include "alias.h"
+using namespace std;
+
+AliasAnalysis::AliasAnalysis(const koopa_raw_function_t &func, const ModuleInfo *module)
+    : module(module) {
+    // an alloc of a pointer stored only once with an arg holds that array parameter
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for (size_t j = 0; j < block->insts.len; ++j) {
+            auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
+            if (value->kind.tag != KOOPA_RVT_STORE)
+                continue;
+            const auto &st = value->kind.data.store;
+            if (st.dest->kind.tag != KOOPA_RVT_ALLOC ||
+                st.dest->ty->data.pointer.base->tag != KOOPA_RTT_POINTER)
+                continue;
+            if (st.value->kind.tag == KOOPA_RVT_FUNC_ARG_REF)
+                arg_holders[st.dest]++;
+            else
+                arg_holders[st.dest] = 2;
+        }
+    }
+}
+
+const AliasAnalysis::Location &AliasAnalysis::locate(const koopa_raw_value_t &ptr) {
+    auto it = locs.find(ptr);
+    if (it != locs.end())
+        return it->second;
+    Location loc;
+    loc.kind = Location::UNKNOWN;
+    loc.root = ptr;
+    const auto &kind = ptr->kind;
+    koopa_raw_value_t index = nullptr;
+    int stride = 0;
+    switch (kind.tag) {
+        case KOOPA_RVT_GET_ELEM_PTR:
+            loc = locate(kind.data.get_elem_ptr.src);
+            index = kind.data.get_elem_ptr.index;
+            stride = types.elem_stride(kind.data.get_elem_ptr.src->ty);
+            break;
+        case KOOPA_RVT_GET_PTR:
+            loc = locate(kind.data.get_ptr.src);
+            index = kind.data.get_ptr.index;
+            stride = types.ptr_stride(kind.data.get_ptr.src->ty);
+            break;
+        case KOOPA_RVT_ALLOC:
+            loc.kind = Location::LOCAL;
+            break;
+        case KOOPA_RVT_GLOBAL_ALLOC:
+            loc.kind = Location::GLOBAL;
+            break;
+        case KOOPA_RVT_FUNC_ARG_REF:
+            loc.kind = Location::ARG;
+            break;
+        case KOOPA_RVT_LOAD: {
+            auto holder = arg_holders.find(kind.data.load.src);
+            if (holder != arg_holders.end() && holder->second == 1) {
+                loc.kind = Location::ARG;
+                loc.root = kind.data.load.src;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    if (index) {
+        auto leader = leaders.find(index);
+        if (leader != leaders.end())
+            index = leader->second;
+        if (index->kind.tag == KOOPA_RVT_INTEGER)
+            loc.offset += int64_t(index->kind.data.integer.value) * stride;
+        else
+            loc.terms.push_back(make_pair(index, stride));
+    }
+    return locs.emplace(ptr, loc).first->second;
+}
+
+/* Objects which only direct loads and stores reach: scalars, never pointed to */
+static bool is_scalar_object(const AliasAnalysis::Location &loc) {
+    if (loc.kind != AliasAnalysis::Location::LOCAL && loc.kind != AliasAnalysis::Location::GLOBAL)
+        return false;
+    return loc.root->ty->data.pointer.base->tag != KOOPA_RTT_ARRAY;
+}
+
+bool AliasAnalysis::may_overlap(const Location &a, const Location &b) const {
+    if (a.kind == b.kind && a.root == b.root)
+        return true;
+    if (is_scalar_object(a) || is_scalar_object(b))
+        return false;
+    bool a_object = a.kind == Location::LOCAL || a.kind == Location::GLOBAL;
+    bool b_object = b.kind == Location::LOCAL || b.kind == Location::GLOBAL;
+    if (a_object && b_object)
+        return false;
+    // parameters point into the arrays of callers, never at our own locals
+    if ((a.kind == Location::LOCAL && b.kind == Location::ARG) ||
+        (a.kind == Location::ARG && b.kind == Location::LOCAL))
+        return false;
+    return true;
+}
+
+AliasResult AliasAnalysis::alias(const koopa_raw_value_t &p, const koopa_raw_value_t &q) {
+    if (p == q)
+        return MUST_ALIAS;
+    Location a = locate(p);
+    const Location &b = locate(q);
+    if (!may_overlap(a, b))
+        return NO_ALIAS;
+    if (a.kind != b.kind || a.root != b.root || a.terms != b.terms)
+        return MAY_ALIAS;
+    // same object and the same variable part
+    return a.offset == b.offset ? MUST_ALIAS : NO_ALIAS;
+}
+
+int AliasAnalysis::mod_ref(const koopa_raw_value_t &inst, const koopa_raw_value_t &ptr) {
+    const auto &kind = inst->kind;
+    switch (kind.tag) {
+        case KOOPA_RVT_LOAD:
+            return alias(kind.data.load.src, ptr) == NO_ALIAS ? NO_MOD_REF : REF;
+        case KOOPA_RVT_STORE:
+            return alias(kind.data.store.dest, ptr) == NO_ALIAS ? NO_MOD_REF : MOD;
+        case KOOPA_RVT_CALL:
+            break;
+        default:
+            return NO_MOD_REF;
+    }
+    const auto &call = kind.data.call;
+    Location loc = locate(ptr);
+    if (!module || !module->effects.count(call.callee)) {
+        if (is_scalar_object(loc) && loc.kind == Location::LOCAL)
+            return NO_MOD_REF;
+        return MOD_REF;
+    }
+    const FuncEffects &eff = module->effects.at(call.callee);
+    int res = NO_MOD_REF;
+    if (loc.kind == Location::GLOBAL) {
+        if (eff.mod_globals.count(loc.root))
+            res |= MOD;
+        if (eff.ref_globals.count(loc.root))
+            res |= REF;
+    } else if (loc.kind == Location::ARG || loc.kind == Location::UNKNOWN) {
+        // may be a global array of the callee
+        if (!eff.mod_globals.empty())
+            res |= MOD;
+        if (!eff.ref_globals.empty())
+            res |= REF;
+    }
+    // and whatever the callee reaches through the pointers passed to it
+    for (size_t i = 0; i < call.args.len; ++i) {
+        auto arg = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
+        if (arg->ty->tag != KOOPA_RTT_POINTER || !may_overlap(locate(arg), loc))
+            continue;
+        if (eff.mod_args)
+            res |= MOD;
+        if (eff.ref_args)
+            res |= REF;
+    }
+    return res;
+}
+
+/*
+ * Effects of the functions of a program on memory: what each reads and
+ * writes itself, then what its callees do, until nothing changes. A
+ * callee writing through its parameters writes the objects the caller
+ * passes. Library functions only touch the arrays passed to them.
+ */
+void compute_effects(const koopa_raw_program_t &program, ModuleInfo &info) {
+    struct CallSite {
+        koopa_raw_function_t callee;
+        vector<AliasAnalysis::Location> args;  // the pointer args
+    };
+    size_t num_funcs = program.funcs.len;
+    vector<vector<CallSite> > calls(num_funcs);
+    info.effects.clear();
+    for (size_t i = 0; i < num_funcs; ++i) {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        FuncEffects &eff = info.effects[func];
+        if (func->bbs.len == 0) {
+            for (size_t k = 0; k < func->params.len; ++k) {
+                auto param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[k]);
+                if (param->ty->tag == KOOPA_RTT_POINTER)
+                    eff.mod_args = eff.ref_args = true;
+            }
+            continue;
+        }
+        if (info.funcs[i].dead)
+            continue;
+        AliasAnalysis aa(func);
+        auto touch = [&](const koopa_raw_value_t &ptr, bool mod) {
+            const auto &loc = aa.locate(ptr);
+            if (loc.kind == AliasAnalysis::Location::GLOBAL)
+                (mod ? eff.mod_globals : eff.ref_globals).insert(loc.root);
+            else if (loc.kind != AliasAnalysis::Location::LOCAL)
+                (mod ? eff.mod_args : eff.ref_args) = true;
+        };
+        for (size_t j = 0; j < func->bbs.len; ++j) {
+            auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[j]);
+            for (size_t k = 0; k < block->insts.len; ++k) {
+                auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[k]);
+                const auto &kind = value->kind;
+                if (kind.tag == KOOPA_RVT_LOAD) {
+                    touch(kind.data.load.src, false);
+                } else if (kind.tag == KOOPA_RVT_STORE) {
+                    touch(kind.data.store.dest, true);
+                } else if (kind.tag == KOOPA_RVT_CALL) {
+                    CallSite site;
+                    site.callee = kind.data.call.callee;
+                    for (size_t a = 0; a < kind.data.call.args.len; ++a) {
+                        auto arg = reinterpret_cast<koopa_raw_value_t>(kind.data.call.args.buffer[a]);
+                        if (arg->ty->tag == KOOPA_RTT_POINTER)
+                            site.args.push_back(aa.locate(arg));
+                    }
+                    calls[i].push_back(site);
+                }
+            }
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < num_funcs; ++i) {
+            auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+            FuncEffects &eff = info.effects[func];
+            size_t before = eff.mod_globals.size() + eff.ref_globals.size() +
+                            eff.mod_args + eff.ref_args;
+            for (auto &site : calls[i]) {
+                const FuncEffects &callee = info.effects[site.callee];
+                eff.mod_globals.insert(callee.mod_globals.begin(), callee.mod_globals.end());
+                eff.ref_globals.insert(callee.ref_globals.begin(), callee.ref_globals.end());
+                for (auto &loc : site.args) {
+                    if (loc.kind == AliasAnalysis::Location::LOCAL)
+                        continue;
+                    if (loc.kind == AliasAnalysis::Location::GLOBAL) {
+                        if (callee.mod_args)
+                            eff.mod_globals.insert(loc.root);
+                        if (callee.ref_args)
+                            eff.ref_globals.insert(loc.root);
+                    } else {
+                        eff.mod_args = eff.mod_args || callee.mod_args;
+                        eff.ref_args = eff.ref_args || callee.ref_args;
+                    }
+                }
+            }
+            if (eff.mod_globals.size() + eff.ref_globals.size() + eff.mod_args + eff.ref_args != before)
+                changed = true;
+        }
+    }
+}
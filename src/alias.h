@@ -0,0 +1,67 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "koopa.h"
+#include "pass.h"
+#include "layout.h"
+using namespace std;
+
+/*
+ * Alias analysis of the memory accesses of a function. A pointer is
+ * located as an object plus a constant offset plus index * stride terms.
+ * SysY has no way to take the address of a scalar and array parameters
+ * only point into the arrays of callers, which is what makes most of the
+ * answers NO_ALIAS. Accesses are always one word.
+ */
+
+enum AliasResult { NO_ALIAS, MAY_ALIAS, MUST_ALIAS };
+
+// Effect of an instruction on a memory location, a bit set
+enum ModRef { NO_MOD_REF = 0, REF = 1, MOD = 2, MOD_REF = 3 };
+
+class AliasAnalysis {
+public:
+    struct Location {
+        enum Kind {
+            LOCAL,    // alloc of the function
+            GLOBAL,   // global alloc
+            ARG,      // array parameter: root is the alloc holding it, or the arg
+            UNKNOWN   // any pointer we can not trace, root is the pointer
+        } kind;
+        koopa_raw_value_t root;
+        int64_t offset = 0;  // in bytes
+        vector<pair<koopa_raw_value_t, int> > terms;  // index value, stride
+    };
+
+    // module gives the effects of callees, calls may do anything without it
+    AliasAnalysis(const koopa_raw_function_t &func, const ModuleInfo *module = nullptr);
+    const Location &locate(const koopa_raw_value_t &ptr);
+    // Whether the words at two pointers may be the same
+    AliasResult alias(const koopa_raw_value_t &p, const koopa_raw_value_t &q);
+    // Whether an instruction may read or write the word at a pointer
+    int mod_ref(const koopa_raw_value_t &inst, const koopa_raw_value_t &ptr);
+    // A value known to equal an earlier one, used for the indexes of pointers
+    // located afterwards
+    void set_leader(const koopa_raw_value_t &value, const koopa_raw_value_t &leader) {
+        leaders[value] = leader;
+    }
+
+private:
+    const ModuleInfo *module;
+    TypeLayouts types;
+    unordered_map<koopa_raw_value_t, Location> locs;
+    // allocs holding array parameters, stored only once with the arg
+    unordered_map<koopa_raw_value_t, int> arg_holders;
+    unordered_map<koopa_raw_value_t, koopa_raw_value_t> leaders;
+
+    // whether two objects may overlap, whatever the offsets
+    bool may_overlap(const Location &a, const Location &b) const;
+};
+
+// Globals and parameter arrays a function may read or write, callees included
+void compute_effects(const koopa_raw_program_t &program, ModuleInfo &info);
+
+#endif
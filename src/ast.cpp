@@ -4,34 +4,12 @@
 #include "ast.h"
 using namespace std;
 
-// The minimum valid id of temporary variables of the KoopaIR program
-int min_temp_id = 0;
-// The operand that will be used during current dump
-string op_num("");
-// The function parameters when calling a function
-vector<string> params;
-// Symbol Table
-ProgSymTab prog_symtab;
-// To indicate what current instruction is
-enum INSTR_TYPE curr_instr = INSTR_TYPE::NONE;
-// Is there an return instr (ret) in current koopaIR block?
-bool ret_in_blk = false;
-// Is there an jump instr (jump, br) in current koopaIR block?
-bool jump_in_blk = false;
-// The minimum valid id to help to distinguish identifiers with the same name
-int var_id = 0;
-// The minimum valid block id to build branches
-int block_id = 0;
-// while info vector
-vector<WhileInfo> vec_while;
-// To indicate a gloabl var or a Local var
-enum Domain curr_domain = Domain::Global;
-// To indicate a call instruction
-bool is_call = false;
+// Lowering state of the file being compiled by this thread
+thread_local CodegenContext *cg_ctx = nullptr;
 
 // check if there's an empty block at the end
 void check_empty_block(string &s, int func_type) {
-    if (!ret_in_blk && !jump_in_blk) {
+    if (!cg_ctx->ret_in_blk && !cg_ctx->jump_in_blk) {
     // if (s[s.size() - 2] == ':') {  // an empty block
         if (func_type == 1) {  // int
             s = s + "ret 0\n";
@@ -41,6 +19,142 @@ void check_empty_block(string &s, int func_type) {
     }
 }
 
+/* 
+ * Logical value of an expression in jumping code. KoopaIR has no phi, so
+ * the value is merged through a stack slot.
+ */
+void dump_logic_value(const BaseAST *exp, string &s) {
+    int true_blk_id = cg_ctx->block_id, false_blk_id = cg_ctx->block_id + 1;
+    int end_blk_id = cg_ctx->block_id + 2;
+    cg_ctx->block_id += 3;
+    string res = "%" + string(to_string(cg_ctx->min_temp_id));
+    cg_ctx->min_temp_id++;
+    s = s + res + " = alloc i32\n";
+    exp->dump_cond(s, true_blk_id, false_blk_id);
+    s = s + "\n%block" + string(to_string(true_blk_id)) + ":\n";
+    s = s + "store 1, " + res + "\n";
+    s = s + "jump %block" + string(to_string(end_blk_id)) + "\n";
+    s = s + "\n%block" + string(to_string(false_blk_id)) + ":\n";
+    s = s + "store 0, " + res + "\n";
+    s = s + "jump %block" + string(to_string(end_blk_id)) + "\n";
+    s = s + "\n%block" + string(to_string(end_blk_id)) + ":\n";
+    cg_ctx->ret_in_blk = false;
+    cg_ctx->jump_in_blk = false;
+    cg_ctx->op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+    cg_ctx->min_temp_id++;
+    s = s + cg_ctx->op_num + " = load " + res + "\n";
+}
+
+/* Logical value of an expression as "ne value, 0" */
+void dump_ne_zero(const BaseAST *exp, string &s) {
+    exp->dump2str(s);
+    string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+    cg_ctx->min_temp_id++;
+    s = s + new_op_num + " = ne " + cg_ctx->op_num + ", 0\n";
+    cg_ctx->op_num = new_op_num;
+}
+
+// Fewer zeros than this are stored one by one instead of by a loop
+const int MIN_ZERO_LOOP = 16;
+
+/*
+ * Initialize a local array. Elements are addressed with one getptr from
+ * the first element, so a store costs two instructions. If the array has
+ * many zeros, a loop clears it four elements at a time first and only the
+ * non-zero elements are stored after it.
+ */
+void dump_local_array_init(const string &name, const veci &dim, const veci &init, string &s) {
+    int total_num = init.size();
+    // pointer to the first element
+    string base = "@" + name;
+    for (int k = 0; k < dim.size(); ++k) {
+        string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+        cg_ctx->min_temp_id++;
+        s = s + new_op_num + " = getelemptr " + base + ", 0\n";
+        base = new_op_num;
+    }
+    int num_zeros = 0;
+    for (int j = 0; j < total_num; ++j)
+        num_zeros += init[j] == 0;
+    bool zero_loop = num_zeros >= MIN_ZERO_LOOP;
+    if (zero_loop) {
+        int loop_blk_id = cg_ctx->block_id, end_blk_id = cg_ctx->block_id + 1;
+        cg_ctx->block_id += 2;
+        string cnt = "%" + string(to_string(cg_ctx->min_temp_id));
+        cg_ctx->min_temp_id++;
+        s = s + cnt + " = alloc i32\n";
+        s = s + "store 0, " + cnt + "\n";
+        s = s + "jump %block" + string(to_string(loop_blk_id)) + "\n";
+        s = s + "\n%block" + string(to_string(loop_blk_id)) + ":\n";
+        string idx = "%" + string(to_string(cg_ctx->min_temp_id));
+        cg_ctx->min_temp_id++;
+        s = s + idx + " = load " + cnt + "\n";
+        string ptr = base;
+        for (int k = 0; k < 4; ++k) {
+            string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+            cg_ctx->min_temp_id++;
+            s = s + new_op_num + " = getptr " + ptr + ", " + (k == 0 ? idx : "1") + "\n";
+            s = s + "store 0, " + new_op_num + "\n";
+            ptr = new_op_num;
+        }
+        string next = "%" + string(to_string(cg_ctx->min_temp_id));
+        string cond = "%" + string(to_string(cg_ctx->min_temp_id + 1));
+        cg_ctx->min_temp_id += 2;
+        s = s + next + " = add " + idx + ", 4\n";
+        s = s + "store " + next + ", " + cnt + "\n";
+        s = s + cond + " = lt " + next + ", " + string(to_string(total_num / 4 * 4)) + "\n";
+        s = s + "br " + cond + ", %block" + string(to_string(loop_blk_id)) + 
+            ", %block" + string(to_string(end_blk_id)) + "\n";
+        s = s + "\n%block" + string(to_string(end_blk_id)) + ":\n";
+    }
+    for (int j = 0; j < total_num; ++j) {
+        // the loop covers whole groups of four
+        if (init[j] == 0 && zero_loop && j < total_num / 4 * 4)
+            continue;
+        string ptr = base;
+        if (j > 0) {
+            ptr = "%" + string(to_string(cg_ctx->min_temp_id));
+            cg_ctx->min_temp_id++;
+            s = s + ptr + " = getptr " + base + ", " + string(to_string(j)) + "\n";
+        }
+        s = s + "store " + string(to_string(init[j])) + ", " + ptr + "\n";
+    }
+}
+
+/* Initializer of elements [first, first + size of level) of the subarray at a level of dims */
+static void global_init(const veci &dim, const veci &init, const veci &num_nonzero,
+                        int level, int first, string &res) {
+    int size = 1;
+    for (int k = 0; k <= level; ++k)
+        size *= dim[k];
+    // a mostly zero table is just a few zeroinits
+    if (num_nonzero[first + size] == num_nonzero[first]) {
+        res += "zeroinit";
+        return;
+    }
+    res += "{";
+    int sub_size = size / dim[level];
+    for (int k = 0; k < dim[level]; ++k) {
+        if (k > 0)
+            res += ", ";
+        if (level == 0)
+            res += string(to_string(init[first + k]));
+        else
+            global_init(dim, init, num_nonzero, level - 1, first + k * sub_size, res);
+    }
+    res += "}";
+}
+
+string global_init(const veci &dim, const veci &init) {
+    // num_nonzero[i]: non-zero elements before element i
+    veci num_nonzero(init.size() + 1, 0);
+    for (int i = 0; i < init.size(); ++i)
+        num_nonzero[i + 1] = num_nonzero[i] + (init[i] != 0);
+    string res;
+    global_init(dim, init, num_nonzero, dim.size() - 1, 0, res);
+    return res;
+}
+
 void import_sysy_lib(string &s) {
     s += "decl @getint(): i32\n";
     s += "decl @getch(): i32\n";
@@ -55,48 +169,48 @@ void import_sysy_lib(string &s) {
         struct Symbol symb;
         symb.tag = Tag::Function;
         symb.value.func_type = 1;
-        (*(prog_symtab.global_symtab))["getint"] = symb;
+        (*(cg_ctx->prog_symtab.global_symtab))["getint"] = symb;
     }
     {
         struct Symbol symb;
         symb.tag = Tag::Function;
         symb.value.func_type = 1;
-        (*(prog_symtab.global_symtab))["getch"] = symb;
+        (*(cg_ctx->prog_symtab.global_symtab))["getch"] = symb;
     }
     {
         struct Symbol symb;
         symb.tag = Tag::Function;
         symb.value.func_type = 1;
-        (*(prog_symtab.global_symtab))["getarray"] = symb;
+        (*(cg_ctx->prog_symtab.global_symtab))["getarray"] = symb;
     }
     {
         struct Symbol symb;
         symb.tag = Tag::Function;
         symb.value.func_type = 0;
-        (*(prog_symtab.global_symtab))["putint"] = symb;
+        (*(cg_ctx->prog_symtab.global_symtab))["putint"] = symb;
     }
     {
         struct Symbol symb;
         symb.tag = Tag::Function;
         symb.value.func_type = 0;
-        (*(prog_symtab.global_symtab))["putch"] = symb;
+        (*(cg_ctx->prog_symtab.global_symtab))["putch"] = symb;
     }
     {
         struct Symbol symb;
         symb.tag = Tag::Function;
         symb.value.func_type = 0;
-        (*(prog_symtab.global_symtab))["putarray"] = symb;
+        (*(cg_ctx->prog_symtab.global_symtab))["putarray"] = symb;
     }
     {
         struct Symbol symb;
         symb.tag = Tag::Function;
         symb.value.func_type = 0;
-        (*(prog_symtab.global_symtab))["starttime"] = symb;
+        (*(cg_ctx->prog_symtab.global_symtab))["starttime"] = symb;
     }
     {
         struct Symbol symb;
         symb.tag = Tag::Function;
         symb.value.func_type = 0;
-        (*(prog_symtab.global_symtab))["stoptime"] = symb;
+        (*(cg_ctx->prog_symtab.global_symtab))["stoptime"] = symb;
     }
 }
\ No newline at end of file
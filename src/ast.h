@@ -57,16 +57,6 @@ ConstExp      ::= Exp;
 
 using veci=vector<int>;
 
-// The most minimum valid id of temporary variables of the KoopaIR program
-extern int min_temp_id;
-// The operand that will be used during current dump
-extern string op_num;
-// The function parameters when calling a function
-extern vector<string> params;
-// The minimum valid id to help to distinguish identifiers with the same name
-extern int var_id;
-// The minimum valid block id to build branches
-extern int block_id;
 // Tagged Union to represent a symbol
 enum class Tag { Constant, Variable, Function, Array, Pointer };
 struct Symbol {
@@ -222,26 +212,51 @@ public:
 
 // Record information of a while loop
 struct WhileInfo {
-    int entry_blk_id;
+    int entry_blk_id;  // the test at the bottom, where continue goes
     int end_blk_id;
 };
 
-// Symbol Table
-extern ProgSymTab prog_symtab;
 // To indicate what current instruction is
 enum class INSTR_TYPE { NONE, LOAD, STORE };
-extern enum INSTR_TYPE curr_instr;
-// To indicate a call instruction
-extern bool is_call;
-// Is there an end instr (ret, jump or br) in current koopaIR block?
-extern bool ret_in_blk;
-// Is there an jump instr (jump, br) in current koopaIR block?
-extern bool jump_in_blk;
-// while info vector
-extern vector<WhileInfo> vec_while;
 // To indicate a gloabl var or a Local var
 enum class Domain { Global, Local };
-extern enum Domain curr_domain;
+
+/* State of lowering one source file, so that files can be compiled concurrently */
+struct CodegenContext {
+    // The minimum valid id of temporary variables of the KoopaIR program
+    int min_temp_id = 0;
+    // The operand that will be used during current dump
+    string op_num;
+    // The function parameters when calling a function
+    vector<string> params;
+    // Symbol Table
+    ProgSymTab prog_symtab;
+    // To indicate what current instruction is
+    enum INSTR_TYPE curr_instr = INSTR_TYPE::NONE;
+    // Is there an end instr (ret, jump or br) in current koopaIR block?
+    bool ret_in_blk = false;
+    // Is there an jump instr (jump, br) in current koopaIR block?
+    bool jump_in_blk = false;
+    // The minimum valid id to help to distinguish identifiers with the same name
+    int var_id = 0;
+    // The minimum valid block id to build branches
+    int block_id = 0;
+    // while info vector
+    vector<WhileInfo> vec_while;
+    // To indicate a gloabl var or a Local var
+    enum Domain curr_domain = Domain::Global;
+    // To indicate a call instruction
+    bool is_call = false;
+    // The first semantic error met while lowering, empty if none
+    string error;
+
+    void fail(const string &msg) {
+        if (error.empty())
+            error = msg;
+    }
+};
+// Lowering state of the file being compiled by this thread
+extern thread_local CodegenContext *cg_ctx;
 
 // The base class for all ASTs 
 class BaseAST {
@@ -252,8 +267,25 @@ public:
     virtual int cal_val() const = 0;
     virtual void supdump(string &s) const = 0;  // Supplementary dump
     virtual unique_ptr<veci> aggr_init(veci dim) const = 0;  // aggregated init
+    // Branch to %block<true_id> if the value is not 0, else to %block<false_id>
+    virtual void dump_cond(string &s, int true_id, int false_id) const {
+        dump2str(s);
+        s = s + "br " + cg_ctx->op_num + ", %block" + string(to_string(true_id)) + 
+            ", %block" + string(to_string(false_id)) + "\n";
+    }
+    // Evaluating it has no side effects and can not fault
+    virtual bool pure() const { return false; }
 };
 
+// Logical value of an expression in jumping code, merged through a stack slot
+void dump_logic_value(const BaseAST *exp, string &s);
+// Logical value of an expression as "ne value, 0"
+void dump_ne_zero(const BaseAST *exp, string &s);
+// Initialize a local array @name of dims dim (innermost first) with init, in row-major order
+void dump_local_array_init(const string &name, const veci &dim, const veci &init, string &s);
+// Initializer of a global array, with zeroinit for all-zero subarrays
+string global_init(const veci &dim, const veci &init);
+
 class OriginCompUnitAST : public BaseAST {
 public:
     unique_ptr<BaseAST> comp_unit;
@@ -273,10 +305,10 @@ public:
     unique_ptr<BaseAST> comp_unit_ptr;
 
     void dump2str(string &s) const override {
-        curr_domain = Domain::Global;
+        cg_ctx->curr_domain = Domain::Global;
         if (comp_unit)
             comp_unit->dump2str(s);
-        curr_domain = Domain::Global;
+        cg_ctx->curr_domain = Domain::Global;
         comp_unit_ptr->dump2str(s);
     }
     void insert2symtab() const override {}
@@ -339,12 +371,12 @@ public:
             string instr("");
             string name = ident;
             struct Symbol symb;
-            if (curr_domain == Domain::Local) {
-                if (prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
+            if (cg_ctx->curr_domain == Domain::Local) {
+                if (cg_ctx->prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
                     instr = instr + "@" + name + " = alloc ";
                 }
             } else {
-                if (prog_symtab.find_global_symbol(symb, name)) {
+                if (cg_ctx->prog_symtab.find_global_symbol(symb, name)) {
                     instr = instr + "global @" + name + " = alloc ";
                 }
             }
@@ -360,81 +392,13 @@ public:
             s += instr;
             // init
             unique_ptr<veci> init_val = const_init_val->aggr_init(dim);
-            if (curr_domain == Domain::Local) {
+            if (cg_ctx->curr_domain == Domain::Local) {
                 // local stored init
                 s += "\n";
-                vector<veci> vpos;
-                int total_num = 1;
-                for (int j = 0; j < dim.size(); ++j)
-                    total_num *= dim[j];
-                int repeat_num = 1;
-                for (int j = 0; j < dim.size(); ++j) {
-                    veci vp;
-                    vp.clear();
-                    int out_repeat = total_num / (dim[j] * repeat_num);
-                    for (int t = 0; t < out_repeat; ++t) {
-                        for (int k = 0; k < dim[j]; ++k) {
-                            for (int p = 0; p < repeat_num; ++p) {
-                                vp.push_back(k);
-                            }
-                        }
-                    }
-                    repeat_num *= dim[j];
-                    vpos.push_back(vp);
-                }
-                for (int j = 0; j < total_num; ++j) {
-                    veci pos;  // one pos
-                    for (int k = dim.size() - 1; k >= 0; --k) {
-                        pos.push_back(vpos[k][j]);
-                    }
-                    struct Symbol symb;
-                    string name = ident;
-                    if (!(prog_symtab.curr_func_symtab->find_local_symbol(symb, name)))
-                        cerr << "cannot find arr symbol\n";
-                    for (int k = 0; k < pos.size(); ++k) {
-                        string new_op_num = "%" + string(to_string(min_temp_id));
-                        min_temp_id++;
-                        string src_ptr("");
-                        if (k == 0)
-                            src_ptr = "@" + name;
-                        else
-                            src_ptr = op_num;
-                        s = s + new_op_num + " = getelemptr " + src_ptr + ", " + 
-                            string(to_string(pos[k])) + "\n";
-                        op_num = new_op_num;
-                    }
-                    s = s + "store " + string(to_string((*init_val)[j])) + ", " + 
-                        op_num + "\n";
-                }
+                dump_local_array_init(name, dim, *init_val, s);
             } else {
                 // global aggregated init
-                s += ", ";
-                vector<string> sv;
-                for (int j = 0; j < init_val->size(); ++j) {
-                    sv.push_back(string(to_string((*init_val)[j])));
-                }
-                vector<string> tsv; // temp string vector
-                for (int j = 0; j < dim.size(); ++j) {
-                    tsv.clear();
-                    int k = 0;
-                    while (k < sv.size()) {
-                        string temp_s("");
-                        temp_s += "{";
-                        for (int p = k; p < k + dim[j]; ++p) {
-                            temp_s += sv[p];
-                            if (p < k + dim[j] - 1)
-                                temp_s += ", ";
-                        }
-                        temp_s += "}";
-                        k += dim[j];
-                        tsv.push_back(temp_s);
-                    }
-                    sv.clear();
-                    for (int t = 0; t < tsv.size(); ++t) {
-                        sv.push_back(tsv[t]);
-                    }
-                }
-                s += sv[0] + "\n";
+                s += ", " + global_init(dim, *init_val) + "\n";
             }
         }
     }
@@ -443,21 +407,21 @@ public:
             struct Symbol symb;
             symb.tag = Tag::Constant;
             symb.value.const_val = const_init_val->cal_val();
-            if (curr_domain == Domain::Local) {
-                (*(prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
+            if (cg_ctx->curr_domain == Domain::Local) {
+                (*(cg_ctx->prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
             } else {
-                (*(prog_symtab.global_symtab))[ident] = symb;
+                (*(cg_ctx->prog_symtab.global_symtab))[ident] = symb;
             }
         } else {
             struct Symbol symb;
             symb.tag = Tag::Array;
-            symb.value.arr_info.arr_aux_id = var_id;
-            var_id++;
+            symb.value.arr_info.arr_aux_id = cg_ctx->var_id;
+            cg_ctx->var_id++;
             symb.value.arr_info.dim = vec_const_exp->size();
-            if (curr_domain == Domain::Local) {
-                (*(prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
+            if (cg_ctx->curr_domain == Domain::Local) {
+                (*(cg_ctx->prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
             } else {
-                (*(prog_symtab.global_symtab))[ident] = symb;
+                (*(cg_ctx->prog_symtab.global_symtab))[ident] = symb;
             }
         }
     }
@@ -571,13 +535,13 @@ public:
         string instr("");
         string name = ident;
         struct Symbol symb;
-        if (curr_domain == Domain::Local) {
-            if (prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
+        if (cg_ctx->curr_domain == Domain::Local) {
+            if (cg_ctx->prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
                 instr = instr + "@" + name + " = alloc i32\n";
                 s += instr;
             }
         } else {
-            if (prog_symtab.find_global_symbol(symb, name)) {
+            if (cg_ctx->prog_symtab.find_global_symbol(symb, name)) {
                 instr = instr + "global @" + name + " = alloc i32, ";
                 int val = symb.value.var_sym.val;
                 instr = instr + string(to_string(val)) + "\n";
@@ -591,12 +555,12 @@ public:
         symb.tag = Tag::Variable;
         symb.value.var_sym.init = false;
         symb.value.var_sym.val = 0;
-        symb.value.var_sym.aux_id = var_id;
-        var_id++;
-        if (curr_domain == Domain::Local) {
-            (*(prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
+        symb.value.var_sym.aux_id = cg_ctx->var_id;
+        cg_ctx->var_id++;
+        if (cg_ctx->curr_domain == Domain::Local) {
+            (*(cg_ctx->prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
         } else {
-            (*(prog_symtab.global_symtab))[ident] = symb;
+            (*(cg_ctx->prog_symtab.global_symtab))[ident] = symb;
         }
     }
     int cal_val() const override { return 0; }
@@ -613,17 +577,17 @@ public:
         insert2symtab();
         string name = ident;
         struct Symbol symb;
-        if (curr_domain == Domain::Local) {
-            if (prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
+        if (cg_ctx->curr_domain == Domain::Local) {
+            if (cg_ctx->prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
                 s = s + "@" + name + " = alloc i32\n";
-                curr_instr = INSTR_TYPE::LOAD;
+                cg_ctx->curr_instr = INSTR_TYPE::LOAD;
                 init_val->dump2str(s);
-                curr_instr = INSTR_TYPE::STORE;
-                s = s + "store " + op_num + ", @" + name + "\n";
-                curr_instr = INSTR_TYPE::NONE;
+                cg_ctx->curr_instr = INSTR_TYPE::STORE;
+                s = s + "store " + cg_ctx->op_num + ", @" + name + "\n";
+                cg_ctx->curr_instr = INSTR_TYPE::NONE;
             }
         } else {
-            if (prog_symtab.find_global_symbol(symb, name)) {
+            if (cg_ctx->prog_symtab.find_global_symbol(symb, name)) {
                 s = s + "global @" + name + " = alloc i32, ";
                 int val = symb.value.var_sym.val;
                 s = s + string(to_string(val)) + "\n";
@@ -635,15 +599,15 @@ public:
         struct Symbol symb;
         symb.tag = Tag::Variable;
         symb.value.var_sym.init = true;
-        symb.value.var_sym.aux_id = var_id;
-        var_id++; 
+        symb.value.var_sym.aux_id = cg_ctx->var_id;
+        cg_ctx->var_id++; 
         // note that it is a run-time value actually
-        if (curr_domain == Domain::Local) {
+        if (cg_ctx->curr_domain == Domain::Local) {
             symb.value.var_sym.val = 0;
-            (*(prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
+            (*(cg_ctx->prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
         } else {
             symb.value.var_sym.val = init_val->cal_val();
-            (*(prog_symtab.global_symtab))[ident] = symb;
+            (*(cg_ctx->prog_symtab.global_symtab))[ident] = symb;
         }
     }
     int cal_val() const override { return 0; } 
@@ -670,12 +634,12 @@ public:
         string instr("");
         string name = ident;
         struct Symbol symb;
-        if (curr_domain == Domain::Local) {
-            if (prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
+        if (cg_ctx->curr_domain == Domain::Local) {
+            if (cg_ctx->prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
                 instr = instr + "@" + name + " = alloc ";
             }
         } else {
-            if (prog_symtab.find_global_symbol(symb, name)) {
+            if (cg_ctx->prog_symtab.find_global_symbol(symb, name)) {
                 instr = instr + "global @" + name + " = alloc ";
             }
         }
@@ -692,84 +656,16 @@ public:
         // init
         if (init_val) {
             unique_ptr<veci> init_v = init_val->aggr_init(dim);
-            if (curr_domain == Domain::Local) {
+            if (cg_ctx->curr_domain == Domain::Local) {
                 // local stored init
                 s += "\n";
-                vector<veci> vpos;
-                int total_num = 1;
-                for (int j = 0; j < dim.size(); ++j)
-                    total_num *= dim[j];
-                int repeat_num = 1;
-                for (int j = 0; j < dim.size(); ++j) {
-                    veci vp;
-                    vp.clear();
-                    int out_repeat = total_num / (dim[j] * repeat_num);
-                    for (int t = 0; t < out_repeat; ++t) {
-                        for (int k = 0; k < dim[j]; ++k) {
-                            for (int p = 0; p < repeat_num; ++p) {
-                                vp.push_back(k);
-                            }
-                        }
-                    }
-                    repeat_num *= dim[j];
-                    vpos.push_back(vp);
-                }
-                for (int j = 0; j < total_num; ++j) {
-                    veci pos;  // one pos
-                    for (int k = dim.size() - 1; k >= 0; --k) {
-                        pos.push_back(vpos[k][j]);
-                    }
-                    struct Symbol symb;
-                    string name = ident;
-                    if (!(prog_symtab.curr_func_symtab->find_local_symbol(symb, name)))
-                        cerr << "cannot find arr symbol\n";
-                    for (int k = 0; k < pos.size(); ++k) {
-                        string new_op_num = "%" + string(to_string(min_temp_id));
-                        min_temp_id++;
-                        string src_ptr("");
-                        if (k == 0)
-                            src_ptr = "@" + name;
-                        else
-                            src_ptr = op_num;
-                        s = s + new_op_num + " = getelemptr " + src_ptr + ", " + 
-                            string(to_string(pos[k])) + "\n";
-                        op_num = new_op_num;
-                    }
-                    s = s + "store " + string(to_string((*init_v)[j])) + ", " + 
-                        op_num + "\n";
-                }
+                dump_local_array_init(name, dim, *init_v, s);
             } else {
                 // global aggregated init
-                s += ", ";
-                vector<string> sv;
-                for (int j = 0; j < init_v->size(); ++j) {
-                    sv.push_back(string(to_string((*init_v)[j])));
-                }
-                vector<string> tsv; // temp string vector
-                for (int j = 0; j < dim.size(); ++j) {
-                    tsv.clear();
-                    int k = 0;
-                    while (k < sv.size()) {
-                        string temp_s("");
-                        temp_s += "{";
-                        for (int p = k; p < k + dim[j]; ++p) {
-                            temp_s += sv[p];
-                            if (p < k + dim[j] - 1)
-                                temp_s += ", ";
-                        }
-                        temp_s += "}";
-                        k += dim[j];
-                        tsv.push_back(temp_s);
-                    }
-                    sv.clear();
-                    for (int t = 0; t < tsv.size(); ++t) {
-                        sv.push_back(tsv[t]);
-                    }
-                }
-                s += sv[0] + "\n";
+                s += ", " + global_init(dim, *init_v) + "\n";
             }
         } else {
-            if (curr_domain == Domain::Global) {
+            if (cg_ctx->curr_domain == Domain::Global) {
                 // // global aggregated init
                 // veci init_v;
                 // int total_num = 1;
@@ -814,13 +710,13 @@ public:
     void insert2symtab() const override {
         struct Symbol symb;
         symb.tag = Tag::Array;
-        symb.value.arr_info.arr_aux_id = var_id;
-        var_id++;
+        symb.value.arr_info.arr_aux_id = cg_ctx->var_id;
+        cg_ctx->var_id++;
         symb.value.arr_info.dim = vec_const_exp->size();
-        if (curr_domain == Domain::Local) {
-            (*(prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
+        if (cg_ctx->curr_domain == Domain::Local) {
+            (*(cg_ctx->prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
         } else {
-            (*(prog_symtab.global_symtab))[ident] = symb;
+            (*(cg_ctx->prog_symtab.global_symtab))[ident] = symb;
         }
     }
     int cal_val() const override { return 0; } 
@@ -833,9 +729,9 @@ public:
     unique_ptr<BaseAST> exp;
 
     void dump2str(string &s) const override {
-        curr_instr = INSTR_TYPE::LOAD;
+        cg_ctx->curr_instr = INSTR_TYPE::LOAD;
         exp->dump2str(s);
-        curr_instr = INSTR_TYPE::NONE;
+        cg_ctx->curr_instr = INSTR_TYPE::NONE;
     }
     void insert2symtab() const override {}
     int cal_val() const override { 
@@ -854,23 +750,23 @@ public:
 
     void dump2str(string & s) const override {
         insert2symtab();
-        curr_domain = Domain::Local;
-        ret_in_blk = false;
-        jump_in_blk = false;
-        prog_symtab.create_func_symtab();
+        cg_ctx->curr_domain = Domain::Local;
+        cg_ctx->ret_in_blk = false;
+        cg_ctx->jump_in_blk = false;
+        cg_ctx->prog_symtab.create_func_symtab();
         s += "fun @";
         s += ident;
         s += "(";
         if (func_fparams) {
-            prog_symtab.curr_func_symtab->insert_block_symtab();
+            cg_ctx->prog_symtab.curr_func_symtab->insert_block_symtab();
             func_fparams->dump2str(s);
         }
         s += ")";
         func_type->dump2str(s);
         s += "{\n";
         s += "%";
-        s += "entry" + string(to_string(block_id)) + ":\n";
-        block_id++;
+        s += "entry" + string(to_string(cg_ctx->block_id)) + ":\n";
+        cg_ctx->block_id++;
         if (func_fparams) {
             func_fparams->supdump(s);
         }
@@ -878,15 +774,15 @@ public:
         check_empty_block(s, func_type->cal_val());  // check if there's an empty block at the end
         s += "}\n\n";
         if (func_fparams) {
-            prog_symtab.curr_func_symtab->delete_curr_block_symtab();
+            cg_ctx->prog_symtab.curr_func_symtab->delete_curr_block_symtab();
         }
-        prog_symtab.delete_func_symtab();
+        cg_ctx->prog_symtab.delete_func_symtab();
     }
     void insert2symtab() const override {
         struct Symbol symb;
         symb.tag = Tag::Function;
         symb.value.func_type = func_type->cal_val();
-        (*(prog_symtab.global_symtab))[ident] = symb;
+        (*(cg_ctx->prog_symtab.global_symtab))[ident] = symb;
     }
     int cal_val() const override { return 0; }
     void supdump(string &s) const override {}
@@ -955,7 +851,7 @@ public:
         insert2symtab();
         string name = ident;
         struct Symbol symb;
-        if (prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
+        if (cg_ctx->prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
             if (symb.tag == Tag::Variable) {
                 s = s + "@" + name + ": i32";
             } else {  // ptr, arr param
@@ -988,30 +884,30 @@ public:
             symb.tag = Tag::Variable;
             symb.value.var_sym.init = false;
             symb.value.var_sym.val = 0;
-            symb.value.var_sym.aux_id = var_id;
-            var_id++;
+            symb.value.var_sym.aux_id = cg_ctx->var_id;
+            cg_ctx->var_id++;
         } else {
             symb.tag = Tag::Pointer;
-            symb.value.ptr_info.ptr_aux_id = var_id;
-            var_id++;
+            symb.value.ptr_info.ptr_aux_id = cg_ctx->var_id;
+            cg_ctx->var_id++;
             symb.value.ptr_info.dim = vec_const_exp->size();
         }
-        (*(prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
+        (*(cg_ctx->prog_symtab.curr_func_symtab->curr_block_symtab->local_symtab))[ident] = symb;
     }
     int cal_val() const override { return 0; }
     void supdump(string &s) const override {
         string name = ident;
         struct Symbol symb;
-        if (prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
+        if (cg_ctx->prog_symtab.curr_func_symtab->find_local_symbol(symb, name)) {
             insert2symtab();
             struct Symbol new_symb;
             string new_name = ident;
-            if (prog_symtab.curr_func_symtab->find_local_symbol(new_symb, new_name)) {
+            if (cg_ctx->prog_symtab.curr_func_symtab->find_local_symbol(new_symb, new_name)) {
                 if (new_symb.tag == Tag::Variable) {
                     s = s + "@" + new_name + " = alloc i32\n";
-                    curr_instr = INSTR_TYPE::STORE;
+                    cg_ctx->curr_instr = INSTR_TYPE::STORE;
                     s = s + "store @" + name + ", @" + new_name + "\n";
-                    curr_instr = INSTR_TYPE::NONE;
+                    cg_ctx->curr_instr = INSTR_TYPE::NONE;
                 } else {
                     s = s + "@" + new_name + " = alloc ";
                     if (vec_const_exp->size() == 0) {
@@ -1033,9 +929,9 @@ public:
                         }
                         s = s + "*" + len + "\n";
                     }
-                    curr_instr = INSTR_TYPE::STORE;
+                    cg_ctx->curr_instr = INSTR_TYPE::STORE;
                     s = s + "store @" + name + ", @" + new_name + "\n";
-                    curr_instr = INSTR_TYPE::NONE;
+                    cg_ctx->curr_instr = INSTR_TYPE::NONE;
                 }
             }
         }
@@ -1050,11 +946,11 @@ public:
     void dump2str(string &s) const override {
         if (!vec_block_item)
             return;
-        prog_symtab.curr_func_symtab->insert_block_symtab();
+        cg_ctx->prog_symtab.curr_func_symtab->insert_block_symtab();
         for (int i = 0; i < vec_block_item->size(); ++i) {
             (*vec_block_item)[i]->dump2str(s);
         }
-        prog_symtab.curr_func_symtab->delete_curr_block_symtab();
+        cg_ctx->prog_symtab.curr_func_symtab->delete_curr_block_symtab();
     }
     void insert2symtab() const override {}
     int cal_val() const override { return 0; }
@@ -1067,7 +963,7 @@ public:
     unique_ptr<BaseAST> block_item_ptr;
 
     void dump2str(string &s) const override {
-        if (ret_in_blk || jump_in_blk)
+        if (cg_ctx->ret_in_blk || cg_ctx->jump_in_blk)
             return;
         block_item_ptr->dump2str(s);
     }
@@ -1109,25 +1005,23 @@ public:  // if (Exp) Stmt
     unique_ptr<BaseAST> stmt;
 
     void dump2str(string &s) const override {
-        int then_blk_id = block_id;
-        int end_blk_id = block_id + 1;
-        block_id += 2;
-        curr_instr = INSTR_TYPE::LOAD;
-        exp->dump2str(s);
-        curr_instr = INSTR_TYPE::NONE;
-        s = s + "br " + op_num + ", %block" + string(to_string(then_blk_id)) + 
-            ", %block" + string(to_string(end_blk_id)) + "\n";
+        int then_blk_id = cg_ctx->block_id;
+        int end_blk_id = cg_ctx->block_id + 1;
+        cg_ctx->block_id += 2;
+        cg_ctx->curr_instr = INSTR_TYPE::LOAD;
+        exp->dump_cond(s, then_blk_id, end_blk_id);
+        cg_ctx->curr_instr = INSTR_TYPE::NONE;
         
         s = s + "\n%block" + string(to_string(then_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
+        cg_ctx->ret_in_blk = false;
+        cg_ctx->jump_in_blk = false;
         stmt->dump2str(s);
-        if (!ret_in_blk && !jump_in_blk)
+        if (!cg_ctx->ret_in_blk && !cg_ctx->jump_in_blk)
             s = s + "jump %block" + string(to_string(end_blk_id)) + "\n";
         
         s = s + "\n%block" + string(to_string(end_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
+        cg_ctx->ret_in_blk = false;
+        cg_ctx->jump_in_blk = false;
     }
     void insert2symtab() const override {}
     int cal_val() const override { return 0; }
@@ -1142,36 +1036,34 @@ public:  // if (Exp) ClosedStmt else OpenStmt
     unique_ptr<BaseAST> open_stmt;
 
     void dump2str(string &s) const override {
-        int then_blk_id = block_id, else_blk_id = block_id + 1;
-        int end_blk_id = block_id + 2;
-        block_id += 3;
-        curr_instr = INSTR_TYPE::LOAD;
-        exp->dump2str(s);
-        curr_instr = INSTR_TYPE::NONE;
-        s = s + "br " + op_num + ", %block" + string(to_string(then_blk_id)) + 
-            ", %block" + string(to_string(else_blk_id)) + "\n";
+        int then_blk_id = cg_ctx->block_id, else_blk_id = cg_ctx->block_id + 1;
+        int end_blk_id = cg_ctx->block_id + 2;
+        cg_ctx->block_id += 3;
+        cg_ctx->curr_instr = INSTR_TYPE::LOAD;
+        exp->dump_cond(s, then_blk_id, else_blk_id);
+        cg_ctx->curr_instr = INSTR_TYPE::NONE;
         
         s = s + "\n%block" + string(to_string(then_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
+        cg_ctx->ret_in_blk = false;
+        cg_ctx->jump_in_blk = false;
         closed_stmt->dump2str(s);
-        if (!ret_in_blk && !jump_in_blk)
+        if (!cg_ctx->ret_in_blk && !cg_ctx->jump_in_blk)
             s = s + "jump %block" + string(to_string(end_blk_id)) + "\n";
-        int ret_in_then = ret_in_blk;
+        int ret_in_then = cg_ctx->ret_in_blk;
         
         s = s + "\n%block" + string(to_string(else_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
+        cg_ctx->ret_in_blk = false;
+        cg_ctx->jump_in_blk = false;
         open_stmt->dump2str(s);
-        if (!ret_in_blk && !jump_in_blk)
+        if (!cg_ctx->ret_in_blk && !cg_ctx->jump_in_blk)
             s = s + "jump %block" + string(to_string(end_blk_id)) + "\n";
-        int ret_in_else = ret_in_blk;
+        int ret_in_else = cg_ctx->ret_in_blk;
 
         if (ret_in_then && ret_in_else)
             return;
         s = s + "\n%block" + string(to_string(end_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
+        cg_ctx->ret_in_blk = false;
+        cg_ctx->jump_in_blk = false;
     }
     void insert2symtab() const override {}
     int cal_val() const override { return 0; }
@@ -1199,36 +1091,34 @@ public:  // if (Exp) ClosedStmt else OpenStmt
     unique_ptr<BaseAST> closed_stmt_else;
 
     void dump2str(string &s) const override {
-        int then_blk_id = block_id, else_blk_id = block_id + 1;
-        int end_blk_id = block_id + 2;
-        block_id += 3;
-        curr_instr = INSTR_TYPE::LOAD;
-        exp->dump2str(s);
-        curr_instr = INSTR_TYPE::NONE;
-        s = s + "br " + op_num + ", %block" + string(to_string(then_blk_id)) + 
-            ", %block" + string(to_string(else_blk_id)) + "\n";
+        int then_blk_id = cg_ctx->block_id, else_blk_id = cg_ctx->block_id + 1;
+        int end_blk_id = cg_ctx->block_id + 2;
+        cg_ctx->block_id += 3;
+        cg_ctx->curr_instr = INSTR_TYPE::LOAD;
+        exp->dump_cond(s, then_blk_id, else_blk_id);
+        cg_ctx->curr_instr = INSTR_TYPE::NONE;
         
         s = s + "\n%block" + string(to_string(then_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
+        cg_ctx->ret_in_blk = false;
+        cg_ctx->jump_in_blk = false;
         closed_stmt_if->dump2str(s);
-        if (!ret_in_blk && !jump_in_blk)
+        if (!cg_ctx->ret_in_blk && !cg_ctx->jump_in_blk)
             s = s + "jump %block" + string(to_string(end_blk_id)) + "\n";
-        int ret_in_then = ret_in_blk;
+        int ret_in_then = cg_ctx->ret_in_blk;
         
         s = s + "\n%block" + string(to_string(else_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
+        cg_ctx->ret_in_blk = false;
+        cg_ctx->jump_in_blk = false;
         closed_stmt_else->dump2str(s);
-        if (!ret_in_blk && !jump_in_blk)
+        if (!cg_ctx->ret_in_blk && !cg_ctx->jump_in_blk)
             s = s + "jump %block" + string(to_string(end_blk_id)) + "\n";
-        int ret_in_else = ret_in_blk;
+        int ret_in_else = cg_ctx->ret_in_blk;
         
         if (ret_in_then && ret_in_else)
             return;
         s = s + "\n%block" + string(to_string(end_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
+        cg_ctx->ret_in_blk = false;
+        cg_ctx->jump_in_blk = false;
     }
     void insert2symtab() const override {}
     int cal_val() const override { return 0; }
@@ -1242,35 +1132,39 @@ public:
     unique_ptr<BaseAST> stmt;
 
     void dump2str(string &s) const override {
-        int entry_blk_id = block_id, body_blk_id = block_id + 1;
-        int end_blk_id = block_id + 2;
-        block_id += 3;
+        // Rotated into "if (cond) do stmt while (cond)", so an iteration
+        // ends with a single branch back instead of a jump and a branch
+        int entry_blk_id = cg_ctx->block_id, body_blk_id = cg_ctx->block_id + 1;
+        int end_blk_id = cg_ctx->block_id + 2;
+        cg_ctx->block_id += 3;
         // Build and insert this while loop's info
         struct WhileInfo while_info;
         while_info.entry_blk_id = entry_blk_id;
         while_info.end_blk_id = end_blk_id;
-        vec_while.push_back(while_info);
+        cg_ctx->vec_while.push_back(while_info);
 
-        s = s + "jump %block" + string(to_string(entry_blk_id)) + "\n";
+        // guard
+        cg_ctx->curr_instr = INSTR_TYPE::LOAD;
+        exp->dump_cond(s, body_blk_id, end_blk_id);
+        cg_ctx->curr_instr = INSTR_TYPE::NONE;
 
-        s = s + "\n%block" + string(to_string(entry_blk_id)) + ":\n";
-        curr_instr = INSTR_TYPE::LOAD;
-        exp->dump2str(s);
-        curr_instr = INSTR_TYPE::NONE;
-        s = s + "br " + op_num + ", %block" + string(to_string(body_blk_id)) + 
-            ", %block" + string(to_string(end_blk_id)) + "\n";
-        
         s = s + "\n%block" + string(to_string(body_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
+        cg_ctx->ret_in_blk = false;
+        cg_ctx->jump_in_blk = false;
         stmt->dump2str(s);
-        if (!ret_in_blk && !jump_in_blk)
+        if (!cg_ctx->ret_in_blk && !cg_ctx->jump_in_blk)
             s = s + "jump %block" + string(to_string(entry_blk_id)) + "\n";
-        vec_while.pop_back();
+        cg_ctx->vec_while.pop_back();
+
+        // test at the bottom
+        s = s + "\n%block" + string(to_string(entry_blk_id)) + ":\n";
+        cg_ctx->curr_instr = INSTR_TYPE::LOAD;
+        exp->dump_cond(s, body_blk_id, end_blk_id);
+        cg_ctx->curr_instr = INSTR_TYPE::NONE;
         
         s = s + "\n%block" + string(to_string(end_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
+        cg_ctx->ret_in_blk = false;
+        cg_ctx->jump_in_blk = false;
     }
     void insert2symtab() const override {}
     int cal_val() const override { return 0; }
@@ -1296,13 +1190,13 @@ public:
     string break_stmt;
 
     void dump2str(string &s) const override {
-        if (vec_while.empty())
+        if (cg_ctx->vec_while.empty())
             return;
-        struct WhileInfo while_info = vec_while[vec_while.size() - 1];
+        struct WhileInfo while_info = cg_ctx->vec_while[cg_ctx->vec_while.size() - 1];
         int end_blk_id = while_info.end_blk_id;
-        if (!ret_in_blk && !jump_in_blk) {
+        if (!cg_ctx->ret_in_blk && !cg_ctx->jump_in_blk) {
             s = s + "jump %block" + string(to_string(end_blk_id)) + "\n";
-            jump_in_blk = true;
+            cg_ctx->jump_in_blk = true;
         }
     }
     void insert2symtab() const override {}
@@ -1316,13 +1210,13 @@ public:
     string continue_stmt;
 
     void dump2str(string &s) const override {
-        if (vec_while.empty())
+        if (cg_ctx->vec_while.empty())
             return;
-        struct WhileInfo while_info = vec_while[vec_while.size() - 1];
+        struct WhileInfo while_info = cg_ctx->vec_while[cg_ctx->vec_while.size() - 1];
         int entry_blk_id = while_info.entry_blk_id;
-        if (!ret_in_blk && !jump_in_blk) {
+        if (!cg_ctx->ret_in_blk && !cg_ctx->jump_in_blk) {
             s = s + "jump %block" + string(to_string(entry_blk_id)) + "\n";
-            jump_in_blk = true;
+            cg_ctx->jump_in_blk = true;
         }
     }
     void insert2symtab() const override {}
@@ -1337,11 +1231,11 @@ public:
     unique_ptr<BaseAST> exp;
 
     void dump2str(string &s) const override {
-        curr_instr = INSTR_TYPE::LOAD;
+        cg_ctx->curr_instr = INSTR_TYPE::LOAD;
         exp->dump2str(s);
-        curr_instr = INSTR_TYPE::STORE;
+        cg_ctx->curr_instr = INSTR_TYPE::STORE;
         lval->dump2str(s);
-        curr_instr = INSTR_TYPE::NONE;
+        cg_ctx->curr_instr = INSTR_TYPE::NONE;
     }
     void insert2symtab() const override {}
     int cal_val() const override { return 0; }
@@ -1355,9 +1249,9 @@ public:
 
     void dump2str(string &s) const override {
         if (exp) {
-            curr_instr = INSTR_TYPE::LOAD;
+            cg_ctx->curr_instr = INSTR_TYPE::LOAD;
             exp->dump2str(s);
-            curr_instr = INSTR_TYPE::NONE;
+            cg_ctx->curr_instr = INSTR_TYPE::NONE;
         }
     }
     void insert2symtab() const override {}
@@ -1371,15 +1265,15 @@ public:
     unique_ptr<BaseAST> exp;
 
     void dump2str(string &s) const override {
-        ret_in_blk = true;
+        cg_ctx->ret_in_blk = true;
         if (exp) {
-            curr_instr = INSTR_TYPE::LOAD;
+            cg_ctx->curr_instr = INSTR_TYPE::LOAD;
             exp->dump2str(s);
-            ret_in_blk = true; // Reclaim "ret", it may be changed by exp->dump2str(s)
+            cg_ctx->ret_in_blk = true; // Reclaim "ret", it may be changed by exp->dump2str(s)
             s += "ret ";
-            s += op_num;
+            s += cg_ctx->op_num;
             s += "\n";
-            curr_instr = INSTR_TYPE::NONE;
+            cg_ctx->curr_instr = INSTR_TYPE::NONE;
         } else {
             s += "ret\n";
         }
@@ -1397,6 +1291,10 @@ public:
     void dump2str(string &s) const override {
         lor_exp->dump2str(s);
     }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        lor_exp->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return lor_exp->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         return lor_exp->cal_val();
@@ -1413,46 +1311,49 @@ public:
     void dump2str(string &s) const override {
         struct Symbol symb;
         string name = ident;
-        if (!prog_symtab.find_symbol(symb, name))
-            cerr << "No such lval\n"; 
+        if (!cg_ctx->prog_symtab.find_symbol(symb, name)) {
+            cg_ctx->fail("undefined identifier '" + name + "'");
+            cg_ctx->op_num = "0";
+            return;
+        }
         if (symb.tag != Tag::Array && symb.tag != Tag::Pointer) {
             if (symb.tag == Tag::Constant) {
-                op_num = string(to_string(symb.value.const_val));
-            } else if (curr_instr == INSTR_TYPE::LOAD) {
+                cg_ctx->op_num = string(to_string(symb.value.const_val));
+            } else if (cg_ctx->curr_instr == INSTR_TYPE::LOAD) {
                 string load_op_num("");
-                load_op_num = load_op_num + "%" + string(to_string(min_temp_id));
-                min_temp_id++;
-                op_num = load_op_num;
+                load_op_num = load_op_num + "%" + string(to_string(cg_ctx->min_temp_id));
+                cg_ctx->min_temp_id++;
+                cg_ctx->op_num = load_op_num;
                 s = s + load_op_num + " = load " + "@" + name + "\n";
-            } else if (curr_instr == INSTR_TYPE::STORE) {
-                string store_op_num = op_num;
+            } else if (cg_ctx->curr_instr == INSTR_TYPE::STORE) {
+                string store_op_num = cg_ctx->op_num;
                 s = s + "store " + store_op_num + ", @" + name + "\n";
             }
         } else {
             if (symb.tag == Tag::Array) {
-                if (curr_instr == INSTR_TYPE::LOAD) {
-                    if (!is_call) {
+                if (cg_ctx->curr_instr == INSTR_TYPE::LOAD) {
+                    if (!cg_ctx->is_call) {
                         if (vec_exp && vec_exp->size() > 0) {
                             for (int i = vec_exp->size() - 1; i >= 0; --i) {
                                 string src_ptr("");
                                 if (i == vec_exp->size() - 1)
                                     src_ptr = "@" + name;
                                 else
-                                    src_ptr = op_num;
+                                    src_ptr = cg_ctx->op_num;
                                 ((*vec_exp)[i])->dump2str(s);
-                                string offset_num = op_num;
-                                string new_op_num = "%" + string(to_string(min_temp_id));
-                                min_temp_id++;
+                                string offset_num = cg_ctx->op_num;
+                                string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                                cg_ctx->min_temp_id++;
                                 s = s + new_op_num + " = getelemptr " + src_ptr + ", " + 
                                     offset_num + "\n";
-                                op_num = new_op_num;
+                                cg_ctx->op_num = new_op_num;
                             }
                         }
                         string load_op_num("");
-                        load_op_num = "%" + string(to_string(min_temp_id));
-                        min_temp_id++;
-                        s = s + load_op_num + " = load " + op_num + "\n";
-                        op_num = load_op_num;
+                        load_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                        cg_ctx->min_temp_id++;
+                        s = s + load_op_num + " = load " + cg_ctx->op_num + "\n";
+                        cg_ctx->op_num = load_op_num;
                     } else {
                         if (vec_exp && vec_exp->size() > 0) {
                             for (int i = vec_exp->size() - 1; i >= 0; --i) {
@@ -1460,198 +1361,205 @@ public:
                                 if (i == vec_exp->size() - 1)
                                     src_ptr = "@" + name;
                                 else
-                                    src_ptr = op_num;
-                                is_call = false;
+                                    src_ptr = cg_ctx->op_num;
+                                cg_ctx->is_call = false;
                                 ((*vec_exp)[i])->dump2str(s);
-                                is_call = true;
-                                string offset_num = op_num;
-                                string new_op_num = "%" + string(to_string(min_temp_id));
-                                min_temp_id++;
+                                cg_ctx->is_call = true;
+                                string offset_num = cg_ctx->op_num;
+                                string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                                cg_ctx->min_temp_id++;
                                 s = s + new_op_num + " = getelemptr " + src_ptr + ", " + 
                                     offset_num + "\n";
-                                op_num = new_op_num;
+                                cg_ctx->op_num = new_op_num;
                             }
                             if (int(vec_exp->size()) < symb.value.arr_info.dim) {
-                                string new_op_num = "%" + string(to_string(min_temp_id));
-                                min_temp_id++;
-                                s = s + new_op_num + " = getelemptr " + op_num + ", 0\n";
-                                op_num = new_op_num;
+                                string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                                cg_ctx->min_temp_id++;
+                                s = s + new_op_num + " = getelemptr " + cg_ctx->op_num + ", 0\n";
+                                cg_ctx->op_num = new_op_num;
                             } else {
-                                string new_op_num = "%" + string(to_string(min_temp_id));
-                                min_temp_id++;
-                                s = s + new_op_num + " = load " + op_num + "\n";
-                                op_num = new_op_num;
+                                string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                                cg_ctx->min_temp_id++;
+                                s = s + new_op_num + " = load " + cg_ctx->op_num + "\n";
+                                cg_ctx->op_num = new_op_num;
                             }
                         } else if (!vec_exp) {
-                            string new_op_num = "%" + string(to_string(min_temp_id));
-                            min_temp_id++;
+                            string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                            cg_ctx->min_temp_id++;
                             s = s + new_op_num + " = getelemptr @" + name + ", 0\n";
-                            op_num = new_op_num;
+                            cg_ctx->op_num = new_op_num;
                         }
                     }
-                } else if (curr_instr == INSTR_TYPE::STORE) {
-                    string store_op_num = op_num;
+                } else if (cg_ctx->curr_instr == INSTR_TYPE::STORE) {
+                    string store_op_num = cg_ctx->op_num;
                     if (vec_exp->size() > 0) {
                         for (int i = vec_exp->size() - 1; i >= 0; --i) {
                             string src_ptr("");
                             if (i == vec_exp->size() - 1)
                                 src_ptr = "@" + name;
                             else
-                                src_ptr = op_num;
-                            curr_instr = INSTR_TYPE::LOAD;
+                                src_ptr = cg_ctx->op_num;
+                            cg_ctx->curr_instr = INSTR_TYPE::LOAD;
                             ((*vec_exp)[i])->dump2str(s);
-                            curr_instr = INSTR_TYPE::STORE;
-                            string offset_num = op_num;
-                            string new_op_num = "%" + string(to_string(min_temp_id));
-                            min_temp_id++;
+                            cg_ctx->curr_instr = INSTR_TYPE::STORE;
+                            string offset_num = cg_ctx->op_num;
+                            string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                            cg_ctx->min_temp_id++;
                             s = s + new_op_num + " = getelemptr " + src_ptr + ", " + 
                                 offset_num + "\n";
-                            op_num = new_op_num;
+                            cg_ctx->op_num = new_op_num;
                         }
                     }
-                    s = s + "store " + store_op_num + ", " + op_num + "\n";
+                    s = s + "store " + store_op_num + ", " + cg_ctx->op_num + "\n";
                 }
             } else if (symb.tag == Tag::Pointer) {
-                if (curr_instr == INSTR_TYPE::LOAD) {
-                    if (!is_call) {
+                if (cg_ctx->curr_instr == INSTR_TYPE::LOAD) {
+                    if (!cg_ctx->is_call) {
                         string first_ptr("");
-                        first_ptr = "%" + string(to_string(min_temp_id));
-                        min_temp_id++;
+                        first_ptr = "%" + string(to_string(cg_ctx->min_temp_id));
+                        cg_ctx->min_temp_id++;
                         s = s + first_ptr + " = load @" + name + "\n";
-                        op_num = first_ptr;
+                        cg_ctx->op_num = first_ptr;
                         string second_ptr("");
-                        second_ptr = "%" + string(to_string(min_temp_id));
-                        min_temp_id++;
+                        second_ptr = "%" + string(to_string(cg_ctx->min_temp_id));
+                        cg_ctx->min_temp_id++;
                         if (vec_exp && vec_exp->size() > 0) {
                             string first_offset("");
                             (*vec_exp)[vec_exp->size() - 1]->dump2str(s);
-                            first_offset = op_num;
+                            first_offset = cg_ctx->op_num;
                             s = s + second_ptr + " = getptr " + first_ptr + ", " + 
                                 first_offset + "\n";
-                            op_num = second_ptr;
+                            cg_ctx->op_num = second_ptr;
                             if (vec_exp->size() > 1) {
                                 for (int i = vec_exp->size() - 2; i >= 0; --i) {
-                                    string src_ptr = op_num;
+                                    string src_ptr = cg_ctx->op_num;
                                     ((*vec_exp)[i])->dump2str(s);
-                                    string offset_num = op_num;
-                                    string new_op_num = "%" + string(to_string(min_temp_id));
-                                    min_temp_id++;
+                                    string offset_num = cg_ctx->op_num;
+                                    string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                                    cg_ctx->min_temp_id++;
                                     s = s + new_op_num + " = getelemptr " + src_ptr + 
                                         ", " + offset_num + "\n";
-                                    op_num = new_op_num;
+                                    cg_ctx->op_num = new_op_num;
                                 }
                             }
                         } else {
                             s = s + second_ptr + " = getptr " + first_ptr + ", 0\n";
-                            op_num = second_ptr;
+                            cg_ctx->op_num = second_ptr;
                         }
                         string load_op_num("");
-                        load_op_num = "%" + string(to_string(min_temp_id));
-                        min_temp_id++;
-                        s = s + load_op_num + " = load " + op_num + "\n";
-                        op_num = load_op_num;
+                        load_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                        cg_ctx->min_temp_id++;
+                        s = s + load_op_num + " = load " + cg_ctx->op_num + "\n";
+                        cg_ctx->op_num = load_op_num;
                     } else {
                         string first_ptr("");
-                        first_ptr = "%" + string(to_string(min_temp_id));
-                        min_temp_id++;
+                        first_ptr = "%" + string(to_string(cg_ctx->min_temp_id));
+                        cg_ctx->min_temp_id++;
                         s = s + first_ptr + " = load @" + name + "\n";
-                        op_num = first_ptr;
+                        cg_ctx->op_num = first_ptr;
                         string second_ptr("");
-                        second_ptr = "%" + string(to_string(min_temp_id));
-                        min_temp_id++;
+                        second_ptr = "%" + string(to_string(cg_ctx->min_temp_id));
+                        cg_ctx->min_temp_id++;
                         if (vec_exp && vec_exp->size() > 0) {
                             string first_offset("");
-                            is_call = false;
+                            cg_ctx->is_call = false;
                             (*vec_exp)[vec_exp->size() - 1]->dump2str(s);
-                            is_call = true;
-                            first_offset = op_num;
+                            cg_ctx->is_call = true;
+                            first_offset = cg_ctx->op_num;
                             s = s + second_ptr + " = getptr " + first_ptr + ", " + 
                                 first_offset + "\n";
-                            op_num = second_ptr;
+                            cg_ctx->op_num = second_ptr;
                             if (vec_exp->size() > 1) {
                                 for (int i = vec_exp->size() - 2; i >= 0; --i) {
-                                    string src_ptr = op_num;
-                                    is_call = false;
+                                    string src_ptr = cg_ctx->op_num;
+                                    cg_ctx->is_call = false;
                                     ((*vec_exp)[i])->dump2str(s);
-                                    is_call = true;
-                                    string offset_num = op_num;
-                                    string new_op_num = "%" + string(to_string(min_temp_id));
-                                    min_temp_id++;
+                                    cg_ctx->is_call = true;
+                                    string offset_num = cg_ctx->op_num;
+                                    string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                                    cg_ctx->min_temp_id++;
                                     s = s + new_op_num + " = getelemptr " + src_ptr + 
                                         ", " + offset_num + "\n";
-                                    op_num = new_op_num;
+                                    cg_ctx->op_num = new_op_num;
                                 }
                             }
                             if (int(vec_exp->size()) == symb.value.ptr_info.dim + 1) {
-                                string new_op_num = "%" + string(to_string(min_temp_id));
-                                min_temp_id++;
-                                s = s + new_op_num + " = load " + op_num + "\n";
-                                op_num = new_op_num;
+                                string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                                cg_ctx->min_temp_id++;
+                                s = s + new_op_num + " = load " + cg_ctx->op_num + "\n";
+                                cg_ctx->op_num = new_op_num;
                             } else {
-                                string new_op_num = "%" + string(to_string(min_temp_id));
-                                min_temp_id++;
-                                s = s + new_op_num + " = getelemptr " + op_num + ", 0\n";
-                                op_num = new_op_num;
+                                string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                                cg_ctx->min_temp_id++;
+                                s = s + new_op_num + " = getelemptr " + cg_ctx->op_num + ", 0\n";
+                                cg_ctx->op_num = new_op_num;
                             }
                         } else {
                             s = s + second_ptr + " = getptr " + first_ptr + ", 0\n";
-                            op_num = second_ptr;
+                            cg_ctx->op_num = second_ptr;
                         }
                     }
-                } else if (curr_instr == INSTR_TYPE::STORE) {
-                    string store_op_num = op_num;
+                } else if (cg_ctx->curr_instr == INSTR_TYPE::STORE) {
+                    string store_op_num = cg_ctx->op_num;
                     string first_ptr("");
-                    first_ptr = "%" + string(to_string(min_temp_id));
-                    min_temp_id++;
+                    first_ptr = "%" + string(to_string(cg_ctx->min_temp_id));
+                    cg_ctx->min_temp_id++;
                     s = s + first_ptr + " = load @" + name + "\n";
-                    op_num = first_ptr;
+                    cg_ctx->op_num = first_ptr;
                     string second_ptr("");
-                    second_ptr = "%" + string(to_string(min_temp_id));
-                    min_temp_id++;
+                    second_ptr = "%" + string(to_string(cg_ctx->min_temp_id));
+                    cg_ctx->min_temp_id++;
                     if (vec_exp && vec_exp->size() > 0) {
                         string first_offset("");
-                        curr_instr = INSTR_TYPE::LOAD;
+                        cg_ctx->curr_instr = INSTR_TYPE::LOAD;
                         (*vec_exp)[vec_exp->size() - 1]->dump2str(s);
-                        curr_instr = INSTR_TYPE::STORE;
-                        first_offset = op_num;
+                        cg_ctx->curr_instr = INSTR_TYPE::STORE;
+                        first_offset = cg_ctx->op_num;
                         s = s + second_ptr + " = getptr " + first_ptr + ", " + 
                             first_offset + "\n";
-                        op_num = second_ptr;
+                        cg_ctx->op_num = second_ptr;
                         if (vec_exp->size() > 1) {
                             for (int i = vec_exp->size() - 2; i >= 0; --i) {
-                                string src_ptr = op_num;
-                                curr_instr = INSTR_TYPE::LOAD;
+                                string src_ptr = cg_ctx->op_num;
+                                cg_ctx->curr_instr = INSTR_TYPE::LOAD;
                                 ((*vec_exp)[i])->dump2str(s);
-                                curr_instr = INSTR_TYPE::STORE;
-                                string offset_num = op_num;
-                                string new_op_num = "%" + string(to_string(min_temp_id));
-                                min_temp_id++;
+                                cg_ctx->curr_instr = INSTR_TYPE::STORE;
+                                string offset_num = cg_ctx->op_num;
+                                string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+                                cg_ctx->min_temp_id++;
                                 s = s + new_op_num + " = getelemptr " + src_ptr + 
                                     ", " + offset_num + "\n";
-                                op_num = new_op_num;
+                                cg_ctx->op_num = new_op_num;
                             }
                         }
                     } else {
                         s = s + second_ptr + " = getptr " + first_ptr + ", 0\n";
-                        op_num = second_ptr;
+                        cg_ctx->op_num = second_ptr;
                     }
-                    s = s + "store " + store_op_num + ", " + op_num + "\n";
+                    s = s + "store " + store_op_num + ", " + cg_ctx->op_num + "\n";
                 }
             }
         }
     }
+    bool pure() const override {
+        // a scalar, elements of arrays may be out of range
+        struct Symbol symb;
+        string name = ident;
+        return cg_ctx->prog_symtab.find_symbol(symb, name) &&
+               symb.tag != Tag::Array && symb.tag != Tag::Pointer;
+    }
     void insert2symtab() const override {}
     int cal_val() const override {
         struct Symbol symb;
         string name = ident;
-        if (prog_symtab.find_symbol(symb, name)) {
+        if (cg_ctx->prog_symtab.find_symbol(symb, name)) {
             if (symb.tag == Tag::Constant) {
                 return symb.value.const_val;
             } else {
                 return symb.value.var_sym.val;
             } 
         } else {
-            cerr << "error: undefined lval!" << endl;
+            cg_ctx->fail("undefined identifier '" + name + "'");
         }
         return 0;
     }
@@ -1666,6 +1574,10 @@ public:
     void dump2str(string &s) const override {
         primary_ptr->dump2str(s);
     }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        primary_ptr->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return primary_ptr->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override { 
         return primary_ptr->cal_val();
@@ -1679,8 +1591,9 @@ public:
     int number;
 
     void dump2str(string &s) const override {
-        op_num = string(to_string(number));
+        cg_ctx->op_num = string(to_string(number));
     }
+    bool pure() const override { return true; }
     void insert2symtab() const override {}
     int cal_val() const override { 
         return number;
@@ -1696,6 +1609,10 @@ public:
     void dump2str(string &s) const override {
         unary_ptr->dump2str(s);
     }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        unary_ptr->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return unary_ptr->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override { 
         return unary_ptr->cal_val(); 
@@ -1710,7 +1627,7 @@ public:
     unique_ptr<BaseAST> func_rparams;
 
     void dump2str(string &s) const override {
-        is_call = true;
+        cg_ctx->is_call = true;
         int num_params = 0;
         if (func_rparams) {
             func_rparams->dump2str(s);
@@ -1718,27 +1635,32 @@ public:
         }
         struct Symbol symb;
         string name = ident;
-        if (prog_symtab.find_global_symbol(symb, name)) {
+        if (cg_ctx->prog_symtab.find_global_symbol(symb, name)) {
             if (symb.value.func_type == 1) {
                 string new_op_num("");
-                new_op_num += "%" + string(to_string(min_temp_id));
-                min_temp_id++; 
+                new_op_num += "%" + string(to_string(cg_ctx->min_temp_id));
+                cg_ctx->min_temp_id++; 
                 s = s + new_op_num + " = ";
-                op_num = new_op_num;
+                cg_ctx->op_num = new_op_num;
             }
             s = s + "call @" + name + "(";
             if (num_params > 0) {
-                for (int i = params.size() - num_params; i < params.size(); ++i) {
-                    s = s + params[i];
-                    if (i < params.size() - 1)
+                for (int i = cg_ctx->params.size() - num_params; i < cg_ctx->params.size(); ++i) {
+                    s = s + cg_ctx->params[i];
+                    if (i < cg_ctx->params.size() - 1)
                         s = s + ", ";
                 }
                 for (int i = 0; i < num_params; ++i)
-                    params.pop_back();
+                    cg_ctx->params.pop_back();
             }
             s = s + ")\n";
+        } else {
+            cg_ctx->fail("undefined function '" + name + "'");
+            for (int i = 0; i < num_params; ++i)
+                cg_ctx->params.pop_back();
+            cg_ctx->op_num = "0";
         }
-        is_call = false;
+        cg_ctx->is_call = false;
     }
     void insert2symtab() const override {}
     int cal_val() const override { return 0; }
@@ -1754,15 +1676,15 @@ public:
     void dump2str(string &s) const override {
         string param("");
         exp->dump2str(s);
-        param = op_num;
-        params.push_back(param);
+        param = cg_ctx->op_num;
+        cg_ctx->params.push_back(param);
         if (!vec_exp)
             return;
         for (int i = 0; i < vec_exp->size(); ++i) {
             param = "";
             (*vec_exp)[i]->dump2str(s);
-            param = op_num;
-            params.push_back(param);
+            param = cg_ctx->op_num;
+            cg_ctx->params.push_back(param);
         }
     }
     void insert2symtab() const override {}
@@ -1789,25 +1711,32 @@ public:
             case '+':
                 break;
             case '-':
-                new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-                min_temp_id++;
+                new_op_num = new_op_num + "%" + string(to_string(cg_ctx->min_temp_id));
+                cg_ctx->min_temp_id++;
                 op_exp = op_exp + new_op_num + " = ";
-                op_exp = op_exp + "sub 0, " + op_num + "\n";
-                op_num = new_op_num;
+                op_exp = op_exp + "sub 0, " + cg_ctx->op_num + "\n";
+                cg_ctx->op_num = new_op_num;
                 s += op_exp;
                 break;
             case '!':
-                new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-                min_temp_id++;
+                new_op_num = new_op_num + "%" + string(to_string(cg_ctx->min_temp_id));
+                cg_ctx->min_temp_id++;
                 op_exp = op_exp + new_op_num + " = ";
-                op_exp = op_exp + "eq " + op_num + ", " + "0\n";
-                op_num = new_op_num;
+                op_exp = op_exp + "eq " + cg_ctx->op_num + ", " + "0\n";
+                cg_ctx->op_num = new_op_num;
                 s += op_exp;
                 break;
             default:
                 break;
         }
     }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        if (unary_op[0] == '!')
+            unary_exp->dump_cond(s, false_id, true_id);
+        else
+            unary_exp->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return unary_exp->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         switch (unary_op[0]) {
@@ -1834,6 +1763,10 @@ public:
     void dump2str(string &s) const override {
         mul_ptr->dump2str(s);
     }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        mul_ptr->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return mul_ptr->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override { 
         return mul_ptr->cal_val(); 
@@ -1850,40 +1783,44 @@ public:
 
     void dump2str(string &s) const override {
         mul_exp->dump2str(s);
-        string op_num1 = op_num;
+        string op_num1 = cg_ctx->op_num;
         unary_exp->dump2str(s);
-        string op_num2 = op_num;
+        string op_num2 = cg_ctx->op_num;
         string op_exp("");
         string new_op_num("");
         switch (mul_op[0]) {
             case '*':
-                new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-                min_temp_id++;
+                new_op_num = new_op_num + "%" + string(to_string(cg_ctx->min_temp_id));
+                cg_ctx->min_temp_id++;
                 op_exp = op_exp + new_op_num + " = ";
                 op_exp = op_exp + "mul " + op_num1 + ", " + op_num2 + "\n";
-                op_num = new_op_num;
+                cg_ctx->op_num = new_op_num;
                 s += op_exp;
                 break;
             case '/':
-                new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-                min_temp_id++;
+                new_op_num = new_op_num + "%" + string(to_string(cg_ctx->min_temp_id));
+                cg_ctx->min_temp_id++;
                 op_exp = op_exp + new_op_num + " = ";
                 op_exp = op_exp + "div " + op_num1 + ", " + op_num2 + "\n";
-                op_num = new_op_num;
+                cg_ctx->op_num = new_op_num;
                 s += op_exp;
                 break;
             case '%':
-                new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-                min_temp_id++;
+                new_op_num = new_op_num + "%" + string(to_string(cg_ctx->min_temp_id));
+                cg_ctx->min_temp_id++;
                 op_exp = op_exp + new_op_num + " = ";
                 op_exp = op_exp + "mod " + op_num1 + ", " + op_num2 + "\n";
-                op_num = new_op_num;
+                cg_ctx->op_num = new_op_num;
                 s += op_exp;
                 break;
             default:
                 break;
         }
     }
+    bool pure() const override {
+        // division by zero may be what the short circuit guards against
+        return mul_op[0] == '*' && mul_exp->pure() && unary_exp->pure();
+    }
     void insert2symtab() const override {}
     int cal_val() const override {
         switch (mul_op[0]) {
@@ -1910,6 +1847,10 @@ public:
     void dump2str(string &s) const override {
         add_ptr->dump2str(s);
     }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        add_ptr->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return add_ptr->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         return add_ptr->cal_val();
@@ -1926,32 +1867,33 @@ public:
 
     void dump2str(string &s) const override {
         add_exp->dump2str(s);
-        string op_num1 = op_num;
+        string op_num1 = cg_ctx->op_num;
         mul_exp->dump2str(s);
-        string op_num2 = op_num;
+        string op_num2 = cg_ctx->op_num;
         string op_exp("");
         string new_op_num("");
         switch (add_op[0]) {
             case '+':
-                new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-                min_temp_id++;
+                new_op_num = new_op_num + "%" + string(to_string(cg_ctx->min_temp_id));
+                cg_ctx->min_temp_id++;
                 op_exp = op_exp + new_op_num + " = ";
                 op_exp = op_exp + "add " + op_num1 + ", " + op_num2 + "\n";
-                op_num = new_op_num;
+                cg_ctx->op_num = new_op_num;
                 s += op_exp;                
                 break;
             case '-':
-                new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-                min_temp_id++;
+                new_op_num = new_op_num + "%" + string(to_string(cg_ctx->min_temp_id));
+                cg_ctx->min_temp_id++;
                 op_exp = op_exp + new_op_num + " = ";
                 op_exp = op_exp + "sub " + op_num1 + ", " + op_num2 + "\n";
-                op_num = new_op_num;
+                cg_ctx->op_num = new_op_num;
                 s += op_exp;                
                 break;
             default:
                 break;
         }
     }
+    bool pure() const override { return add_exp->pure() && mul_exp->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         if (add_op[0] == '+') {
@@ -1971,6 +1913,10 @@ public:
     void dump2str(string &s) const override {
         rel_ptr->dump2str(s);
     }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        rel_ptr->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return rel_ptr->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         return rel_ptr->cal_val();
@@ -1987,9 +1933,9 @@ public:
 
     void dump2str(string &s) const override {
         rel_exp->dump2str(s);
-        string op_num1 = op_num;
+        string op_num1 = cg_ctx->op_num;
         add_exp->dump2str(s);
-        string op_num2 = op_num;
+        string op_num2 = cg_ctx->op_num;
         string op_exp("");
         string new_op_num("");
         string instr("");
@@ -2002,13 +1948,14 @@ public:
         } else {
             instr = string("ge ");
         }
-        new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        min_temp_id++;
+        new_op_num = new_op_num + "%" + string(to_string(cg_ctx->min_temp_id));
+        cg_ctx->min_temp_id++;
         op_exp = op_exp + new_op_num + " = ";
         op_exp = op_exp + instr + op_num1 + ", " + op_num2 + "\n";
-        op_num = new_op_num;
+        cg_ctx->op_num = new_op_num;
         s += op_exp;
     }
+    bool pure() const override { return rel_exp->pure() && add_exp->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         if (rel_op == "<") {
@@ -2032,6 +1979,10 @@ public:
     void dump2str(string &s) const override {
         eq_ptr->dump2str(s);
     }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        eq_ptr->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return eq_ptr->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         return eq_ptr->cal_val();
@@ -2048,9 +1999,9 @@ public:
 
     void dump2str(string &s) const override {
         eq_exp->dump2str(s);
-        string op_num1 = op_num;
+        string op_num1 = cg_ctx->op_num;
         rel_exp->dump2str(s);
-        string op_num2 = op_num;
+        string op_num2 = cg_ctx->op_num;
         string op_exp("");
         string new_op_num("");
         string instr("");
@@ -2059,13 +2010,14 @@ public:
         } else {
             instr = string("ne ");
         }
-        new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        min_temp_id++;
+        new_op_num = new_op_num + "%" + string(to_string(cg_ctx->min_temp_id));
+        cg_ctx->min_temp_id++;
         op_exp = op_exp + new_op_num + " = ";
         op_exp = op_exp + instr + op_num1 + ", " + op_num2 + "\n";
-        op_num = new_op_num;
+        cg_ctx->op_num = new_op_num;
         s += op_exp;
     }
+    bool pure() const override { return eq_exp->pure() && rel_exp->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         if (eq_op == "==") {
@@ -2085,6 +2037,10 @@ public:
     void dump2str(string &s) const override {
         land_ptr->dump2str(s);
     }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        land_ptr->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return land_ptr->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         return land_ptr->cal_val();
@@ -2100,85 +2056,28 @@ public:
     unique_ptr<BaseAST> eq_exp;
 
     void dump2str(string &s) const override {
-        // use "B = ne A, 0" to transfer integer value A to 
-        // corresponding logical value B
-        string op_exp("");
-        string new_op_num("");
-        string instr("and ");
-
-        // lhs computation
-        // int result = 0;
-        int then_blk_id = block_id;
-        int end_blk_id = block_id + 1;
-        block_id += 2;
-        new_op_num = "";
-        new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        min_temp_id++;
-        s = s + new_op_num + " = alloc i32\n";
-        s = s + "store 0, "+ new_op_num + "\n";
-        string res = new_op_num;
-        // if (op_num1 != 0)
-        land_exp->dump2str(s);
-        string op_num1 = op_num;
-        new_op_num = "";
-        new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        min_temp_id++;
-        s = s + new_op_num + " = ";
-        s = s + "ne " + op_num1 + ", 0\n";
-        op_num = new_op_num;
-        s = s + "br " + op_num + ", %block" + string(to_string(then_blk_id)) + 
-            ", %block" + string(to_string(end_blk_id)) + "\n";
-        // result = op_num2 != 0;
-        s = s + "\n%block" + string(to_string(then_blk_id)) + ":\n";
-        eq_exp->dump2str(s);       
-        string op_num2 = op_num;
-        new_op_num = "";
-        new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        min_temp_id++;
-        s = s + new_op_num + " = ";
-        s = s + "ne " + op_num2 + ", 0\n";
-        op_num = new_op_num;
-        s = s + "store " + op_num + ", " + res + "\n";
-        s = s + "jump %block" + string(to_string(end_blk_id)) + "\n";
-        
-        s = s + "\n%block" + string(to_string(end_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
-        new_op_num = "";
-        new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        min_temp_id++;
-        s = s + new_op_num + " = load " + res + "\n";
-        op_num = new_op_num;
-
-        // land_exp->dump2str(s);
-        // new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        // min_temp_id++;
-        // op_exp = op_exp + new_op_num + " = ";
-        // op_exp = op_exp + "ne " + op_num + ", 0\n";
-        // op_num = new_op_num;
-        // string op_num1 = new_op_num;
-        // s += op_exp;
-
-        // op_exp = "";
-        // new_op_num = "";
-        // eq_exp->dump2str(s);
-        // new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        // min_temp_id++;
-        // op_exp = op_exp + new_op_num + " = ";
-        // op_exp = op_exp + "ne " + op_num + ", 0\n";
-        // op_num = new_op_num;       
-        // string op_num2 = new_op_num;
-        // s += op_exp;
-        
-        // op_exp = "";
-        // new_op_num = "";
-        // new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        // min_temp_id++;
-        // op_exp = op_exp + new_op_num + " = ";
-        // op_exp = op_exp + instr + op_num1 + ", " + op_num2 + "\n";
-        // op_num = new_op_num;
-        // s += op_exp;
-    }
+        if (!eq_exp->pure()) {
+            dump_logic_value(this, s);
+            return;
+        }
+        // nothing to skip, so combine the logical values of both sides
+        dump_ne_zero(land_exp.get(), s);
+        string op_num1 = cg_ctx->op_num;
+        dump_ne_zero(eq_exp.get(), s);
+        string op_num2 = cg_ctx->op_num;
+        string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+        cg_ctx->min_temp_id++;
+        s = s + new_op_num + " = and " + op_num1 + ", " + op_num2 + "\n";
+        cg_ctx->op_num = new_op_num;
+    }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        int mid_blk_id = cg_ctx->block_id;
+        cg_ctx->block_id++;
+        land_exp->dump_cond(s, mid_blk_id, false_id);
+        s = s + "\n%block" + string(to_string(mid_blk_id)) + ":\n";
+        eq_exp->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return land_exp->pure() && eq_exp->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         return land_exp->cal_val() && eq_exp->cal_val();
@@ -2194,6 +2093,10 @@ public:
     void dump2str(string &s) const override {
         lor_ptr->dump2str(s);
     }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        lor_ptr->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return lor_ptr->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         return lor_ptr->cal_val();
@@ -2209,82 +2112,28 @@ public:
     unique_ptr<BaseAST> land_exp;
 
     void dump2str(string &s) const override {
-        string op_exp("");
-        string new_op_num("");
-        string instr("or ");
-
-        // lhs computation
-        // int result = 1;
-        int then_blk_id = block_id;
-        int end_blk_id = block_id + 1;
-        block_id += 2;
-        new_op_num = "";
-        new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        min_temp_id++;
-        s = s + new_op_num + " = alloc i32\n";
-        s = s + "store 1, "+ new_op_num + "\n";
-        string res = new_op_num;
-        // if (op_num1 == 0)
-        lor_exp->dump2str(s);
-        string op_num1 = op_num;
-        new_op_num = "";
-        new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        min_temp_id++;
-        s = s + new_op_num + " = ";
-        s = s + "eq " + op_num1 + ", 0\n";
-        op_num = new_op_num;
-        s = s + "br " + op_num + ", %block" + string(to_string(then_blk_id)) + 
-            ", %block" + string(to_string(end_blk_id)) + "\n";
-        // result = op_num2 != 0;
-        s = s + "\n%block" + string(to_string(then_blk_id)) + ":\n";
-        land_exp->dump2str(s);       
-        string op_num2 = op_num;
-        new_op_num = "";
-        new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        min_temp_id++;
-        s = s + new_op_num + " = " + "ne " + op_num2 + ", 0\n";
-        op_num = new_op_num;
-        s = s + "store " + op_num + ", " + res + "\n";
-        s = s + "jump %block" + string(to_string(end_blk_id)) + "\n";
-        
-        s = s + "\n%block" + string(to_string(end_blk_id)) + ":\n";
-        ret_in_blk = false;
-        jump_in_blk = false;
-        new_op_num = "";
-        new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        min_temp_id++;
-        s = s + new_op_num + " = load " + res + "\n";
-        op_num = new_op_num;
-
-        // lor_exp->dump2str(s);
-        // new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        // min_temp_id++;
-        // op_exp = op_exp + new_op_num + " = ";
-        // op_exp = op_exp + "ne " + op_num + ", 0\n";
-        // op_num = new_op_num;
-        // string op_num1 = new_op_num;
-        // s += op_exp;
-
-        // op_exp = "";
-        // new_op_num = "";
-        // land_exp->dump2str(s);
-        // new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        // min_temp_id++;
-        // op_exp = op_exp + new_op_num + " = ";
-        // op_exp = op_exp + "ne " + op_num + ", 0\n";
-        // op_num = new_op_num;       
-        // string op_num2 = new_op_num;
-        // s += op_exp;
-        
-        // op_exp = "";
-        // new_op_num = "";
-        // new_op_num = new_op_num + "%" + string(to_string(min_temp_id));
-        // min_temp_id++;
-        // op_exp = op_exp + new_op_num + " = ";
-        // op_exp = op_exp + instr + op_num1 + ", " + op_num2 + "\n";
-        // op_num = new_op_num;
-        // s += op_exp;
-    }
+        if (!land_exp->pure()) {
+            dump_logic_value(this, s);
+            return;
+        }
+        // nothing to skip, so combine the logical values of both sides
+        dump_ne_zero(lor_exp.get(), s);
+        string op_num1 = cg_ctx->op_num;
+        dump_ne_zero(land_exp.get(), s);
+        string op_num2 = cg_ctx->op_num;
+        string new_op_num = "%" + string(to_string(cg_ctx->min_temp_id));
+        cg_ctx->min_temp_id++;
+        s = s + new_op_num + " = or " + op_num1 + ", " + op_num2 + "\n";
+        cg_ctx->op_num = new_op_num;
+    }
+    void dump_cond(string &s, int true_id, int false_id) const override {
+        int mid_blk_id = cg_ctx->block_id;
+        cg_ctx->block_id++;
+        lor_exp->dump_cond(s, true_id, mid_blk_id);
+        s = s + "\n%block" + string(to_string(mid_blk_id)) + ":\n";
+        land_exp->dump_cond(s, true_id, false_id);
+    }
+    bool pure() const override { return lor_exp->pure() && land_exp->pure(); }
     void insert2symtab() const override {}
     int cal_val() const override {
         return lor_exp->cal_val() || land_exp->cal_val();
@@ -0,0 +1,222 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "compiler.h"
+#include "cache.h"
+#include "timer.h"
+#include "profile.h"
+using namespace std;
+
+using u128 = unsigned __int128;
+
+/* 128 bit FNV-1a hash */
+static u128 fnv1a(const string &data, u128 h) {
+    const u128 prime = (u128(1) << 88) | 0x13b;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= prime;
+    }
+    return h;
+}
+
+static string to_hex(u128 h) {
+    static const char digits[] = "0123456789abcdef";
+    string res(32, '0');
+    for (int i = 31; i >= 0; --i) {
+        res[i] = digits[int(h & 0xf)];
+        h >>= 4;
+    }
+    return res;
+}
+
+/* Identify this build of the compiler by its executable, any rebuild changes it */
+static string build_id() {
+    static string id = []() {
+        struct stat st;
+        if (stat("/proc/self/exe", &st) != 0)
+            return string(__DATE__ " " __TIME__);
+        return to_string(st.st_ino) + ":" + to_string(st.st_size) + ":" +
+               to_string(st.st_mtim.tv_sec) + "." + to_string(st.st_mtim.tv_nsec);
+    }();
+    return id;
+}
+
+CompileCache::CompileCache(const string &dir, unsigned long long max_bytes)
+    : dir(dir), max_bytes(max_bytes) {
+    mkdir(dir.c_str(), 0755);
+}
+
+string CompileCache::dir_from_env() {
+    const char *dir = getenv("SYSY_CACHE_DIR");
+    return dir ? string(dir) : string("");
+}
+
+unsigned long long CompileCache::size_from_env() {
+    const char *size = getenv("SYSY_CACHE_SIZE");
+    if (size)
+        return strtoull(size, nullptr, 0);
+    return 256ULL << 20;
+}
+
+string CompileCache::key(const string &source, const CompileOptions &options) const {
+    // offset basis of 128 bit FNV
+    u128 h = (u128(0x6c62272e07bb0142ULL) << 64) | 0x62b821756295c58dULL;
+    h = fnv1a(build_id(), h);
+    h = fnv1a(options.mode == OutputMode::RiscV ? "-riscv" : "-koopa", h);
+    if (options.profile)
+        h = fnv1a("-fprofile-use\n" + options.profile->str(), h);
+    h = fnv1a(source, h);
+    return to_hex(h);
+}
+
+string CompileCache::func_key(const string &fingerprint) const {
+    u128 h = (u128(0x6c62272e07bb0142ULL) << 64) | 0x62b821756295c58dULL;
+    h = fnv1a(build_id(), h);
+    h = fnv1a("-func", h);
+    h = fnv1a(fingerprint, h);
+    return to_hex(h);
+}
+
+bool CompileCache::lookup(const string &key, string &output) const {
+    string path = dir + "/" + key;
+    ifstream ifs(path, ios::binary);
+    if (!ifs)
+        return false;
+    stringstream buffer;
+    buffer << ifs.rdbuf();
+    output = buffer.str();
+    // touch it, modification time orders entries for LRU eviction
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    return true;
+}
+
+// Inserts after which a directory is scanned again, to see what other processes wrote
+const unsigned RESCAN_INSERTS = 64;
+// Age after which a temporary file is taken to be left by a writer that died
+const time_t STALE_TEMP_SECONDS = 3600;
+
+// Bytes in each cache directory as this process knows it, scanned on first use
+struct DirUsage {
+    unsigned long long bytes;
+    unsigned inserts;
+};
+static mutex usage_mutex;
+static unordered_map<string, DirUsage> dir_usage;
+
+void CompileCache::insert(const string &key, const string &output) const {
+    string path = dir + "/" + key;
+    // write a file of our own then rename it, so that concurrent writers of
+    // the same key, in this process or others, never see half an entry
+    string tmp_path = dir + "/." + key + ".XXXXXX";
+    int fd = mkstemp(&tmp_path[0]);
+    if (fd < 0)
+        return;
+    fchmod(fd, 0644);
+    size_t done = 0;
+    while (done < output.size()) {
+        ssize_t n = write(fd, output.data() + done, output.size() - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    if (close(fd) != 0 || done < output.size() || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return;
+    }
+    // the directory is only scanned again once it may have outgrown its bound,
+    // or every so many inserts for the entries of other processes
+    lock_guard<mutex> lock(usage_mutex);
+    auto it = dir_usage.find(dir);
+    if (it == dir_usage.end()) {
+        dir_usage[dir] = {evict(), 0};
+        return;
+    }
+    DirUsage &usage = it->second;
+    usage.bytes += output.size();
+    if (usage.bytes > max_bytes || ++usage.inserts >= RESCAN_INSERTS)
+        usage = {evict(), 0};
+}
+
+/*
+ * Remove least recently used entries until the cache is below its size
+ * bound, and temporary files of writers that died, returns the bytes left
+ */
+unsigned long long CompileCache::evict() const {
+    struct Entry {
+        string path;
+        unsigned long long size;
+        struct timespec mtime;
+    };
+    vector<Entry> entries;
+    unsigned long long total = 0;
+    time_t now = time(nullptr);
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return 0;
+    while (struct dirent *e = readdir(d)) {
+        bool temp = e->d_name[0] == '.';
+        if (temp && (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")))
+            continue;
+        Entry entry;
+        entry.path = dir + "/" + e->d_name;
+        struct stat st;
+        if (stat(entry.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        if (temp) {
+            // one being written is renamed long before this
+            if (now - st.st_mtim.tv_sec > STALE_TEMP_SECONDS)
+                unlink(entry.path.c_str());
+            continue;
+        }
+        entry.size = st.st_size;
+        entry.mtime = st.st_mtim;
+        total += entry.size;
+        entries.push_back(entry);
+    }
+    closedir(d);
+    if (total <= max_bytes)
+        return total;
+    sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        if (a.mtime.tv_sec != b.mtime.tv_sec)
+            return a.mtime.tv_sec < b.mtime.tv_sec;
+        return a.mtime.tv_nsec < b.mtime.tv_nsec;
+    });
+    // free a bit more than needed so that eviction does not run on every insert
+    unsigned long long target = max_bytes / 10 * 9;
+    for (size_t i = 0; i < entries.size() && total > target; ++i) {
+        if (unlink(entries[i].path.c_str()) == 0)
+            total -= entries[i].size;
+    }
+    return total;
+}
+
+bool cached_compile(const string &source, const CompileOptions &options, string &output) {
+    string dir = CompileCache::dir_from_env();
+    if (dir.empty())
+        return compile(source, options, output);
+    CompileCache cache(dir, CompileCache::size_from_env());
+    string key;
+    {
+        PhaseTimer timer("cache lookup");
+        key = cache.key(source, options);
+        if (cache.lookup(key, output))
+            return true;
+    }
+    if (!compile(source, options, output))
+        return false;
+    PhaseTimer timer("cache insert");
+    cache.insert(key, output);
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <string>
+#include "compiler.h"
+using namespace std;
+
+/*
+ * Content addressed compilation cache on local disk. Entries are keyed by
+ * a hash of the source bytes, the compiler build and the options, and
+ * are evicted least recently used first when the cache grows too large;
+ * the directory is scanned when a process first writes to it, every 64
+ * inserts after that, and when what it wrote may have taken it over the
+ * bound. Scans also remove temporary files left by writers that died.
+ * The backend also keeps the code of each function here, so that only the
+ * functions that changed are generated again.
+ * Enabled by setting SYSY_CACHE_DIR; SYSY_CACHE_SIZE bounds its size in
+ * bytes (default 256M).
+ */
+class CompileCache {
+public:
+    CompileCache(const string &dir, unsigned long long max_bytes);
+    // Cache directory from the environment, empty if caching is disabled
+    static string dir_from_env();
+    static unsigned long long size_from_env();
+
+    string key(const string &source, const CompileOptions &options) const;
+    // Key of the code generated for one function, from its fingerprint
+    string func_key(const string &fingerprint) const;
+    bool lookup(const string &key, string &output) const;
+    void insert(const string &key, const string &output) const;
+
+private:
+    string dir;
+    unsigned long long max_bytes;
+    unsigned long long evict() const;
+};
+
+// compile() with a lookup in the cache first, if it is enabled
+bool cached_compile(const string &source, const CompileOptions &options, string &output);
+
+#endif
@@ -0,0 +1,190 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "ast.h"
+#include "raw.h"
+#include "compiler.h"
+#include "timer.h"
+using namespace std;
+
+// reentrant flex scanner and bison parser
+typedef void *yyscan_t;
+struct yy_buffer_state;
+typedef yy_buffer_state *YY_BUFFER_STATE;
+extern int yylex_init(yyscan_t *scanner);
+extern int yylex_destroy(yyscan_t scanner);
+extern YY_BUFFER_STATE yy_scan_bytes(const char *bytes, int len, yyscan_t scanner);
+extern void yy_delete_buffer(YY_BUFFER_STATE buffer, yyscan_t scanner);
+extern int yyparse(yyscan_t scanner, unique_ptr<BaseAST> &ast);
+
+bool compile(const string &source, const CompileOptions &options, string &output) {
+    output.clear();
+    // Parse
+    unique_ptr<BaseAST> ast;
+    int ret;
+    {
+        PhaseTimer timer("parse (yyparse)");
+        yyscan_t scanner;
+        yylex_init(&scanner);
+        YY_BUFFER_STATE buffer = yy_scan_bytes(source.data(), source.size(), scanner);
+        ret = yyparse(scanner, ast);
+        yy_delete_buffer(buffer, scanner);
+        yylex_destroy(scanner);
+    }
+    if (ret || !ast) {
+        output = "syntax error";
+        return false;
+    }
+
+    // Dump ast to KoopaIR
+    string koopa_ir("");
+    string error;
+    {
+        PhaseTimer timer("lower (dump2str)");
+        CodegenContext ctx;
+        CodegenContext *prev_ctx = cg_ctx;
+        cg_ctx = &ctx;
+        import_sysy_lib(koopa_ir);
+        ast->dump2str(koopa_ir);
+        cg_ctx = prev_ctx;
+        error = move(ctx.error);
+    }
+    if (!error.empty()) {
+        output = "semantic error: " + error;
+        return false;
+    }
+
+    if (options.mode == OutputMode::Koopa) {
+        output = move(koopa_ir);
+    } else {
+        if (!koopa2riscv(koopa_ir.c_str(), output, options.profile)) {
+            output = "invalid KoopaIR";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Longest source a request may send
+const size_t MAX_SOURCE_BYTES = 64u << 20;
+// Connections served at the same time, others wait to be accepted
+const unsigned MAX_CONNECTIONS = 32;
+
+// Bad requests are answered, after a Broken one the next can not be found
+enum class Request { Ok, Bad, Broken, End };
+
+/* Read one request, the message of a bad one in error */
+static Request read_request(FILE *in, CompileOptions &options, string &source, string &error) {
+    char mode[16];
+    size_t len = 0;
+    if (fscanf(in, "%15s %zu", mode, &len) != 2)
+        return Request::End;
+    if (fgetc(in) != '\n')
+        return Request::End;
+    if (len > MAX_SOURCE_BYTES) {
+        error = "source longer than " + to_string(MAX_SOURCE_BYTES) + " bytes";
+        return Request::Broken;
+    }
+    source.resize(len);
+    if (fread(&source[0], 1, len, in) != len)
+        return Request::End;
+    if (strcmp(mode, "-riscv") == 0) {
+        options.mode = OutputMode::RiscV;
+    } else if (strcmp(mode, "-koopa") == 0) {
+        options.mode = OutputMode::Koopa;
+    } else {
+        error = "unknown mode " + string(mode);
+        return Request::Bad;
+    }
+    return Request::Ok;
+}
+
+static void reply(FILE *out, bool ok, const string &output) {
+    fprintf(out, "%s %zu\n", ok ? "ok" : "error", output.size());
+    fwrite(output.data(), 1, output.size(), out);
+    fflush(out);
+}
+
+void serve_stream(FILE *in, FILE *out) {
+    CompileOptions options;
+    string source, output, error;
+    while (true) {
+        Request req = read_request(in, options, source, error);
+        if (req == Request::End)
+            break;
+        if (req != Request::Ok) {
+            reply(out, false, error);
+            if (req == Request::Broken)
+                break;
+            continue;
+        }
+        bool ok = compile(source, options, output);
+        reply(out, ok, output);
+    }
+}
+
+int serve_socket(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        perror("bind");
+        close(fd);
+        return 1;
+    }
+    mutex active_mutex;
+    condition_variable slot_free;
+    unsigned active = 0;
+    while (true) {
+        {
+            unique_lock<mutex> lock(active_mutex);
+            slot_free.wait(lock, [&]() { return active < MAX_CONNECTIONS; });
+        }
+        int conn = accept(fd, nullptr, nullptr);
+        if (conn < 0) {
+            // Out of fds or the like, wait for connections to close rather than spin
+            if (errno != EINTR)
+                this_thread::sleep_for(chrono::milliseconds(100));
+            continue;
+        }
+        {
+            lock_guard<mutex> lock(active_mutex);
+            active++;
+        }
+        thread([&, conn]() {
+            FILE *in = fdopen(conn, "r");
+            int out_fd = in ? dup(conn) : -1;
+            FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : nullptr;
+            if (in && out)
+                serve_stream(in, out);
+            if (out)
+                fclose(out);
+            else if (out_fd >= 0)
+                close(out_fd);
+            if (in)
+                fclose(in);
+            else
+                close(conn);
+            lock_guard<mutex> lock(active_mutex);
+            active--;
+            slot_free.notify_one();
+        }).detach();
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <cstdio>
+#include <string>
+using namespace std;
+
+/*
+ * Library entry of the compiler. compile() keeps no state between calls
+ * and may be called from several threads at the same time.
+ */
+
+enum class OutputMode { Koopa, RiscV };
+
+class Profile;
+
+struct CompileOptions {
+    OutputMode mode = OutputMode::Koopa;
+    // execution profile guiding code generation, if any
+    const Profile *profile = nullptr;
+};
+
+// Compile SysY source to KoopaIR or RISC-V, false (and a message in output) on error
+bool compile(const string &source, const CompileOptions &options, string &output);
+
+/*
+ * Compile server. Each request is a header line "<mode> <length>\n"
+ * (mode is -koopa or -riscv) followed by <length> bytes of source.
+ * Each reply is "ok <length>\n" or "error <length>\n" followed by
+ * <length> bytes of output or error message. Unknown modes and sources
+ * over 64M get an error; after a length that is too long the connection
+ * is closed.
+ */
+// Answer requests from in until end of file
+void serve_stream(FILE *in, FILE *out);
+// Listen on a unix socket, every connection is served on its own thread,
+// at most 32 at a time
+int serve_socket(const char *path);
+
+#endif
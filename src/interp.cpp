@@ -0,0 +1,354 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "koopa.h"
+#include "interp.h"
+#include "profile.h"
+using namespace std;
+
+// Lowest address of globals, so that a null pointer is never valid
+const uint32_t GLOBAL_BASE = 0x1000;
+
+Interpreter::Interpreter(const koopa_raw_program_t &program) : program(program) {}
+
+/* Slots of the values of a function and frame offsets of its allocs */
+const Interpreter::FuncLayout &Interpreter::layout(const koopa_raw_function_t &func) {
+    auto it = layouts.find(func);
+    if (it != layouts.end())
+        return it->second;
+    FuncLayout &res = layouts[func];
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for (size_t j = 0; j < block->insts.len; ++j) {
+            auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
+            if (value->kind.tag == KOOPA_RVT_ALLOC) {
+                // like the backend, one place per alloc for the whole activation
+                res.alloc_offset[value] = res.frame_bytes;
+                res.frame_bytes += (types.size(value->ty->data.pointer.base) + 3) & ~3u;
+            } else if (value->ty->tag != KOOPA_RTT_UNIT) {
+                int id = res.slot.size();
+                res.slot[value] = id;
+            }
+        }
+    }
+    return res;
+}
+
+void Interpreter::init_global(const koopa_raw_value_t &init, uint32_t addr) {
+    const auto &kind = init->kind;
+    switch (kind.tag) {
+        case KOOPA_RVT_INTEGER:
+            memcpy(&mem[addr], &kind.data.integer.value, 4);
+            break;
+        case KOOPA_RVT_AGGREGATE: {
+            uint32_t elem_size = types.size(init->ty->data.array.base);
+            for (size_t i = 0; i < kind.data.aggregate.elems.len; ++i) {
+                auto elem = reinterpret_cast<koopa_raw_value_t>(kind.data.aggregate.elems.buffer[i]);
+                init_global(elem, addr + i * elem_size);
+            }
+            break;
+        }
+        default:  // zeroinit and undef
+            break;
+    }
+}
+
+int32_t Interpreter::operand(const Frame &frame, const koopa_raw_value_t &value) {
+    const auto &kind = value->kind;
+    switch (kind.tag) {
+        case KOOPA_RVT_INTEGER:
+            return kind.data.integer.value;
+        case KOOPA_RVT_FUNC_ARG_REF:
+            return frame.args[kind.data.func_arg_ref.index];
+        case KOOPA_RVT_GLOBAL_ALLOC:
+            return global_addr[value];
+        case KOOPA_RVT_ALLOC:
+            return frame.base + frame.layout->alloc_offset.at(value);
+        default:
+            return frame.slots[frame.layout->slot.at(value)];
+    }
+}
+
+bool Interpreter::check_addr(uint32_t addr) {
+    if (addr >= GLOBAL_BASE && addr % 4 == 0 && addr + 4 <= mem.size())
+        return true;
+    run_error = "bad memory access at " + to_string(addr);
+    return false;
+}
+
+/* Run a SysY library function, false if it faulted */
+bool Interpreter::call_library(const koopa_raw_function_t &func, const vector<int32_t> &args,
+                               int32_t &ret, FILE *in, FILE *out) {
+    string name(func->name);
+    ret = 0;
+    if (name == "@getint") {
+        if (fscanf(in, "%d", &ret) != 1)
+            ret = 0;
+    } else if (name == "@getch") {
+        ret = fgetc(in);
+    } else if (name == "@getarray") {
+        int n = 0;
+        if (fscanf(in, "%d", &n) != 1)
+            n = 0;
+        for (int i = 0; i < n; ++i) {
+            int32_t val = 0;
+            if (fscanf(in, "%d", &val) != 1)
+                val = 0;
+            if (!check_addr(args[0] + 4 * i))
+                return false;
+            memcpy(&mem[args[0] + 4 * i], &val, 4);
+        }
+        ret = n;
+    } else if (name == "@putint") {
+        fprintf(out, "%d", args[0]);
+    } else if (name == "@putch") {
+        fputc(args[0], out);
+    } else if (name == "@putarray") {
+        fprintf(out, "%d:", args[0]);
+        for (int i = 0; i < args[0]; ++i) {
+            int32_t val;
+            if (!check_addr(args[1] + 4 * i))
+                return false;
+            memcpy(&val, &mem[args[1] + 4 * i], 4);
+            fprintf(out, " %d", val);
+        }
+        fputc('\n', out);
+    } else if (name != "@starttime" && name != "@stoptime") {
+        run_error = "call of undefined function " + name;
+        return false;
+    }
+    return true;
+}
+
+int Interpreter::run(FILE *in, FILE *out) {
+    run_error.clear();
+    bb_counts.clear();
+    edges.clear();
+    num_executed = 0;
+
+    // Globals
+    mem.assign(GLOBAL_BASE, 0);
+    global_addr.clear();
+    for (size_t i = 0; i < program.values.len; ++i) {
+        auto value = reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]);
+        uint32_t addr = mem.size();
+        global_addr[value] = addr;
+        mem.resize(addr + ((types.size(value->ty->data.pointer.base) + 3) & ~3u), 0);
+        init_global(value->kind.data.global_alloc.init, addr);
+    }
+    uint32_t stack_top = (mem.size() + 15) & ~15u;
+    mem.resize(stack_top + stack_size, 0);
+
+    koopa_raw_function_t main_func = nullptr;
+    for (size_t i = 0; i < program.funcs.len; ++i) {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if (string(func->name) == "@main" && func->bbs.len > 0)
+            main_func = func;
+    }
+    if (!main_func) {
+        run_error = "no main function";
+        return -1;
+    }
+
+    vector<Frame> frames;
+    // Enter a function, false on stack overflow
+    auto push_frame = [&](const koopa_raw_function_t &func, vector<int32_t> &&args) {
+        Frame frame;
+        frame.func = func;
+        frame.layout = &layout(func);
+        frame.bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]);
+        frame.next_inst = 0;
+        frame.base = stack_top;
+        frame.slots.assign(frame.layout->slot.size(), 0);
+        frame.args = move(args);
+        frame.call = nullptr;
+        uint32_t frame_end = (stack_top + frame.layout->frame_bytes + 15) & ~15u;
+        if (frame_end > mem.size()) {
+            run_error = "stack overflow";
+            return false;
+        }
+        memset(&mem[stack_top], 0, frame_end - stack_top);
+        stack_top = frame_end;
+        bb_counts[frame.bb]++;
+        frames.push_back(move(frame));
+        return true;
+    };
+    if (!push_frame(main_func, vector<int32_t>()))
+        return -1;
+
+    while (true) {
+        Frame &frame = frames.back();
+        if (frame.next_inst >= frame.bb->insts.len) {
+            run_error = "block without terminator";
+            return -1;
+        }
+        auto value = reinterpret_cast<koopa_raw_value_t>(frame.bb->insts.buffer[frame.next_inst++]);
+        const auto &kind = value->kind;
+        num_executed++;
+        if (max_insts && num_executed > max_insts) {
+            run_error = "instruction limit reached";
+            return -1;
+        }
+        int32_t res = 0;
+        switch (kind.tag) {
+            case KOOPA_RVT_ALLOC:
+                continue;
+            case KOOPA_RVT_LOAD: {
+                uint32_t addr = operand(frame, kind.data.load.src);
+                if (!check_addr(addr))
+                    return -1;
+                memcpy(&res, &mem[addr], 4);
+                break;
+            }
+            case KOOPA_RVT_STORE: {
+                uint32_t addr = operand(frame, kind.data.store.dest);
+                int32_t val = operand(frame, kind.data.store.value);
+                if (!check_addr(addr))
+                    return -1;
+                memcpy(&mem[addr], &val, 4);
+                continue;
+            }
+            case KOOPA_RVT_GET_PTR: {
+                auto base = kind.data.get_ptr.src->ty->data.pointer.base;
+                res = uint32_t(operand(frame, kind.data.get_ptr.src)) +
+                      uint32_t(operand(frame, kind.data.get_ptr.index)) * types.size(base);
+                break;
+            }
+            case KOOPA_RVT_GET_ELEM_PTR: {
+                auto base = kind.data.get_elem_ptr.src->ty->data.pointer.base->data.array.base;
+                res = uint32_t(operand(frame, kind.data.get_elem_ptr.src)) +
+                      uint32_t(operand(frame, kind.data.get_elem_ptr.index)) * types.size(base);
+                break;
+            }
+            case KOOPA_RVT_BINARY: {
+                int32_t l = operand(frame, kind.data.binary.lhs);
+                int32_t r = operand(frame, kind.data.binary.rhs);
+                uint32_t ul = l, ur = r;
+                switch (kind.data.binary.op) {
+                    case KOOPA_RBO_NOT_EQ: res = l != r; break;
+                    case KOOPA_RBO_EQ: res = l == r; break;
+                    case KOOPA_RBO_GT: res = l > r; break;
+                    case KOOPA_RBO_LT: res = l < r; break;
+                    case KOOPA_RBO_GE: res = l >= r; break;
+                    case KOOPA_RBO_LE: res = l <= r; break;
+                    case KOOPA_RBO_ADD: res = ul + ur; break;
+                    case KOOPA_RBO_SUB: res = ul - ur; break;
+                    case KOOPA_RBO_MUL: res = ul * ur; break;
+                    case KOOPA_RBO_DIV:
+                    case KOOPA_RBO_MOD:
+                        if (r == 0) {
+                            run_error = "division by zero";
+                            return -1;
+                        }
+                        // the overflowing case gives what RISC-V gives
+                        if (l == INT32_MIN && r == -1)
+                            res = kind.data.binary.op == KOOPA_RBO_DIV ? l : 0;
+                        else
+                            res = kind.data.binary.op == KOOPA_RBO_DIV ? l / r : l % r;
+                        break;
+                    case KOOPA_RBO_AND: res = l & r; break;
+                    case KOOPA_RBO_OR: res = l | r; break;
+                    case KOOPA_RBO_XOR: res = l ^ r; break;
+                    case KOOPA_RBO_SHL: res = ul << (ur & 31); break;
+                    case KOOPA_RBO_SHR: res = ul >> (ur & 31); break;
+                    case KOOPA_RBO_SAR: res = l >> (ur & 31); break;
+                    default: break;
+                }
+                break;
+            }
+            case KOOPA_RVT_BRANCH:
+            case KOOPA_RVT_JUMP: {
+                koopa_raw_basic_block_t target;
+                if (kind.tag == KOOPA_RVT_JUMP)
+                    target = kind.data.jump.target;
+                else if (operand(frame, kind.data.branch.cond))
+                    target = kind.data.branch.true_bb;
+                else
+                    target = kind.data.branch.false_bb;
+                edges[BlockEdge(frame.bb, target)]++;
+                bb_counts[target]++;
+                frame.bb = target;
+                frame.next_inst = 0;
+                continue;
+            }
+            case KOOPA_RVT_CALL: {
+                const auto &call = kind.data.call;
+                vector<int32_t> args(call.args.len);
+                for (size_t i = 0; i < call.args.len; ++i)
+                    args[i] = operand(frame, reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]));
+                if (call.callee->bbs.len == 0) {
+                    if (!call_library(call.callee, args, res, in, out))
+                        return -1;
+                    break;
+                }
+                frame.call = value;
+                if (!push_frame(call.callee, move(args)))
+                    return -1;
+                continue;
+            }
+            case KOOPA_RVT_RETURN: {
+                int32_t ret = kind.data.ret.value ? operand(frame, kind.data.ret.value) : 0;
+                stack_top = frame.base;
+                frames.pop_back();
+                if (frames.empty())
+                    return ret;
+                Frame &caller = frames.back();
+                if (caller.call->ty->tag != KOOPA_RTT_UNIT)
+                    caller.slots[caller.layout->slot.at(caller.call)] = ret;
+                caller.call = nullptr;
+                continue;
+            }
+            default:
+                run_error = "unsupported instruction";
+                return -1;
+        }
+        if (value->ty->tag != KOOPA_RTT_UNIT)
+            frame.slots[frame.layout->slot.at(value)] = res;
+    }
+}
+
+string Interpreter::report() const {
+    string res("");
+    char line[256];
+    snprintf(line, sizeof(line), "%-32s %14llu\n", "instructions",
+             (unsigned long long)num_executed);
+    res += line;
+    res += "block executions:\n";
+    for (size_t i = 0; i < program.funcs.len; ++i) {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        for (size_t j = 0; j < func->bbs.len; ++j) {
+            auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[j]);
+            auto it = bb_counts.find(block);
+            if (it == bb_counts.end())
+                continue;
+            string name = string(func->name) + " " + (block->name ? block->name : "%?");
+            snprintf(line, sizeof(line), "  %-30s %14llu\n", name.c_str(),
+                     (unsigned long long)it->second);
+            res += line;
+        }
+    }
+    return res;
+}
+
+int interpret_koopa(const char *koopa_ir, FILE *in, FILE *out, string &report, string &error,
+                    Profile *profile) {
+    koopa_program_t program;
+    if (koopa_parse_from_string(koopa_ir, &program) != KOOPA_EC_SUCCESS) {
+        error = "invalid KoopaIR";
+        return -1;
+    }
+    koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
+    koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
+    koopa_delete_program(program);
+
+    Interpreter interp(raw);
+    int ret = interp.run(in, out);
+    error = interp.error();
+    report = interp.report();
+    if (profile)
+        *profile = Profile::collect(raw, interp);
+    koopa_delete_raw_program_builder(builder);
+    return ret;
+}
@@ -0,0 +1,86 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "koopa.h"
+#include "pass.h"
+#include "layout.h"
+using namespace std;
+
+/*
+ * Interpreter of the raw program, the oracle for checking passes and
+ * code generation without a RISC-V toolchain. Memory is a flat byte
+ * array like on the target: globals first, then a stack of frames which
+ * hold the allocs of each active function. The SysY library is built in.
+ */
+
+class Interpreter {
+public:
+    explicit Interpreter(const koopa_raw_program_t &program);
+    // Run main, returns its return value
+    int run(FILE *in, FILE *out);
+    // Why the last run stopped early, empty if main returned
+    const string &error() const { return run_error; }
+    uint64_t executed() const { return num_executed; }
+    // times each block was entered
+    const unordered_map<koopa_raw_basic_block_t, uint64_t> &block_counts() const {
+        return bb_counts;
+    }
+    // times each branch or jump edge was taken
+    const unordered_map<BlockEdge, uint64_t, BlockEdgeHash> &edge_counts() const {
+        return edges;
+    }
+    string report() const;
+
+    // Stop after this many instructions, 0 for no limit
+    uint64_t max_insts = 0;
+    uint32_t stack_size = 64u << 20;
+
+private:
+    // Where each function keeps its values
+    struct FuncLayout {
+        unordered_map<koopa_raw_value_t, int> slot;            // result of an instruction
+        unordered_map<koopa_raw_value_t, uint32_t> alloc_offset;  // in the frame
+        uint32_t frame_bytes = 0;
+    };
+    struct Frame {
+        koopa_raw_function_t func;
+        const FuncLayout *layout;
+        koopa_raw_basic_block_t bb;
+        uint32_t next_inst;
+        uint32_t base;            // address of the frame
+        vector<int32_t> slots;
+        vector<int32_t> args;
+        koopa_raw_value_t call;   // call waiting for the callee to return
+    };
+
+    const koopa_raw_program_t &program;
+    vector<uint8_t> mem;
+    unordered_map<koopa_raw_value_t, uint32_t> global_addr;
+    unordered_map<koopa_raw_function_t, FuncLayout> layouts;
+    TypeLayouts types;
+    unordered_map<koopa_raw_basic_block_t, uint64_t> bb_counts;
+    unordered_map<BlockEdge, uint64_t, BlockEdgeHash> edges;
+    uint64_t num_executed = 0;
+    string run_error;
+
+    const FuncLayout &layout(const koopa_raw_function_t &func);
+    void init_global(const koopa_raw_value_t &init, uint32_t addr);
+    int32_t operand(const Frame &frame, const koopa_raw_value_t &value);
+    bool check_addr(uint32_t addr);
+    bool call_library(const koopa_raw_function_t &func, const vector<int32_t> &args,
+                      int32_t &ret, FILE *in, FILE *out);
+};
+
+class Profile;
+
+// Parse KoopaIR and interpret it, the report goes to report; returns main's value.
+// The counts of the run are stored in profile, if one is given.
+int interpret_koopa(const char *koopa_ir, FILE *in, FILE *out, string &report, string &error,
+                    Profile *profile = nullptr);
+
+#endif
@@ -0,0 +1,35 @@
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "koopa.h"
+#include "layout.h"
+using namespace std;
+
+uint32_t type_size(const koopa_raw_type_t &ty) {
+    switch (ty->tag) {
+        case KOOPA_RTT_INT32:
+        case KOOPA_RTT_POINTER:
+            return 4;
+        case KOOPA_RTT_ARRAY:
+            return ty->data.array.len * type_size(ty->data.array.base);
+        default:
+            return 0;
+    }
+}
+
+const TypeLayouts::Layout &TypeLayouts::get(const koopa_raw_type_t &ty) {
+    auto it = layouts.find(ty);
+    if (it != layouts.end())
+        return it->second;
+    Layout layout;
+    if (ty->tag == KOOPA_RTT_ARRAY) {
+        const Layout &elem = get(ty->data.array.base);
+        layout.size = ty->data.array.len * elem.size;
+        layout.strides.push_back(layout.size);
+        layout.strides.insert(layout.strides.end(), elem.strides.begin(), elem.strides.end());
+    } else {
+        layout.size = type_size(ty);
+        layout.strides.push_back(layout.size);
+    }
+    return layouts.emplace(ty, layout).first->second;
+}
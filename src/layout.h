@@ -0,0 +1,38 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "koopa.h"
+using namespace std;
+
+// Size in bytes of a value of a type
+uint32_t type_size(const koopa_raw_type_t &ty);
+
+/*
+ * Layout of the types of a raw program, each computed once: the size of
+ * a type and the stride of every index into it. Types are shared by all
+ * values of a program, so the table must not outlive it; it is not
+ * thread safe, each thread keeps its own.
+ */
+class TypeLayouts {
+public:
+    struct Layout {
+        uint32_t size;
+        // strides[k]: bytes between elements at depth k of a pointer to it,
+        // strides[0] is the size itself, the last one is an int
+        vector<uint32_t> strides;
+    };
+    const Layout &get(const koopa_raw_type_t &ty);
+    uint32_t size(const koopa_raw_type_t &ty) { return get(ty).size; }
+    // stride of getptr and getelemptr of a pointer to a type
+    uint32_t ptr_stride(const koopa_raw_type_t &ptr_ty) { return get(ptr_ty->data.pointer.base).size; }
+    uint32_t elem_stride(const koopa_raw_type_t &ptr_ty) { return get(ptr_ty->data.pointer.base).strides[1]; }
+    void clear() { layouts.clear(); }
+
+private:
+    unordered_map<koopa_raw_type_t, Layout> layouts;
+};
+
+#endif
@@ -9,14 +9,110 @@
 #include <sstream>
 #include "ast.h"
 #include "raw.h"
+#include "compiler.h"
+#include "cache.h"
+#include "timer.h"
+#include "sim.h"
+#include "interp.h"
+#include "profile.h"
 
 using namespace std;
 
-extern FILE *yyin;
-extern int yyparse(unique_ptr<BaseAST> &ast);
+/* Run a program on the simulator, its statistics go to stderr */
+static int simulate(const char *input, const char *pipeline) {
+  ifstream ifs(input);
+  if (!ifs) {
+    cerr << "cannot open " << input << endl;
+    return 1;
+  }
+  stringstream buffer;
+  buffer << ifs.rdbuf();
+  string assembly = buffer.str();
+  string path(input);
+  if (path.size() > 2 && (path.substr(path.size() - 2) == ".c" ||
+                          path.substr(path.size() - 3) == ".sy")) {
+    CompileOptions options;
+    options.mode = OutputMode::RiscV;
+    if (!cached_compile(buffer.str(), options, assembly)) {
+      cerr << assembly << endl;
+      return 1;
+    }
+  }
+  Simulator sim;
+  string error;
+  if (pipeline && !sim.timing.parse(pipeline, error)) {
+    cerr << error << endl;
+    return 1;
+  }
+  if (!sim.load(assembly, error)) {
+    cerr << error << endl;
+    return 1;
+  }
+  int ret = sim.run(stdin, stdout);
+  fflush(stdout);
+  if (!sim.error().empty())
+    cerr << "simulation stopped: " << sim.error() << endl;
+  cerr << sim.report();
+  return ret;
+}
+
+/* Interpret the KoopaIR of a SysY source, block counts go to stderr */
+static int interpret(const char *input, const char *profile_path) {
+  ifstream ifs(input);
+  if (!ifs) {
+    cerr << "cannot open " << input << endl;
+    return 1;
+  }
+  stringstream source;
+  source << ifs.rdbuf();
+  CompileOptions options;
+  options.mode = OutputMode::Koopa;
+  string koopa_ir;
+  if (!cached_compile(source.str(), options, koopa_ir)) {
+    cerr << koopa_ir << endl;
+    return 1;
+  }
+  string report, error;
+  Profile profile;
+  int ret = interpret_koopa(koopa_ir.c_str(), stdin, stdout, report, error,
+                            profile_path ? &profile : nullptr);
+  fflush(stdout);
+  if (!error.empty())
+    cerr << "interpretation stopped: " << error << endl;
+  cerr << report;
+  // the profile of a run that stopped early would be misleading
+  if (profile_path && error.empty() && !profile.save(profile_path)) {
+    cerr << "cannot write profile " << profile_path << endl;
+    return 1;
+  }
+  return ret & 0xff;
+}
 
 int main(int argc, const char *argv[]) {
-  assert(argc == 5);
+  // compile server: compiler -server [socket_path]
+  if (argc >= 2 && strcmp(argv[1], "-server") == 0) {
+    if (argc >= 3)
+      return serve_socket(argv[2]);
+    serve_stream(stdin, stdout);
+    return 0;
+  }
+  // simulator: compiler -sim input.S [-sim-config key=value,...],
+  // or a SysY source compiled first
+  if (argc >= 3 && strcmp(argv[1], "-sim") == 0) {
+    const char *pipeline = nullptr;
+    if (argc >= 5 && strcmp(argv[3], "-sim-config") == 0)
+      pipeline = argv[4];
+    return simulate(argv[2], pipeline);
+  }
+  // interpreter: compiler -interp input [-fprofile-generate profile]
+  if (argc >= 3 && strcmp(argv[1], "-interp") == 0) {
+    const char *profile_path = nullptr;
+    if (argc >= 5 && strcmp(argv[3], "-fprofile-generate") == 0)
+      profile_path = argv[4];
+    return interpret(argv[2], profile_path);
+  }
+  // compiler -koopa|-riscv input -o output [-ftime-report[=json]] [-fprofile-use profile]
+  assert(argc >= 5);
   auto mode = argv[1];
   auto input = argv[2];
   ofstream ofs(argv[4]);
@@ -37,21 +133,44 @@ int main(int argc, const char *argv[]) {
 //     return 0;
 //   }
 
-  yyin = fopen(input, "r");
-  assert(yyin);
-  unique_ptr<BaseAST> ast;
-  auto ret = yyparse(ast);
-  assert(!ret);
+  ifstream ifs(input);
+  assert(ifs);
+  stringstream source;
+  source << ifs.rdbuf();
 
-  string koopa_ir("");
-  import_sysy_lib(koopa_ir);
-  ast->dump2str(koopa_ir); // First dump ast to string
-  if (mode[1] == 'k') {
-    ofs << koopa_ir;
-  } else if (mode[1] == 'r') {
-    string riscv_str("");
-    koopa2riscv(koopa_ir.c_str(), riscv_str);
-    ofs << riscv_str;
+  CompileOptions options;
+  options.mode = mode[1] == 'r' ? OutputMode::RiscV : OutputMode::Koopa;
+  // Report time and memory of each phase on stderr
+  TimeReport report;
+  bool report_json = false;
+  Profile profile;
+  for (int i = 5; i < argc; ++i) {
+    if (strcmp(argv[i], "-ftime-report") == 0) {
+      time_report = &report;
+    } else if (strcmp(argv[i], "-ftime-report=json") == 0) {
+      time_report = &report;
+      report_json = true;
+    } else if (strcmp(argv[i], "-fprofile-use") == 0 && i + 1 < argc) {
+      string error;
+      if (!profile.load(argv[++i], error)) {
+        cerr << error << endl;
+        return 1;
+      }
+      options.profile = &profile;
+    }
+  }
+  string output;
+  bool ok;
+  {
+    PhaseTimer timer("total");
+    ok = cached_compile(source.str(), options, output);
+  }
+  if (time_report)
+    cerr << (report_json ? report.json() : report.table());
+  if (!ok) {
+    cerr << output << endl;
+    return 1;
   }
+  ofs << output;
   return 0;
 }
@@ -0,0 +1,969 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include "koopa.h"
+#include "pass.h"
+#include "alias.h"
+#include "timer.h"
+using namespace std;
+
+/* Task queue of one worker, others steal from its front */
+struct WorkQueue {
+    mutex lock;
+    deque<size_t> tasks;
+};
+
+/* Run task(0) ... task(num_tasks - 1) on a work-stealing pool of threads */
+static void run_on_pool(size_t num_tasks, unsigned int num_threads,
+                        const function<void(size_t)> &task) {
+    if (num_threads == 0)
+        num_threads = thread::hardware_concurrency();
+    if (num_threads > num_tasks)
+        num_threads = num_tasks;
+    // phases timed by the tasks go to the report of the compile
+    TimeReport *report = time_report;
+    if (num_threads <= 1) {
+        WorkerTimes times(report);
+        for (size_t i = 0; i < num_tasks; ++i)
+            task(i);
+        return;
+    }
+    // Give each worker a contiguous share, idle workers steal the rest
+    vector<WorkQueue> queues(num_threads);
+    for (size_t i = 0; i < num_tasks; ++i)
+        queues[i * num_threads / num_tasks].tasks.push_back(i);
+    auto worker = [&](unsigned int id) {
+        WorkerTimes times(report);
+        while (true) {
+            bool found = false;
+            size_t i = 0;
+            {
+                lock_guard<mutex> guard(queues[id].lock);
+                if (!queues[id].tasks.empty()) {
+                    i = queues[id].tasks.back();
+                    queues[id].tasks.pop_back();
+                    found = true;
+                }
+            }
+            for (unsigned int k = 1; !found && k < num_threads; ++k) {
+                WorkQueue &victim = queues[(id + k) % num_threads];
+                lock_guard<mutex> guard(victim.lock);
+                if (!victim.tasks.empty()) {
+                    i = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    found = true;
+                }
+            }
+            if (!found)  // tasks never spawn new tasks, so all work is taken
+                return;
+            task(i);
+        }
+    };
+    vector<thread> pool;
+    for (unsigned int t = 1; t < num_threads; ++t)
+        pool.emplace_back(worker, t);
+    worker(0);
+    for (auto &t : pool)
+        t.join();
+}
+
+void PassManager::add_func_pass(const string &name, FuncPass pass) {
+    Pass p;
+    p.name = name;
+    p.func_pass = pass;
+    passes.push_back(p);
+}
+
+void PassManager::add_module_pass(const string &name, ModulePass pass) {
+    Pass p;
+    p.name = name;
+    p.module_pass = pass;
+    passes.push_back(p);
+}
+
+void PassManager::run(const koopa_raw_program_t &program, ModuleInfo &info) {
+    info.funcs.resize(program.funcs.len);
+    for (size_t i = 0; i < program.funcs.len; ++i) {
+        info.func_index[reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i])] = i;
+        info.funcs[i].module = &info;
+    }
+    size_t i = 0;
+    while (i < passes.size()) {
+        if (passes[i].module_pass) {
+            PhaseTimer timer("pass: " + passes[i].name);
+            passes[i].module_pass(program, info);
+            i++;
+            continue;
+        }
+        size_t j = i;
+        while (j < passes.size() && passes[j].func_pass)
+            j++;
+        // function passes of a stage run interleaved, so they are timed together
+        string stage_name("pass:");
+        for (size_t k = i; k < j; ++k)
+            stage_name += " " + passes[k].name;
+        PhaseTimer timer(stage_name);
+        run_func_stage(program, info, i, j);
+        i = j;
+    }
+}
+
+/* Run function passes [first, last) on every live function */
+void PassManager::run_func_stage(const koopa_raw_program_t &program, ModuleInfo &info,
+                                 size_t first, size_t last) {
+    vector<size_t> work;
+    for (size_t i = 0; i < program.funcs.len; ++i) {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if (func->bbs.len > 0 && !info.funcs[i].dead)
+            work.push_back(i);
+    }
+    // names of the phases, built once and only when they are timed
+    vector<string> timer_names;
+    if (time_report) {
+        for (size_t p = first; p < last; ++p)
+            timer_names.push_back("pass: " + passes[p].name + " (per function)");
+    }
+    run_on_pool(work.size(), num_threads, [&](size_t k) {
+        size_t i = work[k];
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        for (size_t p = first; p < last; ++p) {
+            if (timer_names.empty()) {
+                passes[p].func_pass(func, info.funcs[i]);
+                continue;
+            }
+            PhaseTimer timer(timer_names[p - first]);
+            passes[p].func_pass(func, info.funcs[i]);
+        }
+    });
+}
+
+void get_operands(const koopa_raw_value_t &value, vector<koopa_raw_value_t> &ops) {
+    const auto &kind = value->kind;
+    switch (kind.tag) {
+        case KOOPA_RVT_LOAD:
+            ops.push_back(kind.data.load.src);
+            break;
+        case KOOPA_RVT_STORE:
+            ops.push_back(kind.data.store.value);
+            ops.push_back(kind.data.store.dest);
+            break;
+        case KOOPA_RVT_GET_PTR:
+            ops.push_back(kind.data.get_ptr.src);
+            ops.push_back(kind.data.get_ptr.index);
+            break;
+        case KOOPA_RVT_GET_ELEM_PTR:
+            ops.push_back(kind.data.get_elem_ptr.src);
+            ops.push_back(kind.data.get_elem_ptr.index);
+            break;
+        case KOOPA_RVT_BINARY:
+            ops.push_back(kind.data.binary.lhs);
+            ops.push_back(kind.data.binary.rhs);
+            break;
+        case KOOPA_RVT_BRANCH:
+            ops.push_back(kind.data.branch.cond);
+            break;
+        case KOOPA_RVT_CALL:
+            for (size_t i = 0; i < kind.data.call.args.len; ++i)
+                ops.push_back(reinterpret_cast<koopa_raw_value_t>(kind.data.call.args.buffer[i]));
+            break;
+        case KOOPA_RVT_RETURN:
+            if (kind.data.ret.value)
+                ops.push_back(kind.data.ret.value);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Mark functions which can not be called starting from main */
+void remove_dead_funcs(const koopa_raw_program_t &program, ModuleInfo &info) {
+    koopa_raw_function_t main_func = nullptr;
+    for (size_t i = 0; i < program.funcs.len; ++i) {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if (string(func->name) == "@main")
+            main_func = func;
+    }
+    if (!main_func)  // not a whole program, keep everything
+        return;
+    vector<bool> live(program.funcs.len, false);
+    vector<koopa_raw_function_t> work;
+    live[info.func_index[main_func]] = true;
+    work.push_back(main_func);
+    while (!work.empty()) {
+        auto func = work.back();
+        work.pop_back();
+        for (size_t i = 0; i < func->bbs.len; ++i) {
+            auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+            for (size_t j = 0; j < block->insts.len; ++j) {
+                auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
+                if (value->kind.tag != KOOPA_RVT_CALL)
+                    continue;
+                auto callee = value->kind.data.call.callee;
+                int id = info.func_index[callee];
+                if (!live[id]) {
+                    live[id] = true;
+                    work.push_back(callee);
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < program.funcs.len; ++i)
+        info.funcs[i].dead = !live[i];
+}
+
+/* Mark global variables which no live function uses */
+void remove_dead_globals(const koopa_raw_program_t &program, ModuleInfo &info) {
+    unordered_set<koopa_raw_value_t> used;
+    vector<koopa_raw_value_t> ops;
+    for (size_t i = 0; i < program.funcs.len; ++i) {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if (info.funcs[i].dead)
+            continue;
+        for (size_t j = 0; j < func->bbs.len; ++j) {
+            auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[j]);
+            for (size_t k = 0; k < block->insts.len; ++k) {
+                ops.clear();
+                get_operands(reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[k]), ops);
+                for (auto op : ops) {
+                    if (op->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+                        used.insert(op);
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < program.values.len; ++i) {
+        auto value = reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]);
+        if (!used.count(value))
+            info.dead_globals.insert(value);
+    }
+}
+
+/* Successors of a basic block, given by its terminator */
+static void get_succs(const koopa_raw_basic_block_t &bb, vector<koopa_raw_basic_block_t> &succs) {
+    if (bb->insts.len == 0)
+        return;
+    auto last = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+    if (last->kind.tag == KOOPA_RVT_BRANCH) {
+        succs.push_back(last->kind.data.branch.true_bb);
+        succs.push_back(last->kind.data.branch.false_bb);
+    } else if (last->kind.tag == KOOPA_RVT_JUMP) {
+        succs.push_back(last->kind.data.jump.target);
+    }
+}
+
+/* Find blocks which can not be reached from the entry block */
+void find_unreachable_bbs(const koopa_raw_function_t &func, FuncInfo &info) {
+    unordered_set<koopa_raw_basic_block_t> reached;
+    vector<koopa_raw_basic_block_t> work, succs;
+    auto entry = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]);
+    reached.insert(entry);
+    work.push_back(entry);
+    while (!work.empty()) {
+        auto bb = work.back();
+        work.pop_back();
+        succs.clear();
+        get_succs(bb, succs);
+        for (auto succ : succs) {
+            if (reached.insert(succ).second)
+                work.push_back(succ);
+        }
+    }
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        if (!reached.count(bb))
+            info.unreachable_bbs.insert(bb);
+    }
+}
+
+/* Loop depth of each block: blocks are created in source order, so a branch back closes a loop */
+static vector<int> loop_depths(const vector<koopa_raw_basic_block_t> &blocks,
+                               unordered_map<koopa_raw_basic_block_t, int> &index) {
+    vector<int> depth(blocks.size(), 0);
+    vector<koopa_raw_basic_block_t> succs;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        succs.clear();
+        get_succs(blocks[i], succs);
+        for (auto succ : succs) {
+            int head = index[succ];
+            if (head <= (int)i) {
+                for (size_t k = head; k <= i; ++k)
+                    depth[k]++;
+            }
+        }
+    }
+    return depth;
+}
+
+/*
+ * How often each block runs: the counts of the profile, or without one
+ * 8 times per loop around the block. Only the ratios between blocks mean
+ * something, so a choice is worth it when its savings over the blocks
+ * outweigh its cost in the entry block.
+ */
+void estimate_block_freq(const koopa_raw_function_t &func, FuncInfo &info) {
+    size_t num_bbs = func->bbs.len;
+    vector<koopa_raw_basic_block_t> blocks(num_bbs);
+    unordered_map<koopa_raw_basic_block_t, int> index;
+    for (size_t i = 0; i < num_bbs; ++i) {
+        blocks[i] = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        index[blocks[i]] = i;
+    }
+    vector<int> depth = loop_depths(blocks, index);
+    info.block_freq.clear();
+    info.loop_depth.clear();
+    for (size_t i = 0; i < num_bbs; ++i) {
+        info.loop_depth[blocks[i]] = depth[i];
+        double freq = pow(8.0, min(depth[i], 10));
+        if (info.profile) {
+            auto it = info.block_counts.find(blocks[i]);
+            freq = it == info.block_counts.end() ? 0 : it->second;
+        }
+        info.block_freq[blocks[i]] = freq;
+    }
+}
+
+/* Probability that a branch goes to its true block, by static heuristics */
+static double branch_probability(const koopa_raw_basic_block_t &bb, const koopa_raw_branch_t &br,
+                                 const unordered_map<koopa_raw_basic_block_t, int> &index,
+                                 const FuncInfo &info) {
+    int from = index.at(bb), t = index.at(br.true_bb), f = index.at(br.false_bb);
+    // blocks are created in source order, so a branch back is a loop
+    bool t_back = t <= from, f_back = f <= from;
+    if (t_back != f_back)
+        return t_back ? 0.88 : 0.12;
+    // staying in a loop is more likely than leaving it
+    auto depth = [&](const koopa_raw_basic_block_t &b) {
+        auto it = info.loop_depth.find(b);
+        return it == info.loop_depth.end() ? 0 : it->second;
+    };
+    int t_depth = depth(br.true_bb), f_depth = depth(br.false_bb);
+    if (t_depth != f_depth)
+        return t_depth > f_depth ? 0.88 : 0.12;
+    // returning early is less likely than going on
+    auto ends_in_ret = [](const koopa_raw_basic_block_t &b) {
+        if (b->insts.len == 0)
+            return false;
+        auto last = reinterpret_cast<koopa_raw_value_t>(b->insts.buffer[b->insts.len - 1]);
+        return last->kind.tag == KOOPA_RVT_RETURN;
+    };
+    bool t_ret = ends_in_ret(br.true_bb), f_ret = ends_in_ret(br.false_bb);
+    if (t_ret != f_ret)
+        return t_ret ? 0.28 : 0.72;
+    return 0.5;
+}
+
+/*
+ * Order the blocks of a function for code generation (Pettis-Hansen).
+ * Edges are visited from the heaviest and join two chains whenever the
+ * edge goes from the tail of one to the head of the other, so the likely
+ * successor of a block becomes its fall through. Weights are the counts
+ * of the profile, or without one the frequencies from block-freq split
+ * by branch heuristics. The entry chain is placed first and chains which
+ * never ran last.
+ */
+void layout_blocks(const koopa_raw_function_t &func, FuncInfo &info) {
+    size_t num_bbs = func->bbs.len;
+    if (num_bbs <= 1)
+        return;
+    vector<koopa_raw_basic_block_t> blocks(num_bbs);
+    unordered_map<koopa_raw_basic_block_t, int> index;
+    for (size_t i = 0; i < num_bbs; ++i) {
+        blocks[i] = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        index[blocks[i]] = i;
+    }
+
+    // Estimated by block-freq, which runs before
+    auto block_freq = [&](const koopa_raw_basic_block_t &bb) {
+        auto it = info.block_freq.find(bb);
+        return it == info.block_freq.end() ? 1.0 : it->second;
+    };
+
+    struct Edge {
+        int from, to;
+        double weight;
+        bool jump;  // falling through a jump saves an instruction, not just a branch
+    };
+    vector<Edge> edges;
+    for (size_t i = 0; i < num_bbs; ++i) {
+        auto bb = blocks[i];
+        if (info.unreachable_bbs.count(bb) || bb->insts.len == 0)
+            continue;
+        auto last = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+        double freq = block_freq(bb);
+        if (last->kind.tag == KOOPA_RVT_BRANCH) {
+            const auto &br = last->kind.data.branch;
+            if (br.true_bb == br.false_bb)
+                continue;
+            double p = branch_probability(bb, br, index, info);
+            double t = freq * p, f = freq * (1 - p);
+            if (info.profile) {
+                auto it = info.edge_counts.find(BlockEdge(bb, br.true_bb));
+                t = it == info.edge_counts.end() ? 0 : it->second;
+                it = info.edge_counts.find(BlockEdge(bb, br.false_bb));
+                f = it == info.edge_counts.end() ? 0 : it->second;
+            }
+            edges.push_back({(int)i, index[br.true_bb], t, false});
+            edges.push_back({(int)i, index[br.false_bb], f, false});
+        } else if (last->kind.tag == KOOPA_RVT_JUMP) {
+            auto target = last->kind.data.jump.target;
+            double w = freq;
+            if (info.profile) {
+                auto it = info.edge_counts.find(BlockEdge(bb, target));
+                w = it == info.edge_counts.end() ? 0 : it->second;
+            }
+            edges.push_back({(int)i, index[target], w, true});
+        }
+    }
+    // heaviest first, jumps before branches, then in source order
+    stable_sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {
+        if (a.weight != b.weight)
+            return a.weight > b.weight;
+        return a.jump && !b.jump;
+    });
+
+    vector<vector<int>> chains(num_bbs);
+    vector<int> chain_of(num_bbs);
+    for (size_t i = 0; i < num_bbs; ++i) {
+        chains[i].push_back(i);
+        chain_of[i] = i;
+    }
+    for (auto &e : edges) {
+        int a = chain_of[e.from], b = chain_of[e.to];
+        if (a == b || e.to == 0 || chains[a].back() != e.from || chains[b].front() != e.to)
+            continue;
+        for (int k : chains[b]) {
+            chains[a].push_back(k);
+            chain_of[k] = a;
+        }
+        chains[b].clear();
+    }
+
+    // Chains by the position of their head, cold ones after all others
+    auto cold = [&](int c) {
+        if (!info.profile)
+            return false;
+        for (int k : chains[c]) {
+            auto it = info.block_counts.find(blocks[k]);
+            if (it != info.block_counts.end() && it->second > 0)
+                return false;
+        }
+        return true;
+    };
+    vector<int> hot_chains, cold_chains;
+    for (size_t c = 1; c < num_bbs; ++c) {
+        if (chains[c].empty())
+            continue;
+        (cold(c) ? cold_chains : hot_chains).push_back(c);
+    }
+    auto by_head = [&](int a, int b) { return chains[a].front() < chains[b].front(); };
+    sort(hot_chains.begin(), hot_chains.end(), by_head);
+    sort(cold_chains.begin(), cold_chains.end(), by_head);
+    info.layout.clear();
+    info.layout.reserve(num_bbs);
+    for (int k : chains[0])
+        info.layout.push_back(blocks[k]);
+    for (auto *group : {&hot_chains, &cold_chains}) {
+        for (int c : *group) {
+            for (int k : chains[c])
+                info.layout.push_back(blocks[k]);
+        }
+    }
+}
+
+/* Reachable blocks in reverse post order from the entry */
+static vector<koopa_raw_basic_block_t> reverse_post_order(const koopa_raw_function_t &func) {
+    vector<koopa_raw_basic_block_t> order, succs;
+    unordered_set<koopa_raw_basic_block_t> visited;
+    // stack of (block, successors done)
+    vector<pair<koopa_raw_basic_block_t, size_t>> stack;
+    auto entry = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]);
+    visited.insert(entry);
+    stack.push_back(make_pair(entry, 0));
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        succs.clear();
+        get_succs(top.first, succs);
+        if (top.second < succs.size()) {
+            auto succ = succs[top.second++];
+            if (visited.insert(succ).second)
+                stack.push_back(make_pair(succ, 0));
+            continue;
+        }
+        order.push_back(top.first);
+        stack.pop_back();
+    }
+    reverse(order.begin(), order.end());
+    return order;
+}
+
+/* Whether two values are known to be equal: the same value or the same number */
+static bool same_value(const koopa_raw_value_t &a, const koopa_raw_value_t &b) {
+    if (a == b)
+        return true;
+    return a->kind.tag == KOOPA_RVT_INTEGER && b->kind.tag == KOOPA_RVT_INTEGER &&
+           a->kind.data.integer.value == b->kind.data.integer.value;
+}
+
+/*
+ * Redundant load elimination: the front end loads a variable for every
+ * use, so a load often reads a word whose value is already known, stored
+ * or loaded before on every path with nothing in between which may write
+ * it. Such a load is recorded with the value it reads. Blocks are visited
+ * in reverse post order and a block takes the words known at the end of
+ * all its predecessors. A loop header does not wait for the back edges:
+ * it keeps what no store or call in the loop may write.
+ */
+void eliminate_redundant_loads(const koopa_raw_function_t &func, FuncInfo &info) {
+    info.load_source.clear();
+    if (func->bbs.len == 0)
+        return;
+    AliasAnalysis aa(func, info.module);
+    vector<koopa_raw_basic_block_t> order = reverse_post_order(func);
+    unordered_map<koopa_raw_basic_block_t, int> rpo;
+    for (size_t i = 0; i < order.size(); ++i)
+        rpo[order[i]] = i;
+    unordered_map<koopa_raw_basic_block_t, vector<koopa_raw_basic_block_t>> preds;
+    vector<koopa_raw_basic_block_t> succs;
+    for (auto bb : order) {
+        succs.clear();
+        get_succs(bb, succs);
+        for (auto succ : succs)
+            preds[succ].push_back(bb);
+    }
+
+    // known words: pointer and the value it holds
+    using Known = vector<pair<koopa_raw_value_t, koopa_raw_value_t>>;
+    unordered_map<koopa_raw_basic_block_t, Known> known_out;
+    auto leader = [&](const koopa_raw_value_t &value) {
+        auto it = info.load_source.find(value);
+        return it == info.load_source.end() ? value : it->second;
+    };
+    for (auto bb : order) {
+        Known known;
+        bool first = true, loop_header = false;
+        for (auto pred : preds[bb]) {
+            if (rpo[pred] >= rpo[bb]) {
+                loop_header = true;
+                continue;
+            }
+            const Known &out = known_out[pred];
+            if (first) {
+                known = out;
+                first = false;
+                continue;
+            }
+            Known both;
+            for (auto &word : known) {
+                for (auto &other : out) {
+                    if (same_value(word.second, other.second) &&
+                        aa.alias(word.first, other.first) == MUST_ALIAS) {
+                        both.push_back(word);
+                        break;
+                    }
+                }
+            }
+            known.swap(both);
+        }
+        if (loop_header && !known.empty()) {
+            // the blocks of the loop: those reaching a back edge without the header
+            unordered_set<koopa_raw_basic_block_t> body;
+            vector<koopa_raw_basic_block_t> work;
+            body.insert(bb);
+            for (auto pred : preds[bb]) {
+                if (rpo[pred] >= rpo[bb] && body.insert(pred).second)
+                    work.push_back(pred);
+            }
+            while (!work.empty()) {
+                auto k = work.back();
+                work.pop_back();
+                for (auto pred : preds[k]) {
+                    if (body.insert(pred).second)
+                        work.push_back(pred);
+                }
+            }
+            for (auto block : body) {
+                for (size_t j = 0; j < block->insts.len && !known.empty(); ++j) {
+                    auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
+                    if (value->kind.tag != KOOPA_RVT_STORE && value->kind.tag != KOOPA_RVT_CALL)
+                        continue;
+                    known.erase(remove_if(known.begin(), known.end(), [&](const pair<koopa_raw_value_t, koopa_raw_value_t> &word) {
+                        return aa.mod_ref(value, word.first) & MOD;
+                    }), known.end());
+                }
+            }
+        }
+
+        for (size_t j = 0; j < bb->insts.len; ++j) {
+            auto value = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+            const auto &kind = value->kind;
+            if (kind.tag == KOOPA_RVT_LOAD) {
+                const auto &src = kind.data.load.src;
+                bool found = false;
+                for (auto &word : known) {
+                    if (aa.alias(word.first, src) == MUST_ALIAS) {
+                        info.load_source[value] = word.second;
+                        aa.set_leader(value, word.second);
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found)
+                    known.push_back(make_pair(src, value));
+            } else if (kind.tag == KOOPA_RVT_STORE || kind.tag == KOOPA_RVT_CALL) {
+                known.erase(remove_if(known.begin(), known.end(), [&](const pair<koopa_raw_value_t, koopa_raw_value_t> &word) {
+                    return aa.mod_ref(value, word.first) & MOD;
+                }), known.end());
+                // arguments are not values of the function, they live in regs
+                if (kind.tag == KOOPA_RVT_STORE &&
+                    kind.data.store.value->kind.tag != KOOPA_RVT_FUNC_ARG_REF)
+                    known.push_back(make_pair(kind.data.store.dest, leader(kind.data.store.value)));
+            }
+        }
+        known_out[bb].swap(known);
+    }
+}
+
+/*
+ * Dead store elimination: a store is dead when on every path after it the
+ * word is stored again before anything may read it, or the function
+ * returns and the word is a local. Backward over the blocks until nothing
+ * changes; loads replaced by a known value read nothing. Going back to an
+ * earlier iteration of a loop, a pointer with a variable index may point
+ * elsewhere, so only fixed words cross back edges.
+ */
+void eliminate_dead_stores(const koopa_raw_function_t &func, FuncInfo &info) {
+    info.dead_stores.clear();
+    if (func->bbs.len == 0)
+        return;
+    AliasAnalysis aa(func, info.module);
+    for (auto &src : info.load_source)
+        aa.set_leader(src.first, src.second);
+    vector<koopa_raw_basic_block_t> order = reverse_post_order(func);
+    unordered_map<koopa_raw_basic_block_t, int> rpo;
+    for (size_t i = 0; i < order.size(); ++i)
+        rpo[order[i]] = i;
+
+    // words stored again before any read; all locals as well when returning
+    struct Dead {
+        bool top = true;  // not computed yet, everything
+        bool all_locals = false;
+        vector<koopa_raw_value_t> ptrs;
+    };
+    auto is_local = [&](const koopa_raw_value_t &ptr) {
+        return aa.locate(ptr).kind == AliasAnalysis::Location::LOCAL;
+    };
+    // may point at a local of the function
+    auto may_local = [&](const koopa_raw_value_t &ptr) {
+        auto kind = aa.locate(ptr).kind;
+        return kind == AliasAnalysis::Location::LOCAL || kind == AliasAnalysis::Location::UNKNOWN;
+    };
+    unordered_map<koopa_raw_basic_block_t, Dead> dead_in;
+    vector<koopa_raw_basic_block_t> succs;
+    auto transfer = [&](const koopa_raw_basic_block_t &bb, bool mark) {
+        Dead dead;
+        dead.top = false;
+        succs.clear();
+        get_succs(bb, succs);
+        if (bb->insts.len == 0)
+            return dead;
+        auto last = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+        if (last->kind.tag == KOOPA_RVT_RETURN)
+            dead.all_locals = true;
+        bool first = true;
+        for (auto succ : succs) {
+            Dead in = dead_in[succ];
+            if (in.top)
+                continue;
+            if (rpo[succ] <= rpo[bb]) {
+                in.ptrs.erase(remove_if(in.ptrs.begin(), in.ptrs.end(), [&](const koopa_raw_value_t &ptr) {
+                    const auto &loc = aa.locate(ptr);
+                    return !loc.terms.empty() || loc.kind == AliasAnalysis::Location::UNKNOWN;
+                }), in.ptrs.end());
+            }
+            if (first) {
+                dead = in;
+                first = false;
+                continue;
+            }
+            dead.all_locals = dead.all_locals && in.all_locals;
+            vector<koopa_raw_value_t> both;
+            for (auto ptr : dead.ptrs) {
+                for (auto other : in.ptrs) {
+                    if (aa.alias(ptr, other) == MUST_ALIAS) {
+                        both.push_back(ptr);
+                        break;
+                    }
+                }
+            }
+            dead.ptrs.swap(both);
+        }
+        for (size_t j = bb->insts.len; j-- > 0;) {
+            auto value = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+            const auto &kind = value->kind;
+            if (kind.tag == KOOPA_RVT_STORE) {
+                const auto &dest = kind.data.store.dest;
+                bool overwritten = dead.all_locals && is_local(dest);
+                for (size_t k = 0; k < dead.ptrs.size() && !overwritten; ++k)
+                    overwritten = aa.alias(dead.ptrs[k], dest) == MUST_ALIAS;
+                if (overwritten) {
+                    if (mark)
+                        info.dead_stores.insert(value);
+                } else {
+                    dead.ptrs.push_back(dest);
+                }
+            } else if ((kind.tag == KOOPA_RVT_LOAD && !info.load_source.count(value)) ||
+                       kind.tag == KOOPA_RVT_CALL) {
+                dead.ptrs.erase(remove_if(dead.ptrs.begin(), dead.ptrs.end(), [&](const koopa_raw_value_t &ptr) {
+                    return aa.mod_ref(value, ptr) & REF;
+                }), dead.ptrs.end());
+                if (kind.tag == KOOPA_RVT_LOAD && may_local(kind.data.load.src))
+                    dead.all_locals = false;
+                for (size_t a = 0; kind.tag == KOOPA_RVT_CALL && a < kind.data.call.args.len; ++a) {
+                    auto arg = reinterpret_cast<koopa_raw_value_t>(kind.data.call.args.buffer[a]);
+                    if (arg->ty->tag == KOOPA_RTT_POINTER && may_local(arg))
+                        dead.all_locals = false;
+                }
+            }
+        }
+        return dead;
+    };
+    // every word of one set is one of the other
+    auto covers = [&](const vector<koopa_raw_value_t> &ptrs, const vector<koopa_raw_value_t> &others) {
+        for (auto ptr : ptrs) {
+            bool found = false;
+            for (size_t k = 0; k < others.size() && !found; ++k)
+                found = aa.alias(ptr, others[k]) == MUST_ALIAS;
+            if (!found)
+                return false;
+        }
+        return true;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = order.size(); i-- > 0;) {
+            auto bb = order[i];
+            Dead dead = transfer(bb, false);
+            Dead &in = dead_in[bb];
+            if (in.top || in.all_locals != dead.all_locals || !covers(in.ptrs, dead.ptrs) ||
+                !covers(dead.ptrs, in.ptrs)) {
+                in = dead;
+                changed = true;
+            }
+        }
+    }
+    for (auto bb : order)
+        transfer(bb, true);
+}
+
+/*
+ * Promote scalar globals to registers over loops (the backend holds them
+ * in saved regs): each is loaded when the loop is entered and, if the loop
+ * stores it, stored back when the loop is left. SysY can not take the
+ * address of a scalar, so only calls may touch it behind the loop's back;
+ * a global is left alone in a loop calling functions which may use it.
+ * Promoted loops never overlap: a loop is promoted rather than the loops
+ * inside it when it saves more than they do together.
+ */
+void promote_globals(const koopa_raw_function_t &func, FuncInfo &info) {
+    size_t num_bbs = func->bbs.len;
+    info.promoted_loops.clear();
+    if (num_bbs <= 1)
+        return;
+    vector<koopa_raw_basic_block_t> blocks(num_bbs);
+    unordered_map<koopa_raw_basic_block_t, int> index;
+    for (size_t i = 0; i < num_bbs; ++i) {
+        blocks[i] = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        index[blocks[i]] = i;
+    }
+    vector<vector<int>> preds(num_bbs);
+    vector<koopa_raw_basic_block_t> succs;
+    for (size_t i = 0; i < num_bbs; ++i) {
+        if (info.unreachable_bbs.count(blocks[i]))
+            continue;
+        succs.clear();
+        get_succs(blocks[i], succs);
+        for (auto succ : succs)
+            preds[index[succ]].push_back(i);
+    }
+    auto freq = [&](int b) {
+        auto it = info.block_freq.find(blocks[b]);
+        return it == info.block_freq.end() ? 1.0 : it->second;
+    };
+
+    // Natural loops by header: the blocks reaching a back edge without the header
+    map<int, vector<bool>> loops;
+    for (size_t h = 1; h < num_bbs; ++h) {
+        for (int b : preds[h]) {
+            if (b < (int)h)
+                continue;
+            vector<bool> &body = loops[h];
+            body.resize(num_bbs, false);
+            body[h] = true;
+            vector<int> work;
+            if (!body[b]) {
+                body[b] = true;
+                work.push_back(b);
+            }
+            while (!work.empty()) {
+                int k = work.back();
+                work.pop_back();
+                for (int p : preds[k]) {
+                    if (!body[p]) {
+                        body[p] = true;
+                        work.push_back(p);
+                    }
+                }
+            }
+        }
+    }
+    vector<pair<int, int>> by_size;  // (-size, header), outermost first
+    for (auto &loop : loops)
+        by_size.push_back(make_pair(-(int)count(loop.second.begin(), loop.second.end(), true),
+                                    loop.first));
+    sort(by_size.begin(), by_size.end());
+
+    size_t num_loops = by_size.size();
+    vector<PromotedLoop> cands(num_loops);
+    vector<double> saved(num_loops, 0);  // instructions saved by promoting the loop
+    AliasAnalysis aa(func, info.module);
+    for (size_t l = 0; l < num_loops; ++l) {
+        int h = by_size[l].second;
+        const vector<bool> &body = loops[h];
+        bool ok = !body[0];
+        double entry_freq = 0, exit_freq = 0;
+        for (size_t k = 0; k < num_bbs && ok; ++k) {
+            if (!body[k])
+                continue;
+            // one way in, through the header
+            for (int p : preds[k]) {
+                if (!body[p] && (int)k != h)
+                    ok = false;
+                if (!body[p] && (int)k == h)
+                    entry_freq += freq(p);
+            }
+            succs.clear();
+            get_succs(blocks[k], succs);
+            for (auto succ : succs) {
+                auto it = info.edge_counts.find(BlockEdge(blocks[k], succ));
+                if (!body[index[succ]] && it != info.edge_counts.end())
+                    exit_freq += it->second;
+            }
+        }
+        if (!ok || entry_freq == 0)
+            continue;
+
+        PromotedLoop &loop = cands[l];
+        loop.header = blocks[h];
+        vector<koopa_raw_value_t> loop_calls;
+        unordered_map<koopa_raw_value_t, double> gain;
+        vector<koopa_raw_value_t> order;  // globals by first use
+        for (size_t k = 0; k < num_bbs; ++k) {
+            if (!body[k])
+                continue;
+            auto block = blocks[k];
+            loop.blocks.insert(block);
+            for (size_t j = 0; j < block->insts.len; ++j) {
+                auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
+                const auto &kind = value->kind;
+                if (kind.tag == KOOPA_RVT_RETURN) {
+                    if (info.profile)
+                        exit_freq += freq(k);
+                    continue;
+                }
+                if (kind.tag == KOOPA_RVT_CALL)
+                    loop_calls.push_back(value);
+                koopa_raw_value_t glb = nullptr;
+                if (info.load_source.count(value) || info.dead_stores.count(value))
+                    continue;
+                if (kind.tag == KOOPA_RVT_LOAD) {
+                    glb = kind.data.load.src;
+                } else if (kind.tag == KOOPA_RVT_STORE) {
+                    glb = kind.data.store.dest;
+                    if (glb->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+                        loop.stored.insert(glb);
+                }
+                if (!glb || glb->kind.tag != KOOPA_RVT_GLOBAL_ALLOC ||
+                    glb->ty->data.pointer.base->tag != KOOPA_RTT_INT32)
+                    continue;
+                if (!gain.count(glb))
+                    order.push_back(glb);
+                gain[glb] += freq(k);  // an access of the slot instead of memory
+            }
+        }
+        // without a profile, a loop is taken to be left as often as it is entered
+        if (!info.profile)
+            exit_freq = entry_freq;
+        // a load on the way in, a store on the way out, the save and restore of the reg
+        double func_freq = freq(0);
+        for (auto glb : order) {
+            bool clobbered = false;
+            for (auto call : loop_calls)
+                clobbered = clobbered || aa.mod_ref(call, glb) != NO_MOD_REF;
+            if (clobbered)
+                continue;
+            double cost = entry_freq + 2 * func_freq;
+            if (loop.stored.count(glb))
+                cost += exit_freq;
+            if (gain[glb] > cost) {
+                loop.globals.push_back(glb);
+                saved[l] += gain[glb] - cost;
+            }
+        }
+        stable_sort(loop.globals.begin(), loop.globals.end(),
+                    [&](koopa_raw_value_t a, koopa_raw_value_t b) { return gain[a] > gain[b]; });
+    }
+
+    // Loop tree: the parent of a loop is the smallest loop around its header
+    vector<int> parent(num_loops, -1);
+    vector<vector<int>> children(num_loops);
+    for (size_t l = 0; l < num_loops; ++l) {
+        for (size_t k = 0; k < l; ++k) {
+            if (by_size[k].first < by_size[l].first && loops[by_size[k].second][by_size[l].second])
+                parent[l] = k;
+        }
+        if (parent[l] >= 0)
+            children[parent[l]].push_back(l);
+    }
+    // Inner loops first: the best of promoting a loop or the best inside it
+    vector<double> best(num_loops, 0);
+    vector<bool> promote(num_loops, false);
+    for (size_t l = num_loops; l-- > 0;) {
+        double inner = 0;
+        for (int c : children[l])
+            inner += best[c];
+        promote[l] = !cands[l].globals.empty() && saved[l] > inner;
+        best[l] = promote[l] ? saved[l] : inner;
+    }
+    vector<int> work;
+    for (size_t l = 0; l < num_loops; ++l) {
+        if (parent[l] < 0)
+            work.push_back(l);
+    }
+    while (!work.empty()) {
+        int l = work.back();
+        work.pop_back();
+        if (promote[l]) {
+            info.promoted_loops.push_back(cands[l]);
+            continue;
+        }
+        work.insert(work.end(), children[l].begin(), children[l].end());
+    }
+}
+
+void add_default_passes(PassManager &pm) {
+    pm.add_module_pass("dead-funcs", remove_dead_funcs);
+    pm.add_module_pass("dead-globals", remove_dead_globals);
+    pm.add_module_pass("effects", compute_effects);
+    pm.add_func_pass("unreachable-bbs", find_unreachable_bbs);
+    pm.add_func_pass("block-freq", estimate_block_freq);
+    pm.add_func_pass("block-layout", layout_blocks);
+    pm.add_func_pass("redundant-loads", eliminate_redundant_loads);
+    pm.add_func_pass("dead-stores", eliminate_dead_stores);
+    pm.add_func_pass("promote-globals", promote_globals);
+}
@@ -0,0 +1,125 @@
+#ifndef PASS_H
+#define PASS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include "koopa.h"
+using namespace std;
+
+/*
+ * Middle end over the raw program. The raw program built by libkoopa is
+ * read only, so passes do not rewrite it: they record what they found in
+ * FuncInfo / ModuleInfo and the backend generates code accordingly.
+ */
+
+// A control flow edge between two blocks of a function
+using BlockEdge = pair<koopa_raw_basic_block_t, koopa_raw_basic_block_t>;
+
+struct BlockEdgeHash {
+    size_t operator()(const BlockEdge &edge) const {
+        return hash<const void *>()(edge.first) * 31 + hash<const void *>()(edge.second);
+    }
+};
+
+struct FuncProfile;
+struct ModuleInfo;
+
+// A loop whose scalar globals are kept in registers while it runs
+struct PromotedLoop {
+    koopa_raw_basic_block_t header;  // the only block entered from outside
+    unordered_set<koopa_raw_basic_block_t> blocks;
+    vector<koopa_raw_value_t> globals;        // promoted, most accessed first
+    unordered_set<koopa_raw_value_t> stored;  // globals the loop stores to
+};
+
+// Results of passes on one function
+struct FuncInfo {
+    // never reachable from main, no code is generated for it
+    bool dead = false;
+    // blocks which can never be executed
+    unordered_set<koopa_raw_basic_block_t> unreachable_bbs;
+    // profile of the function if one was given and still matches it
+    const FuncProfile *profile = nullptr;
+    unordered_map<koopa_raw_basic_block_t, uint64_t> block_counts;
+    unordered_map<BlockEdge, uint64_t, BlockEdgeHash> edge_counts;
+    // estimated times each block runs, relative to each other
+    unordered_map<koopa_raw_basic_block_t, double> block_freq;
+    // number of loops around each block
+    unordered_map<koopa_raw_basic_block_t, int> loop_depth;
+    // order in which to emit the blocks, entry first; empty for source order
+    vector<koopa_raw_basic_block_t> layout;
+    // loads of a word whose value is known, and that value
+    unordered_map<koopa_raw_value_t, koopa_raw_value_t> load_source;
+    // stores overwritten before anything reads them
+    unordered_set<koopa_raw_value_t> dead_stores;
+    // loops with promoted globals, they do not overlap
+    vector<PromotedLoop> promoted_loops;
+    // the whole program, for function passes looking at what callees do
+    const ModuleInfo *module = nullptr;
+};
+
+// Memory a function may touch when called, its callees included
+struct FuncEffects {
+    unordered_set<koopa_raw_value_t> mod_globals, ref_globals;
+    bool mod_args = false, ref_args = false;  // through its pointer parameters
+};
+
+// Results of passes on the whole program
+struct ModuleInfo {
+    vector<FuncInfo> funcs;  // indexed as program.funcs
+    unordered_map<koopa_raw_function_t, int> func_index;
+    // global variables never used by live functions
+    unordered_set<koopa_raw_value_t> dead_globals;
+    unordered_map<koopa_raw_function_t, FuncEffects> effects;
+};
+
+using FuncPass = function<void(const koopa_raw_function_t &, FuncInfo &)>;
+using ModulePass = function<void(const koopa_raw_program_t &, ModuleInfo &)>;
+
+/*
+ * Runs passes in the order they are added. Consecutive function passes
+ * form one stage which runs concurrently over all functions on a
+ * work-stealing pool; a module pass is a barrier between stages.
+ * A function pass may only touch its own FuncInfo, so the results do not
+ * depend on the number of threads.
+ */
+class PassManager {
+public:
+    explicit PassManager(unsigned int num_threads = 0) : num_threads(num_threads) {}
+    void add_func_pass(const string &name, FuncPass pass);
+    void add_module_pass(const string &name, ModulePass pass);
+    void run(const koopa_raw_program_t &program, ModuleInfo &info);
+
+private:
+    struct Pass {
+        string name;
+        FuncPass func_pass;      // set for function passes
+        ModulePass module_pass;  // set for module passes
+    };
+    unsigned int num_threads;  // 0 for one per core
+    vector<Pass> passes;
+    void run_func_stage(const koopa_raw_program_t &program, ModuleInfo &info,
+                        size_t first, size_t last);
+};
+
+// Values used as operands by an instruction
+void get_operands(const koopa_raw_value_t &value, vector<koopa_raw_value_t> &ops);
+
+/* Passes */
+void remove_dead_funcs(const koopa_raw_program_t &program, ModuleInfo &info);
+void remove_dead_globals(const koopa_raw_program_t &program, ModuleInfo &info);
+void find_unreachable_bbs(const koopa_raw_function_t &func, FuncInfo &info);
+void estimate_block_freq(const koopa_raw_function_t &func, FuncInfo &info);
+void layout_blocks(const koopa_raw_function_t &func, FuncInfo &info);
+void eliminate_redundant_loads(const koopa_raw_function_t &func, FuncInfo &info);
+void eliminate_dead_stores(const koopa_raw_function_t &func, FuncInfo &info);
+void promote_globals(const koopa_raw_function_t &func, FuncInfo &info);
+
+// Add the default optimization pipeline to a pass manager
+void add_default_passes(PassManager &pm);
+
+#endif
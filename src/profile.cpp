@@ -0,0 +1,163 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include "koopa.h"
+#include "raw.h"
+#include "interp.h"
+#include "profile.h"
+using namespace std;
+
+uint64_t func_checksum(const koopa_raw_function_t &func) {
+    // 64 bit FNV-1a of the fingerprint
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : fingerprint(func)) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+string FuncProfile::str(const string &name) const {
+    string res = "func " + name + " " + to_string(checksum) + " " +
+                 to_string(block_counts.size()) + "\n";
+    for (size_t i = 0; i < block_counts.size(); ++i) {
+        if (block_counts[i])
+            res += "block " + to_string(i) + " " + to_string(block_counts[i]) + "\n";
+    }
+    for (auto &edge : edge_counts) {
+        res += "edge " + to_string(edge.first.first) + " " + to_string(edge.first.second) +
+               " " + to_string(edge.second) + "\n";
+    }
+    return res;
+}
+
+string Profile::str() const {
+    string res("");
+    for (auto &func : funcs)
+        res += func.second.str(func.first);
+    return res;
+}
+
+bool Profile::parse(const string &text, string &error) {
+    funcs.clear();
+    istringstream iss(text);
+    string line;
+    FuncProfile *curr = nullptr;
+    int line_no = 0;
+    while (getline(iss, line)) {
+        line_no++;
+        istringstream fields(line);
+        string kind;
+        if (!(fields >> kind) || kind[0] == '#')
+            continue;
+        bool ok = true;
+        if (kind == "func") {
+            string name;
+            unsigned long long checksum;
+            size_t num_blocks;
+            ok = bool(fields >> name >> checksum >> num_blocks);
+            if (ok) {
+                curr = &funcs[name];
+                curr->checksum = checksum;
+                curr->block_counts.assign(num_blocks, 0);
+            }
+        } else if (kind == "block") {
+            size_t index;
+            unsigned long long count;
+            ok = curr && (fields >> index >> count) && index < curr->block_counts.size();
+            if (ok)
+                curr->block_counts[index] = count;
+        } else if (kind == "edge") {
+            size_t from, to;
+            unsigned long long count;
+            ok = curr && (fields >> from >> to >> count) &&
+                 from < curr->block_counts.size() && to < curr->block_counts.size();
+            if (ok)
+                curr->edge_counts[make_pair(int(from), int(to))] = count;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            error = "bad profile record at line " + to_string(line_no);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Profile::load(const string &path, string &error) {
+    ifstream ifs(path);
+    if (!ifs) {
+        error = "cannot open profile " + path;
+        return false;
+    }
+    stringstream buffer;
+    buffer << ifs.rdbuf();
+    return parse(buffer.str(), error);
+}
+
+bool Profile::save(const string &path) const {
+    ofstream ofs(path);
+    if (!ofs)
+        return false;
+    ofs << "# sysy profile v1\n" << str();
+    return bool(ofs);
+}
+
+Profile Profile::collect(const koopa_raw_program_t &program, const Interpreter &interp) {
+    Profile res;
+    const auto &bb_counts = interp.block_counts();
+    const auto &edges = interp.edge_counts();
+    for (size_t i = 0; i < program.funcs.len; ++i) {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if (func->bbs.len == 0)
+            continue;
+        FuncProfile &prof = res.funcs[func->name];
+        prof.checksum = func_checksum(func);
+        prof.block_counts.assign(func->bbs.len, 0);
+        unordered_map<koopa_raw_basic_block_t, int> index;
+        for (size_t j = 0; j < func->bbs.len; ++j) {
+            auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[j]);
+            index[block] = j;
+            auto it = bb_counts.find(block);
+            if (it != bb_counts.end())
+                prof.block_counts[j] = it->second;
+        }
+        for (auto &edge : edges) {
+            auto from = index.find(edge.first.first);
+            if (from == index.end())
+                continue;
+            prof.edge_counts[make_pair(from->second, index[edge.first.second])] = edge.second;
+        }
+    }
+    return res;
+}
+
+void Profile::apply(const koopa_raw_program_t &program, ModuleInfo &info) const {
+    info.funcs.resize(program.funcs.len);
+    for (size_t i = 0; i < program.funcs.len; ++i) {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        auto it = funcs.find(func->name);
+        if (func->bbs.len == 0 || it == funcs.end())
+            continue;
+        const FuncProfile &prof = it->second;
+        // a stale profile would mislead more than no profile
+        if (prof.checksum != func_checksum(func) || prof.block_counts.size() != func->bbs.len)
+            continue;
+        FuncInfo &func_info = info.funcs[i];
+        func_info.profile = &prof;
+        vector<koopa_raw_basic_block_t> blocks(func->bbs.len);
+        for (size_t j = 0; j < func->bbs.len; ++j) {
+            blocks[j] = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[j]);
+            func_info.block_counts[blocks[j]] = prof.block_counts[j];
+        }
+        for (auto &edge : prof.edge_counts) {
+            BlockEdge e(blocks[edge.first.first], blocks[edge.first.second]);
+            func_info.edge_counts[e] = edge.second;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "koopa.h"
+#include "pass.h"
+using namespace std;
+
+class Interpreter;
+
+/*
+ * Execution profile: how often each block was entered and each edge was
+ * taken. Blocks are numbered by their position in the function, and a
+ * checksum of the function drops counts that no longer match its code.
+ *
+ * Text format, one record per line:
+ *   func <name> <checksum> <number of blocks>
+ *   block <index> <count>
+ *   edge <from> <to> <count>
+ * block and edge records belong to the func record before them.
+ */
+
+struct FuncProfile {
+    uint64_t checksum = 0;
+    vector<uint64_t> block_counts;            // by block index
+    map<pair<int, int>, uint64_t> edge_counts;  // by block indexes
+    string str(const string &name) const;
+};
+
+class Profile {
+public:
+    map<string, FuncProfile> funcs;  // by function name
+
+    bool load(const string &path, string &error);
+    bool save(const string &path) const;
+    bool parse(const string &text, string &error);
+    string str() const;
+    // Counts of a run of the interpreter on program
+    static Profile collect(const koopa_raw_program_t &program, const Interpreter &interp);
+    // Attach the counts to the functions of program they still match
+    void apply(const koopa_raw_program_t &program, ModuleInfo &info) const;
+};
+
+// Checksum of a function, stable across builds of the compiler
+uint64_t func_checksum(const koopa_raw_function_t &func);
+
+#endif
@@ -3,69 +3,127 @@
 #include <cstring>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <map>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <memory>
 #include "koopa.h"
 #include "raw.h"
+#include "cache.h"
+#include "timer.h"
+#include "profile.h"
+#include "layout.h"
+#include "schedule.h"
 using namespace std;
 
 using veci = vector<int>;
 
 // mapping of reg_id and reg_name
-string temp_regs[17] = {"t0", "t1", "t2", "t3", "t4", "t5", "t6",
+string temp_regs[28] = {"t0", "t1", "t2", "t3", "t4", "t5", "t6",
                         "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",
-                        "x0", "ra"};
-// use condition of regs
-int reg_use[15];
-// called saved regs offset to sp
-int reg_offset[NUM_REGS];
-// ra save
-bool ra_save = false;
-// ra offset
-int ra_offset;
+                        "x0", "ra",
+                        "s1", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11"};
 // id of x0
 const int x0_id = 15;
 // id of ra
 const int ra_id = 16;
-// Total bytes allocated for one stack frame
-unsigned int num_bytes = 0;
-// The minimum valid label id
-int min_label_id = 0;
-// The id of the block containing ret instruction
-int end_label_id = 0;
-// current function
-koopa_raw_function_t curr_func;
-
-struct myCompare {
-    bool operator()(const koopa_raw_value_t &v1, const koopa_raw_value_t &v2) const {
-        return reinterpret_cast<long long int>(v1) < reinterpret_cast<long long int>(v2);
-    }
-};
-// mapping of instruction and where (reg_id) it stored its result
-map<koopa_raw_value_t, int, myCompare> reg_map;
-// mapping of instruction and where (offset to sp) is stored its result
-map<koopa_raw_value_t, int, myCompare> offset_map;
-
-struct myBlockCompare {
-    bool operator()(const koopa_raw_basic_block_t &b1, 
-                    const koopa_raw_basic_block_t &b2) const {
-        return reinterpret_cast<long long int>(b1) < reinterpret_cast<long long int>(b2);
-    }
-};
-map<koopa_raw_basic_block_t, int, myBlockCompare> label_map;
+// id of s1, the first of the callee saved regs holding globals or their address
+const int saved_reg_id = 17;
+// globals up to this size go to .sdata / .sbss and are reached from gp
+const unsigned int SMALL_DATA_BYTES = 8;
+// code generation state of the function being compiled by this thread
+thread_local FuncContext *func_ctx = nullptr;
+// Number of threads generating functions in parallel, 0 for one per core
+unsigned int codegen_threads = 0;
 
 
 /* Initialization */
 void init() {
-    memset(reg_use, 0, sizeof(reg_use));
-    memset(reg_offset, 0, sizeof(reg_offset));
-    ra_save = false;
+    memset(func_ctx->reg_use, 0, sizeof(func_ctx->reg_use));
+    memset(func_ctx->reg_offset, 0, sizeof(func_ctx->reg_offset));
+    func_ctx->ra_save = false;
+    func_ctx->pads.clear();
 } 
 
+/* Get the dense id of a value, assigning a new one if it has none yet */
+int get_value_id(const koopa_raw_value_t &value) {
+    auto it = func_ctx->value_id.find(value);
+    if (it != func_ctx->value_id.end())
+        return it->second;
+    int id = func_ctx->reg_table.size();
+    func_ctx->value_id[value] = id;
+    func_ctx->reg_table.push_back(0);
+    func_ctx->offset_table.push_back(-1);
+    return id;
+}
+
+/* Offset to sp where the result of a value is stored */
+int get_offset(const koopa_raw_value_t &value) {
+    return func_ctx->offset_table[get_value_id(value)];
+}
+
+void set_offset(const koopa_raw_value_t &value, int offset) {
+    func_ctx->offset_table[get_value_id(value)] = offset;
+}
+
+/* Reg where the result of a value is currently held */
+int get_reg(const koopa_raw_value_t &value) {
+    return func_ctx->reg_table[get_value_id(value)];
+}
+
+void set_reg(const koopa_raw_value_t &value, int reg_id) {
+    func_ctx->reg_table[get_value_id(value)] = reg_id;
+}
+
+/* Label id of a basic block in current function */
+int get_label(const koopa_raw_basic_block_t &bb) {
+    return func_ctx->label_table[func_ctx->bb_id[bb]];
+}
+
+/* 
+ * Labels are numbered per function and prefixed by its name, so the code of
+ * a function does not depend on the other functions of the program.
+ * ".L" keeps them local and apart from any SysY identifier.
+ */
+string label_name(int label_id) {
+    return ".L" + func_ctx->func_name + "_" + to_string(label_id);
+}
+
+string end_label() {
+    return ".L" + func_ctx->func_name + "_end";
+}
+
+/* Assign dense ids to all blocks and instructions of a function */
+void index_func(const koopa_raw_function_t &func) {
+    func_ctx->value_id.clear();
+    func_ctx->bb_id.clear();
+    func_ctx->reg_table.clear();
+    func_ctx->offset_table.clear();
+    func_ctx->label_table.clear();
+    size_t num_insts = 0;
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        num_insts += block->insts.len;
+    }
+    func_ctx->value_id.reserve(num_insts);
+    func_ctx->bb_id.reserve(func->bbs.len);
+    func_ctx->reg_table.reserve(num_insts);
+    func_ctx->offset_table.reserve(num_insts);
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        func_ctx->bb_id[block] = i;
+        for (size_t j = 0; j < block->insts.len; ++j)
+            get_value_id(reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]));
+    }
+}
+
 /* Find next available reg */
 int find_next_reg() {
     int j = 0;
     for (int s = 0; s < NUM_REGS; ++s) {
-        if (!reg_use[j])
+        if (!func_ctx->reg_use[j])
             break;
         j = (j + 1) % NUM_REGS;
     }
@@ -73,11 +131,11 @@ int find_next_reg() {
 }
 
 void use_reg(int reg_id) {
-    reg_use[reg_id] = 1;
+    func_ctx->reg_use[reg_id] = 1;
 }
 
 void free_reg(int reg_id) {
-    reg_use[reg_id] = 0;
+    func_ctx->reg_use[reg_id] = 0;
 }
 
 /* Allocate vars on the stack in a block */
@@ -86,29 +144,31 @@ void alloc_block_local_var(const koopa_raw_basic_block_t &block) {
         auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[i]);
         const auto &kind = value->kind;
         if (kind.tag == KOOPA_RVT_ALLOC) {
-            auto ptr = value->ty->data.pointer.base;
-            if (ptr->tag == KOOPA_RTT_ARRAY) {  // array
-                offset_map[value] = num_bytes;
-                int total_len = 4;
-                while (ptr->data.array.base && ptr->tag == KOOPA_RTT_ARRAY) {
-                    int dim = ptr->data.array.len;
-                    if (dim == 0)
-                        break;
-                    total_len *= dim;
-                    ptr = ptr->data.array.base;
-                }
-                num_bytes += total_len;
-            } else {  // pointer or int
-                offset_map[value] = num_bytes;
-                num_bytes += 4;
-            }
-        } else if (value->ty->tag != KOOPA_RTT_UNIT) {
-            offset_map[value] = num_bytes;
-            num_bytes += 4;
+            set_offset(value, func_ctx->num_bytes);
+            func_ctx->num_bytes += func_ctx->types.size(value->ty->data.pointer.base);
+        } else if (value->ty->tag != KOOPA_RTT_UNIT && !func_ctx->folded_addrs.count(value) &&
+                   !shares_slot(value)) {
+            set_offset(value, func_ctx->num_bytes);
+            func_ctx->num_bytes += 4;
         }
     }
 }
 
+/* Value a load is known to read, nullptr if it has to read memory */
+koopa_raw_value_t load_source(const koopa_raw_value_t &value) {
+    if (!func_ctx->info)
+        return nullptr;
+    auto it = func_ctx->info->load_source.find(value);
+    return it == func_ctx->info->load_source.end() ? nullptr : it->second;
+}
+
+/* A load of a known value held in a slot takes that slot, slots never change */
+bool shares_slot(const koopa_raw_value_t &value) {
+    auto src = load_source(value);
+    return src && src->kind.tag != KOOPA_RVT_INTEGER && !func_ctx->folded_addrs.count(src) &&
+           func_ctx->value_id.count(src);
+}
+
 /* Allocate params space for function call */
 bool alloc_params(const koopa_raw_function_t &func) {
     unsigned int param_bytes = 0;
@@ -131,67 +191,101 @@ bool alloc_params(const koopa_raw_function_t &func) {
             }
         }
     }
-    num_bytes += (param_bytes * 4);
+    func_ctx->num_bytes += (param_bytes * 4);
     return func_call;
 }
 
-/* Compute total space which should be allocated on the stack and build offset_map */
+/* Compute total space which should be allocated on the stack and build offset table */
 void alloc_func(const koopa_raw_function_t &func) {
-    num_bytes = 0;
+    func_ctx->num_bytes = 0;
     unsigned int ra_bytes = 0;
     // Allocate params
-    ra_save = alloc_params(func);
-    if (ra_save) {
+    func_ctx->ra_save = alloc_params(func);
+    if (func_ctx->ra_save) {
         ra_bytes = 4;
     }
     // Allocate caller saved reg space, make sure that reg offset < 2048
-    if (ra_save) {
+    if (func_ctx->ra_save) {
         for (int i = 0; i < NUM_REGS; ++i) {
-            reg_offset[i] = num_bytes;
-            num_bytes += 4;
+            func_ctx->reg_offset[i] = func_ctx->num_bytes;
+            func_ctx->num_bytes += 4;
         }
     }
+    // Allocate space for the saved regs holding globals, also below 2048
+    for (int k = 0; k < func_ctx->num_saved; ++k) {
+        func_ctx->saved_offset[k] = func_ctx->num_bytes;
+        func_ctx->num_bytes += 4;
+    }
     // Allocate local vars
     for (size_t i = 0; i < func->bbs.len; ++i) {
         auto block = func->bbs.buffer[i];
         alloc_block_local_var(reinterpret_cast<koopa_raw_basic_block_t>(block)); 
     }
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for (size_t j = 0; j < block->insts.len; ++j) {
+            auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
+            if (value->kind.tag != KOOPA_RVT_LOAD || !shares_slot(value))
+                continue;
+            auto src = load_source(value);
+            while (shares_slot(src))
+                src = load_source(src);
+            set_offset(value, get_offset(src));
+        }
+    }
     // Allocate space for ra
-    if (ra_save) {
-        ra_offset = num_bytes;
-        num_bytes += ra_bytes;
+    if (func_ctx->ra_save) {
+        func_ctx->ra_offset = func_ctx->num_bytes;
+        func_ctx->num_bytes += ra_bytes;
     }
     // Round up to multiples of 16
-    num_bytes = (((num_bytes - 1) >> 4) + 1) << 4; 
+    func_ctx->num_bytes = (((func_ctx->num_bytes - 1) >> 4) + 1) << 4; 
 }
 
 /* Allocate label ids for each block in a function */
 void alloc_labels(const koopa_raw_function_t &func) {
+    func_ctx->label_table.resize(func->bbs.len);
     for (size_t i = 0; i < func->bbs.len; ++i) {
-        auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
-        int new_label_id = min_label_id;
-        min_label_id++;
-        label_map[block] = new_label_id;
+        func_ctx->label_table[i] = func_ctx->min_label_id;
+        func_ctx->min_label_id++;
     }
 }
 
-void koopa2riscv(const char *str, string &s) {
+bool koopa2riscv(const char *str, string &s, const Profile *profile) {
     // KoopaIR to raw program
     koopa_program_t program;
-    koopa_error_code_t ret = koopa_parse_from_string(str, &program);
-    assert(ret == KOOPA_EC_SUCCESS);
+    koopa_error_code_t ret;
+    {
+        PhaseTimer timer("koopa parse");
+        ret = koopa_parse_from_string(str, &program);
+    }
+    if (ret != KOOPA_EC_SUCCESS)
+        return false;
 
     koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
-    koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
+    koopa_raw_program_t raw;
+    {
+        PhaseTimer timer("raw build");
+        raw = koopa_build_raw_program(builder, program);
+    }
 
     // Delete KoopaIR program
     koopa_delete_program(program);
 
+    // Run middle end passes, with the counts of the profile for them to use
+    ModuleInfo info;
+    if (profile)
+        profile->apply(raw, info);
+    PassManager pm(codegen_threads);
+    add_default_passes(pm);
+    pm.run(raw, info);
+
     // Handle raw program
-    traverse(raw, s);
+    traverse(raw, info, s);
     
     // Delete raw program
     koopa_delete_raw_program_builder(builder);
+    return true;
 }
 
 /* Traverse raw program */
@@ -202,15 +296,29 @@ void traverse(const koopa_raw_program_t &program, string &s) {
     traverse(program.funcs, s);
 }
 
+/* Traverse raw program, skipping what the middle end found to be dead */
+void traverse(const koopa_raw_program_t &program, const ModuleInfo &info, string &s) {
+    {
+        PhaseTimer timer("backend: globals");
+        for (size_t i = 0; i < program.values.len; ++i) {
+            auto value = reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]);
+            if (!info.dead_globals.count(value))
+                traverse(value, s);
+        }
+    }
+    PhaseTimer timer("backend: functions");
+    gen_funcs(program.funcs, s, &info);
+}
+
 /* Traverse raw slice */
 void traverse(const koopa_raw_slice_t &slice, string &s) {
+    if (slice.kind == KOOPA_RSIK_FUNCTION) {
+        gen_funcs(slice, s);
+        return;
+    }
     for (size_t i = 0; i < slice.len; ++i) {
         auto ptr = slice.buffer[i];
         switch (slice.kind) {
-            case KOOPA_RSIK_FUNCTION:
-                curr_func = reinterpret_cast<koopa_raw_function_t>(ptr);
-                traverse(reinterpret_cast<koopa_raw_function_t>(ptr), s);
-                break;
             case KOOPA_RSIK_BASIC_BLOCK:
                 traverse(reinterpret_cast<koopa_raw_basic_block_t>(ptr), s);
                 break;
@@ -223,60 +331,391 @@ void traverse(const koopa_raw_slice_t &slice, string &s) {
     }
 }
 
+/* Append a type to a fingerprint */
+static void fingerprint(const koopa_raw_type_t &ty, string &fp) {
+    fp += to_string(ty->tag);
+    switch (ty->tag) {
+        case KOOPA_RTT_ARRAY:
+            fp += "[" + to_string(ty->data.array.len);
+            fingerprint(ty->data.array.base, fp);
+            fp += "]";
+            break;
+        case KOOPA_RTT_POINTER:
+            fp += "*";
+            fingerprint(ty->data.pointer.base, fp);
+            break;
+        case KOOPA_RTT_FUNCTION:
+            fp += "(";
+            for (size_t i = 0; i < ty->data.function.params.len; ++i)
+                fingerprint(reinterpret_cast<koopa_raw_type_t>(ty->data.function.params.buffer[i]), fp);
+            fp += ")";
+            fingerprint(ty->data.function.ret, fp);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Append an operand to a fingerprint, instructions are named by their position */
+static void fingerprint(const koopa_raw_value_t &value,
+                        const unordered_map<koopa_raw_value_t, int> &ids, string &fp) {
+    if (!value) {
+        fp += " _";
+        return;
+    }
+    auto it = ids.find(value);
+    if (it != ids.end()) {
+        fp += " %" + to_string(it->second);
+        return;
+    }
+    const auto &kind = value->kind;
+    switch (kind.tag) {
+        case KOOPA_RVT_INTEGER:
+            fp += " #" + to_string(kind.data.integer.value);
+            break;
+        case KOOPA_RVT_FUNC_ARG_REF:
+            fp += " $" + to_string(kind.data.func_arg_ref.index);
+            break;
+        default:
+            // globals, referenced by name and type
+            fp += " ";
+            fp += value->name ? value->name : "?";
+            fp += ":";
+            fingerprint(value->ty, fp);
+    }
+}
+
+/*
+ * Fingerprint of a function: everything its generated code depends on, that
+ * is its own instructions and the names and types of the globals and
+ * functions it refers to. Equal fingerprints give equal code.
+ */
+string fingerprint(const koopa_raw_function_t &func) {
+    unordered_map<koopa_raw_value_t, int> ids;
+    unordered_map<koopa_raw_basic_block_t, int> bbs;
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        bbs[block] = i;
+        for (size_t j = 0; j < block->insts.len; ++j)
+            ids[reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j])] = ids.size();
+    }
+    string fp = string(func->name) + ":";
+    fingerprint(func->ty, fp);
+    fp += "\n";
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        fp += "b" + to_string(i) + ":\n";
+        for (size_t j = 0; j < block->insts.len; ++j) {
+            auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
+            const auto &kind = value->kind;
+            fp += to_string(kind.tag) + ":";
+            fingerprint(value->ty, fp);
+            vector<koopa_raw_value_t> ops;
+            get_operands(value, ops);
+            for (auto op : ops)
+                fingerprint(op, ids, fp);
+            switch (kind.tag) {
+                case KOOPA_RVT_BINARY:
+                    fp += " op" + to_string(kind.data.binary.op);
+                    break;
+                case KOOPA_RVT_BRANCH:
+                    fp += " b" + to_string(bbs[kind.data.branch.true_bb]) +
+                          " b" + to_string(bbs[kind.data.branch.false_bb]);
+                    break;
+                case KOOPA_RVT_JUMP:
+                    fp += " b" + to_string(bbs[kind.data.jump.target]);
+                    break;
+                case KOOPA_RVT_CALL:
+                    fp += " " + string(kind.data.call.callee->name) + ":";
+                    fingerprint(kind.data.call.callee->ty, fp);
+                    break;
+                default:
+                    break;
+            }
+            fp += "\n";
+        }
+    }
+    return fp;
+}
+
+/*
+ * Results of the middle end which depend on other functions, through what
+ * callees do: promoted globals, loads of known values and dead stores
+ */
+static string decisions_str(const koopa_raw_function_t &func, const FuncInfo &info) {
+    string res;
+    size_t pos = 0;
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for (size_t j = 0; j < block->insts.len; ++j, ++pos) {
+            auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
+            if (info.load_source.count(value))
+                res += "known " + to_string(pos) + "\n";
+            if (info.dead_stores.count(value))
+                res += "dead " + to_string(pos) + "\n";
+        }
+    }
+    for (auto &loop : info.promoted_loops) {
+        for (size_t i = 0; i < func->bbs.len; ++i) {
+            if (func->bbs.buffer[i] == loop.header)
+                res += "loop b" + to_string(i) + ":";
+        }
+        for (auto glb : loop.globals)
+            res += string(" ") + glb->name;
+        res += "\n";
+    }
+    return res;
+}
+
+/* Generate all functions on a pool of threads, output kept in original order */
+void gen_funcs(const koopa_raw_slice_t &funcs, string &s, const ModuleInfo *info) {
+    size_t num_funcs = funcs.len;
+    unsigned int num_defs = 0;
+    for (size_t i = 0; i < num_funcs; ++i) {
+        auto func = reinterpret_cast<koopa_raw_function_t>(funcs.buffer[i]);
+        if (func->bbs.len == 0 || (info && info->funcs[i].dead))
+            continue;
+        num_defs++;
+    }
+    // Code of unchanged functions is reused from the cache, if it is enabled
+    string cache_dir = CompileCache::dir_from_env();
+    unique_ptr<CompileCache> cache;
+    if (!cache_dir.empty())
+        cache.reset(new CompileCache(cache_dir, CompileCache::size_from_env()));
+    vector<string> outs(num_funcs);
+    atomic<size_t> next_func(0);
+    TimeReport *report = time_report;
+    auto worker = [&]() {
+        WorkerTimes times(report);
+        size_t i;
+        while ((i = next_func++) < num_funcs) {
+            auto func = reinterpret_cast<koopa_raw_function_t>(funcs.buffer[i]);
+            if (func->bbs.len == 0 || (info && info->funcs[i].dead))
+                continue;
+            string key;
+            if (cache) {
+                string fp = fingerprint(func);
+                // code depends on the profile as well
+                if (info && info->funcs[i].profile)
+                    fp += info->funcs[i].profile->str(func->name);
+                // and on what the middle end decided knowing what callees do
+                if (info)
+                    fp += decisions_str(func, info->funcs[i]);
+                key = cache->func_key(fp);
+                if (cache->lookup(key, outs[i]))
+                    continue;
+            }
+            FuncContext ctx;
+            if (info)
+                ctx.info = &info->funcs[i];
+            func_ctx = &ctx;
+            traverse(func, outs[i]);
+            func_ctx = nullptr;
+            if (cache)
+                cache->insert(key, outs[i]);
+        }
+    };
+    unsigned int num_threads = codegen_threads;
+    if (num_threads == 0)
+        num_threads = thread::hardware_concurrency();
+    if (num_threads > num_defs)
+        num_threads = num_defs;
+    vector<thread> pool;
+    for (unsigned int t = 1; t < num_threads; ++t)
+        pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool)
+        t.join();
+    for (size_t i = 0; i < num_funcs; ++i)
+        s += outs[i];
+}
+
+static void gen_func(const koopa_raw_function_t &func, string &s);
+
+/* Instructions of a line of generated code, pseudo instructions counted as they expand */
+static size_t count_insts(const string &code, size_t pos) {
+    if (code.compare(pos, 2, "  ") != 0 || pos + 2 >= code.size() ||
+        code[pos + 2] == '.' || code[pos + 2] == '\n')
+        return 0;
+    if (code.compare(pos + 2, 3, "li ") == 0 || code.compare(pos + 2, 3, "la ") == 0 ||
+        code.compare(pos + 2, 5, "call ") == 0)
+        return 2;
+    return 1;
+}
+
+// Conditional branches reach +-4KiB, with some margin
+const size_t MAX_BRANCH_INSTS = 1000;
+
+/*
+ * Branch relaxation as an assembler does it: a conditional branch whose
+ * target may be out of range becomes the opposite branch over a jump.
+ * Expanding a branch moves the code after it, so repeat until no branch
+ * changes. Only the few far branches pay for the jump.
+ */
+static void relax_branches(string &code) {
+    vector<string> lines;
+    size_t total = 0;
+    for (size_t pos = 0; pos < code.size();) {
+        size_t end = code.find('\n', pos);
+        if (end == string::npos)
+            end = code.size();
+        total += count_insts(code, pos);
+        lines.push_back(code.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    if (total < MAX_BRANCH_INSTS)
+        return;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        unordered_map<string, size_t> label_pos;
+        vector<size_t> line_pos(lines.size());
+        size_t addr = 0;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            line_pos[i] = addr;
+            const string &line = lines[i];
+            if (!line.empty() && line[0] != ' ' && line.back() == ':')
+                label_pos[line.substr(0, line.size() - 1)] = addr;
+            addr += count_insts(line, 0);
+        }
+        vector<string> relaxed;
+        relaxed.reserve(lines.size());
+        for (size_t i = 0; i < lines.size(); ++i) {
+            const string &line = lines[i];
+            bool bnez = line.compare(0, 7, "  bnez ") == 0;
+            if (!bnez && line.compare(0, 7, "  beqz ") != 0) {
+                relaxed.push_back(line);
+                continue;
+            }
+            size_t comma = line.find(", ");
+            string target = line.substr(comma + 2);
+            auto it = label_pos.find(target);
+            size_t dist = it == label_pos.end() ? 0 :
+                          it->second > line_pos[i] ? it->second - line_pos[i] :
+                                                     line_pos[i] - it->second;
+            if (dist < MAX_BRANCH_INSTS) {
+                relaxed.push_back(line);
+                continue;
+            }
+            string skip = label_name(func_ctx->min_label_id++);
+            relaxed.push_back(string(bnez ? "  beqz " : "  bnez ") +
+                              line.substr(7, comma - 7) + ", " + skip);
+            relaxed.push_back("  j " + target);
+            relaxed.push_back(skip + ":");
+            changed = true;
+        }
+        lines.swap(relaxed);
+    }
+    code.clear();
+    for (auto &line : lines)
+        code += line + "\n";
+}
+
 /* Traverse functions */
 void traverse(const koopa_raw_function_t &func, string &s) {
     if (func->bbs.len == 0)
         return;
+    // built once, so that functions do not pay for the names when nothing is timed
+    static const string emit_phase("backend: emit"), schedule_phase("backend: schedule"),
+        relax_phase("backend: relax branches");
+    string code;
+    {
+        PhaseTimer timer(emit_phase);
+        gen_func(func, code);
+    }
+    {
+        PhaseTimer timer(schedule_phase);
+        schedule_code(code);
+    }
+    {
+        PhaseTimer timer(relax_phase);
+        relax_branches(code);
+    }
+    s += code;
+}
+
+static void gen_func(const koopa_raw_function_t &func, string &s) {
     init();
+    func_ctx->curr_func = func;
     s += "  .text\n";
     s += "  .globl ";
     string func_name = string(func->name);
     func_name.erase(0, 1);
+    func_ctx->func_name = func_name;
     s = s + func_name + "\n" + func_name + ":\n";
+    index_func(func);
+    find_folded_addrs(func);
+    find_global_regs(func);
     // Prologue
     alloc_func(func);
-    if (num_bytes > 0) {
-        if (num_bytes <= 2048) { // Rember to substract, not to increase num_bytes
-            s = s + "  addi sp, sp, -" + string(to_string(num_bytes)) + "\n";
+    if (func_ctx->num_bytes > 0) {
+        if (func_ctx->num_bytes <= 2048) { // Rember to substract, not to increase num_bytes
+            s = s + "  addi sp, sp, -" + string(to_string(func_ctx->num_bytes)) + "\n";
         } else {
-            s = s + "  li t0, -" + string(to_string(num_bytes)) + "\n";
+            s = s + "  li t0, -" + string(to_string(func_ctx->num_bytes)) + "\n";
             s = s + "  add sp, sp, t0\n";
         }
     }
-    if (ra_save) {
+    if (func_ctx->ra_save) {
         // s = s + "  sw ra, " + string(to_string(ra_offset)) + "(sp)\n\n";
-        visit_stack(ra_id, ra_offset, 1, s);
+        visit_stack(ra_id, func_ctx->ra_offset, 1, s);
+    }
+    for (int k = 0; k < func_ctx->num_saved; ++k)
+        visit_stack(saved_reg_id + k, func_ctx->saved_offset[k], 1, s);
+    for (size_t k = 0; k < func_ctx->reg_globals.size(); ++k) {
+        string var_name = string(func_ctx->reg_globals[k]->name);
+        var_name.erase(0, 1);
+        s = s + "  la " + temp_regs[saved_reg_id + k] + ", " + var_name + "\n";
     }
 
     alloc_labels(func);
-    traverse(func->bbs, s);
+    // Blocks in the order chosen by the middle end, the next one is the fall through
+    vector<koopa_raw_basic_block_t> order;
+    if (func_ctx->info && !func_ctx->info->layout.empty()) {
+        order = func_ctx->info->layout;
+    } else {
+        for (size_t i = 0; i < func->bbs.len; ++i)
+            order.push_back(reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]));
+    }
+    if (func_ctx->info) {
+        auto &unreachable = func_ctx->info->unreachable_bbs;
+        order.erase(remove_if(order.begin(), order.end(),
+                              [&](koopa_raw_basic_block_t bb) { return unreachable.count(bb); }),
+                    order.end());
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+        func_ctx->next_bb = i + 1 < order.size() ? order[i + 1] : nullptr;
+        traverse(order[i], s);
+    }
 
     // Epilogue
-    s = s + "end" + string(to_string(end_label_id)) + ":\n";
-    end_label_id++;
-    if (ra_save) {
+    s = s + end_label() + ":\n";
+    if (func_ctx->ra_save) {
         // s = s + "  lw ra, " + string(to_string(ra_offset)) + "(sp)\n";
-        visit_stack(ra_id, ra_offset, 0, s);
+        visit_stack(ra_id, func_ctx->ra_offset, 0, s);
     }
-    if (num_bytes > 0) {
-        if (num_bytes < 2048) { // Add num_bytes back
-            s = s + "  addi sp, sp, " + string(to_string(num_bytes)) + "\n";
+    for (int k = 0; k < func_ctx->num_saved; ++k)
+        visit_stack(saved_reg_id + k, func_ctx->saved_offset[k], 0, s);
+    if (func_ctx->num_bytes > 0) {
+        if (func_ctx->num_bytes < 2048) { // Add num_bytes back
+            s = s + "  addi sp, sp, " + string(to_string(func_ctx->num_bytes)) + "\n";
         } else {
-            s = s + "  li t0, " + string(to_string(num_bytes)) + "\n";
+            s = s + "  li t0, " + string(to_string(func_ctx->num_bytes)) + "\n";
             s = s + "  add sp, sp, t0\n";
         }
     }
     s += "  ret\n\n";
+    // code of branch edges which load or store promoted globals
+    s += func_ctx->pads;
 }
 
 /* Traverse basic blocks */
 void traverse(const koopa_raw_basic_block_t &bb, string &s) {
-    int blk_id = label_map[bb];
-    koopa_raw_basic_block_t bb1 = 
-        reinterpret_cast<koopa_raw_basic_block_t>(curr_func->bbs.buffer[0]);
-    int blk1_id = label_map[bb1];
-    if (blk_id != blk1_id)
-        s = s + "label" + string(to_string(blk_id)) + ":\n";
+    if (func_ctx->info && func_ctx->info->unreachable_bbs.count(bb))
+        return;
+    if (func_ctx->bb_id[bb] != 0)  // no label for the entry block
+        s = s + label_name(get_label(bb)) + ":\n";
+    func_ctx->curr_bb = bb;
     traverse(bb->insts, s);
 }
 
@@ -336,37 +775,39 @@ void traverse(const koopa_raw_return_t &ret, string &s) {
         switch (kind.tag) {
             case KOOPA_RVT_INTEGER:
                 traverse(kind.data.integer, ret.value, s);
-                reg_id = reg_map[ret.value];
+                reg_id = get_reg(ret.value);
                 s = s + "  mv a0, " + temp_regs[reg_id] + "\n";
-                reg_map.erase(ret.value);
                 free_reg(reg_id);
                 break;
             default:
-                src_offset = offset_map[ret.value];
+                src_offset = get_offset(ret.value);
                 visit_stack(7, src_offset, 0, s);
         }
     }
-    s = s + "  j end" + string(to_string(end_label_id)) + "\n\n";
+    s += edge_code(func_ctx->curr_bb, nullptr);
+    if (func_ctx->next_bb)  // the epilogue follows the last block
+        s = s + "  j " + end_label() + "\n";
+    s += "\n";
 }
 
 /* Traverse integer */
 void traverse(const koopa_raw_integer_t &i, const koopa_raw_value_t &value, string &s) {
     string instr("");
     // if (i.value == 0) {
-    //     reg_map[value] = x0_id;   // use x0 for convenience
+    //     set_reg(value, x0_id);   // use x0 for convenience
     // } else {
     //     int reg_id = find_next_reg();
     //     instr = instr + "  li " + temp_regs[reg_id] + ", " + 
     //             string(to_string(i.value)) + "\n";
     //     use_reg(reg_id);
-    //     reg_map[value] = reg_id;
+    //     set_reg(value, reg_id);
     //     s += instr;
     // }
     int reg_id = find_next_reg();
     instr = instr + "  li " + temp_regs[reg_id] + ", " + 
             string(to_string(i.value)) + "\n";
     use_reg(reg_id);
-    reg_map[value] = reg_id;
+    set_reg(value, reg_id);
     s += instr;
 }   
 
@@ -379,30 +820,26 @@ void traverse(const koopa_raw_binary_t &b, const koopa_raw_value_t &value, strin
     switch (kind1.tag) {
         case KOOPA_RVT_INTEGER:
             traverse(kind1.data.integer, b.lhs, s);
-            lhs_id = reg_map[b.lhs];
+            lhs_id = get_reg(b.lhs);
             break;
         default:
-            lhs_offset = offset_map[b.lhs];
+            lhs_offset = get_offset(b.lhs);
             lhs_id = find_next_reg();
             use_reg(lhs_id);
             visit_stack(lhs_id, lhs_offset, 0, s);
-            reg_map[b.lhs] = lhs_id;
     }
     const auto &kind2 = b.rhs->kind;
     switch (kind2.tag) {
         case KOOPA_RVT_INTEGER:
             traverse(kind2.data.integer, b.rhs, s);
-            rhs_id = reg_map[b.rhs];
+            rhs_id = get_reg(b.rhs);
             break;
         default:
-            rhs_offset = offset_map[b.rhs];
+            rhs_offset = get_offset(b.rhs);
             rhs_id = find_next_reg();
             use_reg(rhs_id);
             visit_stack(rhs_id, rhs_offset, 0, s);
-            reg_map[b.rhs] = rhs_id;
     }
-    reg_map.erase(b.lhs);
-    reg_map.erase(b.rhs);
     free_reg(lhs_id);
     free_reg(rhs_id);
     int reg_id = find_next_reg();    // dst reg_id of this binary op
@@ -487,7 +924,7 @@ void traverse(const koopa_raw_binary_t &b, const koopa_raw_value_t &value, strin
             break;        
     }
     use_reg(reg_id);
-    int dst_offset = offset_map[value];
+    int dst_offset = get_offset(value);
     visit_stack(reg_id, dst_offset, 1, instr);
     s += instr;
     free_reg(reg_id);
@@ -528,6 +965,46 @@ void visit_stack(int dst_reg, int dst_offset, int mode, string &instr) {
     }
 }
 
+/* Reg holding a global promoted in the loop of a block, -1 if there is none */
+int promoted_reg(const koopa_raw_basic_block_t &bb, const koopa_raw_value_t &glb) {
+    auto loop = func_ctx->bb_loop.find(bb);
+    if (loop == func_ctx->bb_loop.end())
+        return -1;
+    const auto &regs = func_ctx->loop_regs[loop->second];
+    auto it = regs.find(glb);
+    return it == regs.end() ? -1 : it->second;
+}
+
+/*
+ * Code on the edge from a block to another (nullptr when returning): load
+ * the globals of a promoted loop entered, store back those stored by a
+ * promoted loop left.
+ */
+string edge_code(const koopa_raw_basic_block_t &from, const koopa_raw_basic_block_t &to) {
+    string s;
+    auto from_loop = func_ctx->bb_loop.find(from);
+    auto to_loop = to ? func_ctx->bb_loop.find(to) : func_ctx->bb_loop.end();
+    int lf = from_loop == func_ctx->bb_loop.end() ? -1 : from_loop->second;
+    int lt = to_loop == func_ctx->bb_loop.end() ? -1 : to_loop->second;
+    if (lf == lt)
+        return s;
+    if (lf >= 0) {
+        const auto &loop = func_ctx->info->promoted_loops[lf];
+        for (auto glb : loop.globals) {
+            if (loop.stored.count(glb) && func_ctx->loop_regs[lf].count(glb))
+                visit_heap(func_ctx->loop_regs[lf][glb], glb, 1, s);
+        }
+    }
+    if (lt >= 0) {
+        const auto &loop = func_ctx->info->promoted_loops[lt];
+        for (auto glb : loop.globals) {
+            if (func_ctx->loop_regs[lt].count(glb))
+                visit_heap(func_ctx->loop_regs[lt][glb], glb, 0, s);
+        }
+    }
+    return s;
+}
+
 /* To visit global variable with load or store command */
 void visit_heap(int dst_reg, const koopa_raw_value_t &value, int mode, string &s) {
     string cmd("");
@@ -535,41 +1012,304 @@ void visit_heap(int dst_reg, const koopa_raw_value_t &value, int mode, string &s
         cmd = "  lw ";
     else 
         cmd = "  sw ";
+    auto it = func_ctx->global_regs.find(value);
+    if (it != func_ctx->global_regs.end()) {
+        s = s + cmd + temp_regs[dst_reg] + ", 0(" + temp_regs[it->second] + ")\n";
+        return;
+    }
+    // the linker turns this into one access off gp for small data
     string var_name = string(value->name);
     var_name.erase(0, 1);
     int med_reg = 3;
-    s = s + "  la " + temp_regs[med_reg] + ", " + var_name + "\n";
-    s = s + cmd + temp_regs[dst_reg] + ", 0(" + temp_regs[med_reg] + ")\n";
+    s = s + "  lui " + temp_regs[med_reg] + ", %hi(" + var_name + ")\n";
+    s = s + cmd + temp_regs[dst_reg] + ", %lo(" + var_name + ")(" + temp_regs[med_reg] + ")\n";
+}
+
+/*
+ * A getelemptr or getptr only used as the address of loads and stores or
+ * as the source of other ones gets no code of its own: the access adds
+ * its index to the address itself, constant indexes end up in the offset
+ * of lw / sw and chains of them are computed at once.
+ */
+void find_folded_addrs(const koopa_raw_function_t &func) {
+    func_ctx->folded_addrs.clear();
+    unordered_set<koopa_raw_value_t> needed;  // must hold their value
+    vector<koopa_raw_value_t> ops;
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for (size_t j = 0; j < block->insts.len; ++j) {
+            auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
+            const auto &kind = value->kind;
+            bool is_addr = kind.tag == KOOPA_RVT_GET_ELEM_PTR || kind.tag == KOOPA_RVT_GET_PTR;
+            if (is_addr)
+                func_ctx->folded_addrs.insert(value);
+            ops.clear();
+            get_operands(value, ops);
+            for (size_t k = 0; k < ops.size(); ++k) {
+                auto op = ops[k];
+                if (op->kind.tag != KOOPA_RVT_GET_ELEM_PTR && op->kind.tag != KOOPA_RVT_GET_PTR)
+                    continue;
+                // operands are (src) of load, (value, dest) of store, (src, index) of the others
+                bool addr_use = kind.tag == KOOPA_RVT_LOAD ||
+                                (kind.tag == KOOPA_RVT_STORE && k == 1) || (is_addr && k == 0);
+                if (!addr_use)
+                    needed.insert(op);
+            }
+        }
+    }
+    for (auto value : needed)
+        func_ctx->folded_addrs.erase(value);
+}
+
+/* Address of a pointer as root + offset + sum of index * stride */
+struct Address {
+    enum { FRAME, GLOBAL, SLOT } root;  // on the stack, a global, or held in a stack slot
+    koopa_raw_value_t value = nullptr;  // the global, or the value holding the pointer
+    int offset = 0;                     // in bytes, to sp for FRAME
+    vector<pair<koopa_raw_value_t, int> > terms;
+};
+
+/* Add index * stride to an address */
+void add_index(Address &addr, const koopa_raw_value_t &index, int stride) {
+    if (index->kind.tag == KOOPA_RVT_INTEGER)
+        addr.offset += index->kind.data.integer.value * stride;
+    else
+        addr.terms.push_back(make_pair(index, stride));
+}
+
+Address get_address(const koopa_raw_value_t &ptr) {
+    Address addr;
+    const auto &kind = ptr->kind;
+    if (func_ctx->folded_addrs.count(ptr)) {
+        if (kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+            addr = get_address(kind.data.get_elem_ptr.src);
+            add_index(addr, kind.data.get_elem_ptr.index, cal_base(kind.data.get_elem_ptr));
+        } else {
+            addr = get_address(kind.data.get_ptr.src);
+            add_index(addr, kind.data.get_ptr.index, cal_base(kind.data.get_ptr));
+        }
+    } else if (kind.tag == KOOPA_RVT_ALLOC) {
+        addr.root = Address::FRAME;
+        addr.offset = get_offset(ptr);
+    } else if (kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
+        addr.root = Address::GLOBAL;
+        addr.value = ptr;
+    } else {
+        addr.root = Address::SLOT;
+        addr.value = ptr;
+    }
+    return addr;
+}
+
+/*
+ * Keep the address of the globals a function uses most in callee saved
+ * regs, loaded once in the prologue. An access then saves the la before
+ * it (or the lui of a global outside small data), which is worth the save,
+ * la and restore of the reg when the access runs often enough.
+ */
+void find_global_regs(const koopa_raw_function_t &func) {
+    func_ctx->global_regs.clear();
+    func_ctx->reg_globals.clear();
+    const double reg_cost = 4;  // sw, la (2) and lw of the saved reg
+    unordered_map<koopa_raw_value_t, double> gain;
+    auto freq = [&](const koopa_raw_basic_block_t &bb) {
+        if (!func_ctx->info)
+            return 1.0;
+        auto it = func_ctx->info->block_freq.find(bb);
+        return it == func_ctx->info->block_freq.end() ? 1.0 : it->second;
+    };
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+        auto block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        if (func_ctx->info && func_ctx->info->unreachable_bbs.count(block))
+            continue;
+        double f = freq(block);
+        for (size_t j = 0; j < block->insts.len; ++j) {
+            auto value = reinterpret_cast<koopa_raw_value_t>(block->insts.buffer[j]);
+            const auto &kind = value->kind;
+            koopa_raw_value_t ptr = nullptr;
+            if (load_source(value) || (func_ctx->info && func_ctx->info->dead_stores.count(value)))
+                continue;
+            if (kind.tag == KOOPA_RVT_LOAD)
+                ptr = kind.data.load.src;
+            else if (kind.tag == KOOPA_RVT_STORE)
+                ptr = kind.data.store.dest;
+            else if ((kind.tag == KOOPA_RVT_GET_ELEM_PTR || kind.tag == KOOPA_RVT_GET_PTR) &&
+                     !func_ctx->folded_addrs.count(value))
+                ptr = value;
+            if (!ptr)
+                continue;
+            Address addr = get_address(ptr);
+            if (addr.root != Address::GLOBAL)
+                continue;
+            if (!addr.terms.empty())
+                gain[addr.value] += 2 * f;  // la
+            else if (func_ctx->types.size(addr.value->ty->data.pointer.base) > SMALL_DATA_BYTES)
+                gain[addr.value] += f;      // lui
+        }
+    }
+    auto entry = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]);
+    vector<pair<double, koopa_raw_value_t> > cands;
+    for (auto &g : gain) {
+        if (g.second > reg_cost * freq(entry))
+            cands.push_back(make_pair(g.second, g.first));
+    }
+    // most gain first, then by name so that the code does not depend on pointers
+    sort(cands.begin(), cands.end(), [](const pair<double, koopa_raw_value_t> &a,
+                                        const pair<double, koopa_raw_value_t> &b) {
+        if (a.first != b.first)
+            return a.first > b.first;
+        return strcmp(a.second->name, b.second->name) < 0;
+    });
+    for (size_t k = 0; k < cands.size() && k < (size_t)NUM_SAVED_REGS; ++k) {
+        func_ctx->global_regs[cands[k].second] = saved_reg_id + k;
+        func_ctx->reg_globals.push_back(cands[k].second);
+    }
+    func_ctx->num_saved = func_ctx->reg_globals.size();
+
+    // the regs left hold promoted globals, reused by each promoted loop
+    func_ctx->bb_loop.clear();
+    func_ctx->loop_regs.clear();
+    if (!func_ctx->info)
+        return;
+    const auto &loops = func_ctx->info->promoted_loops;
+    func_ctx->loop_regs.resize(loops.size());
+    for (size_t l = 0; l < loops.size(); ++l) {
+        for (auto bb : loops[l].blocks)
+            func_ctx->bb_loop[bb] = l;
+        int reg = func_ctx->reg_globals.size();
+        for (auto glb : loops[l].globals) {
+            if (reg >= NUM_SAVED_REGS)
+                break;
+            func_ctx->loop_regs[l][glb] = saved_reg_id + reg++;
+        }
+        if (reg > func_ctx->num_saved)
+            func_ctx->num_saved = reg;
+    }
+}
+
+/*
+ * Compute root + terms of an address into t4 (with t5 and t6), returns the
+ * offset left for the access off base. FRAME addresses without terms stay
+ * on sp, globals without terms on their saved reg or the upper part of
+ * their address.
+ */
+string gen_address(const Address &addr, string &base, string &s) {
+    const int reg_addr = 4, reg_idx = 5, reg_tmp = 6;  // t4, t5, t6
+    base = temp_regs[reg_addr];
+    if (addr.root == Address::FRAME && addr.terms.empty()) {
+        base = "sp";
+        return string(to_string(addr.offset));
+    }
+    int offset = addr.offset;
+    string root = temp_regs[reg_addr];  // reg holding the root
+    if (addr.root == Address::FRAME) {
+        get_stack_addr(reg_addr, addr.offset, s);
+        offset = 0;
+    } else if (addr.root == Address::GLOBAL) {
+        auto it = func_ctx->global_regs.find(addr.value);
+        string var_name = string(addr.value->name);
+        var_name.erase(0, 1);
+        if (it != func_ctx->global_regs.end()) {
+            root = temp_regs[it->second];
+        } else if (addr.terms.empty()) {
+            if (offset > 0)
+                var_name += "+" + string(to_string(offset));
+            else if (offset < 0)
+                var_name += string(to_string(offset));
+            s = s + "  lui " + temp_regs[reg_addr] + ", %hi(" + var_name + ")\n";
+            return "%lo(" + var_name + ")";
+        } else {
+            s = s + "  la " + temp_regs[reg_addr] + ", " + var_name + "\n";
+        }
+    } else {
+        visit_stack(reg_addr, get_offset(addr.value), 0, s);
+    }
+    for (auto &term : addr.terms) {
+        visit_stack(reg_idx, get_offset(term.first), 0, s);
+        int stride = term.second;
+        if (stride > 0 && (stride & (stride - 1)) == 0) {
+            int shift = 0;
+            while ((1 << shift) < stride)
+                shift++;
+            if (shift > 0)
+                s = s + "  slli " + temp_regs[reg_idx] + ", " + temp_regs[reg_idx] + ", " +
+                    string(to_string(shift)) + "\n";
+        } else {
+            s = s + "  li " + temp_regs[reg_tmp] + ", " + string(to_string(stride)) + "\n";
+            s = s + "  mul " + temp_regs[reg_idx] + ", " + temp_regs[reg_idx] + ", " +
+                temp_regs[reg_tmp] + "\n";
+        }
+        s = s + "  add " + temp_regs[reg_addr] + ", " + root + ", " + temp_regs[reg_idx] + "\n";
+        root = temp_regs[reg_addr];
+    }
+    base = root;
+    if (offset < -2048 || offset >= 2048) {
+        s = s + "  li " + temp_regs[reg_idx] + ", " + string(to_string(offset)) + "\n";
+        s = s + "  add " + temp_regs[reg_addr] + ", " + base + ", " + temp_regs[reg_idx] + "\n";
+        base = temp_regs[reg_addr];
+        offset = 0;
+    }
+    return string(to_string(offset));
+}
+
+/* Load (mode 0) or store (mode 1) the word a pointer points to */
+void access_address(int reg, const koopa_raw_value_t &ptr, int mode, string &s) {
+    Address addr = get_address(ptr);
+    if (addr.root == Address::FRAME && addr.terms.empty()) {
+        visit_stack(reg, addr.offset, mode, s);
+        return;
+    }
+    string base;
+    string offset = gen_address(addr, base, s);
+    s = s + (mode == 0 ? "  lw " : "  sw ") + temp_regs[reg] + ", " + offset + "(" + base + ")\n";
+}
+
+/* Compute the address of a getelemptr or getptr and store it as its value */
+void store_address(const Address &addr, const koopa_raw_value_t &value, string &s) {
+    if (addr.root == Address::FRAME && addr.terms.empty()) {
+        get_stack_addr(4, addr.offset, s);
+    } else {
+        string base;
+        string offset = gen_address(addr, base, s);
+        if (base != "t4" || offset != "0")
+            s = s + "  addi t4, " + base + ", " + offset + "\n";
+    }
+    visit_stack(4, get_offset(value), 1, s);
 }
 
 /* Traverse load */
 void traverse(const koopa_raw_load_t &lw, const koopa_raw_value_t &value, string &s) {
+    // the value is known: already in its slot, or a number
+    if (shares_slot(value))
+        return;
+    auto src = load_source(value);
+    if (src && src->kind.tag == KOOPA_RVT_INTEGER) {
+        traverse(src->kind.data.integer, src, s);
+        visit_stack(get_reg(src), get_offset(value), 1, s);
+        free_reg(get_reg(src));
+        return;
+    }
     int reg_id = find_next_reg();
     use_reg(reg_id);
     const auto &kind = lw.src->kind;
-    int dst_offset = offset_map[value];
+    int dst_offset = get_offset(value);
     int src_offset = 0;
-    int reg_med;
-    string var_name;
     switch (kind.tag) {
         case KOOPA_RVT_GLOBAL_ALLOC:
-            var_name = string(lw.src->name);
-            var_name.erase(0, 1);
+            if (promoted_reg(func_ctx->curr_bb, lw.src) >= 0) {
+                visit_stack(promoted_reg(func_ctx->curr_bb, lw.src), dst_offset, 1, s);
+                break;
+            }
             visit_heap(reg_id, lw.src, 0, s);
             visit_stack(reg_id, dst_offset, 1, s);
             break;
         case KOOPA_RVT_GET_ELEM_PTR:
         case KOOPA_RVT_GET_PTR:
-            reg_med = find_next_reg();
-            use_reg(reg_med);
-            src_offset = offset_map[lw.src];
-            visit_stack(reg_med, src_offset, 0, s);
-            s = s + "  lw " + temp_regs[reg_id] + ", 0(" + temp_regs[reg_med] + ")\n";
-            free_reg(reg_med);
+            access_address(reg_id, lw.src, 0, s);
             visit_stack(reg_id, dst_offset, 1, s);
             break;
         default:
-            src_offset = offset_map[lw.src];
+            src_offset = get_offset(lw.src);
             visit_stack(reg_id, src_offset, 0, s);
             visit_stack(reg_id, dst_offset, 1, s);
     }
@@ -578,29 +1318,36 @@ void traverse(const koopa_raw_load_t &lw, const koopa_raw_value_t &value, string
 
 /* Traverse store */
 void traverse(const koopa_raw_store_t & sw, const koopa_raw_value_t &value, string &s) {
+    // overwritten before anything reads it
+    if (func_ctx->info && func_ctx->info->dead_stores.count(value))
+        return;
     const auto &kind = sw.value->kind;
     int reg_id = 0;
     int src_offset = 0;
-    int dst_offset = offset_map[sw.dest];
-    map<koopa_raw_value_t, int, myCompare>::iterator it;
+    int dst_offset = get_offset(sw.dest);
     size_t i = 0;
     bool found = false;
+    int promoted = -1;
+    if (sw.dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+        promoted = promoted_reg(func_ctx->curr_bb, sw.dest);
+    if (promoted >= 0 && kind.tag != KOOPA_RVT_INTEGER && get_offset(sw.value) >= 0) {
+        visit_stack(promoted, get_offset(sw.value), 0, s);
+        return;
+    }
     switch (kind.tag) {
         case KOOPA_RVT_INTEGER:  // store 2, @x
             traverse(kind.data.integer, sw.value, s);
-            reg_id = reg_map[sw.value];
-            reg_map.erase(sw.value);
+            reg_id = get_reg(sw.value);
             break;
         default:  // store %1, @x
-            it = offset_map.find(sw.value);
-            if (it != offset_map.end()) {
-                src_offset = offset_map[sw.value];
+            src_offset = get_offset(sw.value);
+            if (src_offset >= 0) {
                 reg_id = find_next_reg();
                 use_reg(reg_id);
                 visit_stack(reg_id, src_offset, 0, s);
             } else {  // store @x_0, @x_1, while @x_0 is a fparam
-                for (; i < curr_func->params.len; ++i) {
-                    auto ptr = curr_func->params.buffer[i];
+                for (; i < func_ctx->curr_func->params.len; ++i) {
+                    auto ptr = func_ctx->curr_func->params.buffer[i];
                     koopa_raw_value_t val = reinterpret_cast<koopa_raw_value_t>(ptr);
                     if (sw.value == val) {
                         found = true;
@@ -612,7 +1359,7 @@ void traverse(const koopa_raw_store_t & sw, const koopa_raw_value_t &value, stri
                 if (i < 8) {
                     reg_id = 7 + i;
                 } else {
-                    src_offset = (i - 8) * 4 + num_bytes;  // in caller's frame
+                    src_offset = (i - 8) * 4 + func_ctx->num_bytes;  // in caller's frame
                     reg_id = find_next_reg();
                     use_reg(reg_id);
                     visit_stack(reg_id, src_offset, 0, s);
@@ -620,20 +1367,16 @@ void traverse(const koopa_raw_store_t & sw, const koopa_raw_value_t &value, stri
             }
     }
     const auto &dst_kind = sw.dest->kind;
-    int ptr_offset = 0;
-    int reg_med = 0;
     switch (dst_kind.tag) {
         case KOOPA_RVT_GLOBAL_ALLOC:  // store at a global var
-            visit_heap(reg_id, sw.dest, 1, s);
+            if (promoted >= 0)
+                s = s + "  mv " + temp_regs[promoted] + ", " + temp_regs[reg_id] + "\n";
+            else
+                visit_heap(reg_id, sw.dest, 1, s);
             break;
         case KOOPA_RVT_GET_ELEM_PTR:
         case KOOPA_RVT_GET_PTR:
-            ptr_offset = offset_map[sw.dest];
-            reg_med = find_next_reg();
-            use_reg(reg_med);
-            visit_stack(reg_med, ptr_offset, 0, s);
-            s = s + "  sw " + temp_regs[reg_id] + ", 0(" + temp_regs[reg_med] + ")\n";
-            free_reg(reg_med);
+            access_address(reg_id, sw.dest, 1, s);
             break;
         default:
             visit_stack(reg_id, dst_offset, 1, s);
@@ -649,101 +1392,130 @@ void traverse(const koopa_raw_branch_t & br, const koopa_raw_value_t &value, str
     switch (kind.tag) {
         case KOOPA_RVT_INTEGER:
             traverse(kind.data.integer, br.cond, s);
-            cond_id = reg_map[br.cond];
-            reg_map.erase(br.cond);
+            cond_id = get_reg(br.cond);
             free_reg(cond_id);
             break;
         default:
-            cond_offset = offset_map[br.cond];
+            cond_offset = get_offset(br.cond);
             cond_id = find_next_reg();
             use_reg(cond_id);
             visit_stack(cond_id, cond_offset, 0, s);
             free_reg(cond_id);
     }
-    int then_blk_id = label_map[br.true_bb];
-    int else_blk_id = label_map[br.false_bb];
-    // use jr to exceed 2048 bytes' limitation
-    int med_label_id = min_label_id;
-    min_label_id++;
-    s = s + "  bnez " + temp_regs[cond_id] + ", label" + 
-        string(to_string(med_label_id)) + "\n";
-    s = s + "  la t4, label" + string(to_string(else_blk_id)) + "\n";
-    s = s + "  jr t4\n\n";
-    s = s + "label" + string(to_string(med_label_id)) + ":\n";
-    s = s + "  la t4, label" + string(to_string(then_blk_id)) + "\n";
-    s = s + "  jr t4\n\n";
+    string cond = temp_regs[cond_id];
+    auto next = func_ctx->next_bb;
+    if (br.true_bb == br.false_bb) {
+        // the same as a jump, with the code of its edge
+        s += edge_code(func_ctx->curr_bb, br.true_bb);
+        if (br.true_bb != next)
+            s = s + "  j " + label_name(get_label(br.true_bb)) + "\n";
+        s += "\n";
+        return;
+    }
+    string then_label = label_name(get_label(br.true_bb));
+    string else_label = label_name(get_label(br.false_bb));
+    string then_code = edge_code(func_ctx->curr_bb, br.true_bb);
+    string else_code = edge_code(func_ctx->curr_bb, br.false_bb);
+    if (!then_code.empty() || !else_code.empty()) {
+        // branch over the code of one edge, the code of both puts the true one aside
+        bool over_else = else_code.empty() && !then_code.empty();
+        if (!then_code.empty() && !else_code.empty()) {
+            string pad = label_name(func_ctx->min_label_id++);
+            func_ctx->pads += pad + ":\n" + then_code + "  j " + then_label + "\n\n";
+            then_label = pad;
+        }
+        if (over_else) {
+            s = s + "  beqz " + cond + ", " + else_label + "\n" + then_code;
+            if (br.true_bb != next)
+                s = s + "  j " + then_label + "\n";
+        } else {
+            s = s + "  bnez " + cond + ", " + then_label + "\n" + else_code;
+            if (br.false_bb != next)
+                s = s + "  j " + else_label + "\n";
+        }
+        s += "\n";
+        return;
+    }
+    if (br.false_bb == next) {
+        s = s + "  bnez " + cond + ", " + then_label + "\n";
+    } else if (br.true_bb == next) {
+        s = s + "  beqz " + cond + ", " + else_label + "\n";
+    } else {
+        s = s + "  bnez " + cond + ", " + then_label + "\n";
+        s = s + "  j " + else_label + "\n";
+    }
+    s += "\n";
 }
 
 /* Traverse jump */
 void traverse(const koopa_raw_jump_t & j, const koopa_raw_value_t &value, string &s) {
-    int jump_blk_id = label_map[j.target];
-    // use jr to exceed 2048 bytes' limitation
-    s = s + "  la t4, label" + string(to_string(jump_blk_id)) + "\n";
-    s = s + "  jr t4\n\n";
-}
-
-/* Get array aggregated init value */
-veci get_init_val(const koopa_raw_aggregate_t &aggr) {
-    veci res;
-    res.clear();
-    for (int i = 0; i < aggr.elems.len; ++i) {
-        auto ptr = aggr.elems.buffer[i];
-        koopa_raw_value_t val = reinterpret_cast<koopa_raw_value_t>(ptr);
-        const auto kind = val->kind;
-        switch (kind.tag) {
-            case KOOPA_RVT_INTEGER:
-                res.push_back(kind.data.integer.value);
-                break;
-            default:
-                veci temp = get_init_val(kind.data.aggregate);
-                res.insert(res.end(), temp.begin(), temp.end());
-        }
-    }
-    return res;
+    s += edge_code(func_ctx->curr_bb, j.target);
+    // nothing to do if the target is the next block
+    if (j.target != func_ctx->next_bb)
+        s = s + "  j " + label_name(get_label(j.target)) + "\n";
+    s += "\n";
 }
 
-/* Get zero init value */
-void get_zero_init(const koopa_raw_value_t &value, string &s) {  // array zero init
-    int total_len = 4;
-    auto ptr = value->ty->data.pointer.base;
-    if (ptr->tag == KOOPA_RTT_ARRAY) {  // array
-        while (ptr->data.array.base && ptr->tag == KOOPA_RTT_ARRAY) {
-            int dim = ptr->data.array.len;
-            if (dim == 0)
-                break;
-            total_len *= dim;
-            ptr = ptr->data.array.base;
-        }
+/* Whether an initializer sets every byte to 0 */
+bool is_zero_init(const koopa_raw_value_t &init) {
+    const auto &kind = init->kind;
+    switch (kind.tag) {
+        case KOOPA_RVT_INTEGER:
+            return kind.data.integer.value == 0;
+        case KOOPA_RVT_AGGREGATE:
+            for (size_t i = 0; i < kind.data.aggregate.elems.len; ++i) {
+                if (!is_zero_init(reinterpret_cast<koopa_raw_value_t>(kind.data.aggregate.elems.buffer[i])))
+                    return false;
+            }
+            return true;
+        default:  // zeroinit and undef
+            return true;
     }
-    s = s + "  .zero " + string(to_string(total_len)) + "\n";
 }
 
-/* Traverse global alloc */
-void traverse(const koopa_raw_global_alloc_t & glb, const koopa_raw_value_t &value, string &s) {
-    string glbvar_name = string(value->name);
-    glbvar_name.erase(0, 1);
-    s = s + "  .data\n.globl " + glbvar_name + "\n";
-    s = s + glbvar_name + ":\n";
-    veci init_val;
-    int i;
-    const auto &kind = glb.init->kind;
+/* Emit an initializer as words, runs of zeros are merged into one .zero */
+void emit_init(const koopa_raw_value_t &init, unsigned int &zero_bytes, string &s) {
+    const auto &kind = init->kind;
     switch (kind.tag) {
         case KOOPA_RVT_INTEGER:
+            if (kind.data.integer.value == 0) {
+                zero_bytes += 4;
+                break;
+            }
+            if (zero_bytes > 0)
+                s = s + "  .zero " + string(to_string(zero_bytes)) + "\n";
+            zero_bytes = 0;
             s = s + "  .word " + string(to_string(int(kind.data.integer.value))) + "\n";
             break;
-        case KOOPA_RVT_ZERO_INIT:  // array zero init
-            // s = s + "  .zero 4\n";
-            get_zero_init(value, s);
-            break;
         case KOOPA_RVT_AGGREGATE:
-            init_val = get_init_val(kind.data.aggregate);
-            for (i = 0; i < init_val.size(); ++i) {
-                s = s + "  .word " + string(to_string(init_val[i])) + "\n";
-            }
+            for (size_t i = 0; i < kind.data.aggregate.elems.len; ++i)
+                emit_init(reinterpret_cast<koopa_raw_value_t>(kind.data.aggregate.elems.buffer[i]),
+                          zero_bytes, s);
             break;
-        default:
+        default:  // zeroinit and undef
+            zero_bytes += type_size(init->ty);
             break;
     }
+}
+
+/* Traverse global alloc */
+void traverse(const koopa_raw_global_alloc_t & glb, const koopa_raw_value_t &value, string &s) {
+    string glbvar_name = string(value->name);
+    glbvar_name.erase(0, 1);
+    // variables which start as zero take no space in the object file
+    bool small = type_size(value->ty->data.pointer.base) <= SMALL_DATA_BYTES;
+    if (is_zero_init(glb.init)) {
+        s = s + (small ? "  .section .sbss\n.globl " : "  .bss\n.globl ") + glbvar_name + "\n";
+        s = s + glbvar_name + ":\n";
+        s = s + "  .zero " + string(to_string(type_size(value->ty->data.pointer.base))) + "\n\n";
+        return;
+    }
+    s = s + (small ? "  .section .sdata\n.globl " : "  .data\n.globl ") + glbvar_name + "\n";
+    s = s + glbvar_name + ":\n";
+    unsigned int zero_bytes = 0;
+    emit_init(glb.init, zero_bytes, s);
+    if (zero_bytes > 0)
+        s = s + "  .zero " + string(to_string(zero_bytes)) + "\n";
     s += "\n";
 }
 
@@ -762,7 +1534,7 @@ void put_params(const koopa_raw_slice_t &slice, string &s) {
                     string(to_string(kind.data.integer.value)) + "\n";
                 break;
             default:
-                src_offset = offset_map[value];
+                src_offset = get_offset(value);
                 visit_stack(reg_id, src_offset, 0, s);
         }
         reg_id++;
@@ -775,11 +1547,10 @@ void put_params(const koopa_raw_slice_t &slice, string &s) {
             switch (kind.tag) {
                 case KOOPA_RVT_INTEGER:
                     traverse(kind.data.integer, value, s);
-                    med_id = reg_map[value];
-                    reg_map.erase(value);
+                    med_id = get_reg(value);
                     break;
                 default:
-                    src_offset = offset_map[value];
+                    src_offset = get_offset(value);
                     med_id = find_next_reg();
                     use_reg(med_id);
                     visit_stack(med_id, src_offset, 0, s);
@@ -796,7 +1567,7 @@ void traverse(const koopa_raw_call_t & call, const koopa_raw_value_t &value, str
     // store reg value onto the stack
     for (int i = 0; i < NUM_REGS; ++i) {
         s = s + "  sw " + temp_regs[i] + ", " + 
-            string(to_string(reg_offset[i])) + "(sp)\n";
+            string(to_string(func_ctx->reg_offset[i])) + "(sp)\n";
     }
     // put params in regs and stack
     put_params(call.args, s);
@@ -806,148 +1577,40 @@ void traverse(const koopa_raw_call_t & call, const koopa_raw_value_t &value, str
     s = s + "  call " + callee_name + "\n";
     // store ret value
     if (value->ty->tag != KOOPA_RTT_UNIT) {
-        int dst_offset = offset_map[value];
+        int dst_offset = get_offset(value);
         visit_stack(7, dst_offset, 1, s);
     }
     // restore reg value
     for (int i = 0; i < NUM_REGS; ++i) {
         s = s + "  lw " + temp_regs[i] + ", " + 
-            string(to_string(reg_offset[i])) + "(sp)\n";
+            string(to_string(func_ctx->reg_offset[i])) + "(sp)\n";
     }
     s += "\n";
 }
 
 int cal_base(const koopa_raw_get_elem_ptr_t &get_ep) {
-    int total_len = 4;
-    int count = 0;
-    auto ptr = get_ep.src->ty->data.pointer.base;
-    while (ptr->data.array.base && ptr->tag == KOOPA_RTT_ARRAY) {
-        int dim = ptr->data.array.len;
-        if (dim == 0)
-            break;
-        if (count > 0)
-            total_len *= dim;
-        ptr = ptr->data.array.base;
-        count++;
-    }
-    return total_len;
+    return func_ctx->types.elem_stride(get_ep.src->ty);
 }
 
 int cal_base(const koopa_raw_get_ptr_t &get_p) {
-    int total_len = 4;
-    auto ptr = get_p.src->ty->data.pointer.base;
-    while (ptr->data.array.base && ptr->tag == KOOPA_RTT_ARRAY) {
-        int dim = ptr->data.array.len;
-        if (dim == 0)
-            break;
-        total_len *= dim;
-        ptr = ptr->data.array.base;
-    }
-    return total_len;
+    return func_ctx->types.ptr_stride(get_p.src->ty);
 }
 
 void traverse(const koopa_raw_get_elem_ptr_t &get_ep, const koopa_raw_value_t &value, string &s) {
-    auto src = get_ep.src;
-    auto index = get_ep.index;
-    const auto idx_kind = index->kind;
-    int reg_idx = 0;
-    int idx_offset = 0;
-    switch (idx_kind.tag) {
-        case KOOPA_RVT_INTEGER:
-            traverse(idx_kind.data.integer, index, s);
-            reg_idx = reg_map[index];
-            reg_map.erase(index);
-            break;
-        default:
-            idx_offset = offset_map[index];
-            reg_idx = find_next_reg();
-            use_reg(reg_idx);
-            visit_stack(reg_idx, idx_offset, 0, s);
-    }
-    int reg_src = 0;
-    reg_src = find_next_reg();
-    use_reg(reg_src);
-    int src_offset = 0;
-    const auto &src_kind = src->kind;
-    if (src_kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
-        string var_name = string(src->name);
-        var_name.erase(0, 1);
-        s = s + "  la " + temp_regs[reg_src] + ", " + var_name + "\n";
-    } else if (src_kind.tag == KOOPA_RVT_ALLOC) {
-        src_offset = offset_map[src];
-        get_stack_addr(reg_src, src_offset, s);
-    } else if (src_kind.tag == KOOPA_RVT_GET_ELEM_PTR || 
-               src_kind.tag == KOOPA_RVT_GET_PTR || 
-               src_kind.tag == KOOPA_RVT_LOAD) {
-        src_offset = offset_map[src];
-        visit_stack(reg_src, src_offset, 0, s);
-    } else {
-        cout << "no\n";
-    }
-    int reg_base = 0;
-    reg_base = find_next_reg();
-    int base_num = cal_base(get_ep);
-    s = s + "  li " + temp_regs[reg_base] + ", " + string(to_string(base_num)) + "\n";
-    s = s + "  mul " + temp_regs[reg_base] + ", " + temp_regs[reg_base] + ", " + 
-        temp_regs[reg_idx] + "\n";
-    s = s + "  add " + temp_regs[reg_src] + ", " + temp_regs[reg_src] + ", " + 
-        temp_regs[reg_base] + "\n";
-    free_reg(reg_idx);
-    free_reg(reg_base);
-    int dst_offset = offset_map[value];
-    visit_stack(reg_src, dst_offset, 1, s);
-    free_reg(reg_src);
+    // folded into the loads and stores using it
+    if (func_ctx->folded_addrs.count(value))
+        return;
+    Address addr = get_address(get_ep.src);
+    add_index(addr, get_ep.index, cal_base(get_ep));
+    store_address(addr, value, s);
 }
 
+
 void traverse(const koopa_raw_get_ptr_t &get_p, const koopa_raw_value_t &value, string &s) {
-    auto src = get_p.src;
-    auto index = get_p.index;
-    const auto idx_kind = index->kind;
-    int reg_idx = 0;
-    int idx_offset = 0;
-    switch (idx_kind.tag) {
-        case KOOPA_RVT_INTEGER:
-            traverse(idx_kind.data.integer, index, s);
-            reg_idx = reg_map[index];
-            reg_map.erase(index);
-            break;
-        default:
-            idx_offset = offset_map[index];
-            reg_idx = find_next_reg();
-            use_reg(reg_idx);
-            visit_stack(reg_idx, idx_offset, 0, s);
-    }
-    int reg_src = 0;
-    reg_src = find_next_reg();
-    use_reg(reg_src);
-    int src_offset = 0;
-    const auto &src_kind = src->kind;
-    if (src_kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
-        string var_name = string(src->name);
-        var_name.erase(0, 1);
-        s = s + "  la " + temp_regs[reg_src] + ", " + var_name + "\n";
-    } else if (src_kind.tag == KOOPA_RVT_ALLOC) {
-        src_offset = offset_map[src];
-        get_stack_addr(reg_src, src_offset, s);
-    } else if (src_kind.tag == KOOPA_RVT_GET_ELEM_PTR || 
-               src_kind.tag == KOOPA_RVT_GET_PTR || 
-               src_kind.tag == KOOPA_RVT_LOAD) {
-        src_offset = offset_map[src];
-        visit_stack(reg_src, src_offset, 0, s);
-    } else {
-        cout << "no\n";
-    }
-    int reg_base = 0;
-    reg_base = find_next_reg();
-    int base_num = cal_base(get_p);
-    s = s + "  li " + temp_regs[reg_base] + ", " + string(to_string(base_num)) + "\n";
-    s = s + "  mul " + temp_regs[reg_base] + ", " + temp_regs[reg_base] + ", " + 
-        temp_regs[reg_idx] + "\n";
-    s = s + "  add " + temp_regs[reg_src] + ", " + temp_regs[reg_src] + ", " + 
-        temp_regs[reg_base] + "\n";
-    free_reg(reg_idx);
-    free_reg(reg_base);
-    int dst_offset = offset_map[value];
-    visit_stack(reg_src, dst_offset, 1, s);
-    free_reg(reg_src);
-}
\ No newline at end of file
+    // folded into the loads and stores using it
+    if (func_ctx->folded_addrs.count(value))
+        return;
+    Address addr = get_address(get_p.src);
+    add_index(addr, get_p.index, cal_base(get_p));
+    store_address(addr, value, s);
+}
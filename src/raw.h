@@ -5,15 +5,57 @@
 #include <cstring>
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include "koopa.h"
+#include "pass.h"
+#include "layout.h"
 using namespace std;
 
 
 #define NUM_REGS 3
-extern string temp_regs[17];     // mapping of reg_id and reg_name
-extern int reg_use[15];    // use of regs
+#define NUM_SAVED_REGS 11
+extern string temp_regs[28];     // mapping of reg_id and reg_name
 extern const int x0_id;
 extern string koopa_ir;
+// Number of threads generating functions in parallel, 0 for one per core
+extern unsigned int codegen_threads;
+
+/* Code generation state of one function, so functions can be compiled concurrently */
+struct FuncContext {
+    int reg_use[15];           // use condition of regs
+    int reg_offset[NUM_REGS];  // caller saved regs offset to sp
+    bool ra_save = false;      // ra save
+    int ra_offset = 0;         // ra offset
+    unsigned int num_bytes = 0;  // Total bytes allocated for the stack frame
+    int min_label_id = 0;      // The minimum valid label id, labels are local to the function
+    string func_name;          // name of the function, prefix of its labels
+    koopa_raw_function_t curr_func = nullptr;
+    const FuncInfo *info = nullptr;  // results of middle end passes, if any
+    koopa_raw_basic_block_t next_bb = nullptr;  // block emitted after the current one
+    // dense id of each value in the function, assigned by index_func
+    unordered_map<koopa_raw_value_t, int> value_id;
+    // dense id of each basic block in the function
+    unordered_map<koopa_raw_basic_block_t, int> bb_id;
+    vector<int> reg_table;     // value id -> reg_id holding its result
+    vector<int> offset_table;  // value id -> offset to sp of its result, -1 if none
+    vector<int> label_table;   // block id -> label id
+    // getelemptr / getptr values computed by the loads and stores using them
+    unordered_set<koopa_raw_value_t> folded_addrs;
+    TypeLayouts types;         // sizes and strides of the types used
+    koopa_raw_basic_block_t curr_bb = nullptr;  // block being emitted
+    // globals whose address is kept in a saved reg, reg id of the reg
+    unordered_map<koopa_raw_value_t, int> global_regs;
+    vector<koopa_raw_value_t> reg_globals;  // saved reg -> global, from s1
+    // promoted loop of each block, and reg id holding each of its globals
+    unordered_map<koopa_raw_basic_block_t, int> bb_loop;
+    vector<unordered_map<koopa_raw_value_t, int> > loop_regs;
+    int num_saved = 0;                 // saved regs used, from s1
+    int saved_offset[NUM_SAVED_REGS];  // saved regs offset to sp
+    string pads;                       // code of branch edges, after the epilogue
+};
+extern thread_local FuncContext *func_ctx;
 
 /* 
  * Functions to traverse the raw program and 
@@ -21,7 +63,10 @@ extern string koopa_ir;
  */
 int get_total_var(const string &s, string::size_type start_pos);
 void traverse(const koopa_raw_program_t &program, string &s);
+void traverse(const koopa_raw_program_t &program, const ModuleInfo &info, string &s);
 void traverse(const koopa_raw_slice_t &slice, string &s);
+void gen_funcs(const koopa_raw_slice_t &funcs, string &s, const ModuleInfo *info = nullptr);
+string fingerprint(const koopa_raw_function_t &func);
 void traverse(const koopa_raw_function_t &func, string &s);
 void traverse(const koopa_raw_basic_block_t &bb, string &s);
 void traverse(const koopa_raw_value_t &value, string &s);
@@ -39,8 +84,19 @@ void traverse(const koopa_raw_get_ptr_t &get_p, const koopa_raw_value_t &value,
 int find_next_reg();
 void use_reg(int reg_id);
 void free_reg(int reg_id);
-void koopa2riscv(const char *str, string &s);
+class Profile;
+// False if str is not a valid KoopaIR program
+bool koopa2riscv(const char *str, string &s, const Profile *profile = nullptr);
 void visit_stack(int dst_reg, int dst_offset, int mode, string &instr);
 void visit_heap(int dst_reg, const koopa_raw_value_t &value, int mode, string &s);
+void find_folded_addrs(const koopa_raw_function_t &func);
+void find_global_regs(const koopa_raw_function_t &func);
+koopa_raw_value_t load_source(const koopa_raw_value_t &value);
+bool shares_slot(const koopa_raw_value_t &value);
+int promoted_reg(const koopa_raw_basic_block_t &bb, const koopa_raw_value_t &glb);
+string edge_code(const koopa_raw_basic_block_t &from, const koopa_raw_basic_block_t &to);
+void access_address(int reg, const koopa_raw_value_t &ptr, int mode, string &s);
+int cal_base(const koopa_raw_get_elem_ptr_t &get_ep);
+int cal_base(const koopa_raw_get_ptr_t &get_p);
 
 #endif
\ No newline at end of file
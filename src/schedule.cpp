@@ -0,0 +1,586 @@
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <bitset>
+#include <string>
+#include <vector>
+#include "schedule.h"
+using namespace std;
+
+static const char *reg_names[32] = {"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+                                    "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+                                    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+                                    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+const int ZERO = 0, SP = 2;
+
+// Longest run scheduled at once, longer blocks are cut into runs of this size
+const int MAX_RUN = 128;
+
+static int reg_id(const string &name) {
+    for (int i = 0; i < 32; ++i) {
+        if (name == reg_names[i])
+            return i;
+    }
+    return name == "fp" ? 8 : -1;
+}
+
+static bool is_temp(int reg) {
+    return (reg >= 5 && reg <= 7) || reg >= 28;
+}
+
+static string trim(const string &s) {
+    size_t b = s.find_first_not_of(" \t\r");
+    if (b == string::npos)
+        return string("");
+    size_t e = s.find_last_not_of(" \t\r");
+    return s.substr(b, e - b + 1);
+}
+
+namespace {
+
+enum InstKind { ALU, LOAD, STORE };
+
+struct Operand {
+    string text;    // immediate or symbol, the offset of a memory operand
+    int reg = -1;   // register, the base of a memory operand
+    bool mem = false;
+};
+
+struct Inst {
+    string line;
+    string mnemonic;
+    vector<Operand> ops;
+    InstKind kind = ALU;
+    bool def = false;     // ops[0] is written
+    int bytes = 0;        // accessed by loads and stores
+    unsigned latency = 1;
+    // filled while building the graph
+    int def_value = -1;
+    vector<int> use_values;  // per operand, -1 for other operands
+};
+
+// Where an address points, as far as it is known
+struct Addr {
+    enum { UNKNOWN, CONST, STACK, SYMBOL } kind = UNKNOWN;
+    int sp_value = -1;   // value of sp the STACK address is relative to
+    string symbol;
+    bool hi = false;     // lui of %hi(symbol), only good for %lo(symbol)
+    long offset = 0;
+};
+
+// A value written by an instruction of the run, or live into it
+struct Value {
+    int reg;
+    int def = -1;          // instruction, -1 if live in
+    vector<int> users;     // distinct instructions reading it
+    bool fixed = true;     // keeps its register: live in or out, or not a temporary
+    Addr addr;
+};
+
+struct Edge {
+    int to;
+    unsigned latency;
+};
+
+// Registers while a run is scheduled
+struct RegState {
+    vector<int> holder;      // value in each register, -1 if free
+    vector<int> assigned;    // register of each value
+    vector<int> remaining;   // reads of each value not issued yet
+    vector<bool> done;       // instructions issued
+};
+
+}  // namespace
+
+/* Parse an instruction we know how to move, false for anything else */
+static bool parse_inst(const string &line, Inst &inst, const PipelineConfig &timing) {
+    if (line.compare(0, 2, "  ") != 0 || line.size() < 3 || line[2] == '.' || line[2] == ' ')
+        return false;
+    string body = trim(line);
+    size_t sp = body.find(' ');
+    inst.line = line;
+    inst.mnemonic = body.substr(0, sp);
+    const string &m = inst.mnemonic;
+    static const char *alu_ops[] = {
+        "add", "sub", "and", "or", "xor", "sll", "srl", "sra", "slt", "sltu", "sgt", "sgtu",
+        "addi", "andi", "ori", "xori", "slli", "srli", "srai", "slti", "sltiu",
+        "lui", "li", "la", "mv", "neg", "not", "seqz", "snez", "sltz", "sgtz",
+        "mul", "mulh", "mulhu", "mulhsu", "div", "divu", "rem", "remu"};
+    if (m == "lw" || m == "lh" || m == "lhu" || m == "lb" || m == "lbu") {
+        inst.kind = LOAD;
+        inst.latency = timing.load_latency;
+    } else if (m == "sw" || m == "sh" || m == "sb") {
+        inst.kind = STORE;
+    } else {
+        bool found = false;
+        for (auto op : alu_ops)
+            found = found || m == op;
+        if (!found)
+            return false;
+        if (m[0] == 'm' && m != "mv")
+            inst.latency = timing.mul_latency;
+        else if (m.compare(0, 3, "div") == 0 || m.compare(0, 3, "rem") == 0)
+            inst.latency = timing.div_latency;
+        else
+            inst.latency = timing.alu_latency;
+    }
+    if (sp == string::npos)
+        return false;
+    string rest = body.substr(sp + 1);
+    size_t pos = 0;
+    while (pos <= rest.size()) {
+        size_t comma = rest.find(',', pos);
+        if (comma == string::npos)
+            comma = rest.size();
+        Operand op;
+        op.text = trim(rest.substr(pos, comma - pos));
+        op.reg = reg_id(op.text);
+        inst.ops.push_back(op);
+        pos = comma + 1;
+    }
+    if (inst.ops.empty() || inst.ops[0].reg < 0)
+        return false;
+    if (inst.kind != ALU) {
+        // lw rd, offset(base) / sw rs, offset(base)
+        if (inst.ops.size() != 2)
+            return false;
+        Operand &mem = inst.ops[1];
+        size_t open = mem.text.rfind('(');
+        if (open == string::npos || mem.text.back() != ')')
+            return false;
+        mem.reg = reg_id(mem.text.substr(open + 1, mem.text.size() - open - 2));
+        mem.text = mem.text.substr(0, open);
+        mem.mem = true;
+        if (mem.reg < 0)
+            return false;
+        inst.bytes = m[1] == 'w' ? 4 : m[1] == 'h' ? 2 : 1;
+    }
+    inst.def = inst.kind != STORE && inst.ops[0].reg != ZERO;
+    return true;
+}
+
+/* Address of a memory operand given what its base holds */
+static Addr mem_addr(const Addr &base, const string &offset) {
+    Addr addr;
+    if (offset.compare(0, 4, "%lo(") == 0 && offset.back() == ')') {
+        string expr = offset.substr(4, offset.size() - 5);
+        size_t plus = expr.find_first_of("+-");
+        string symbol = expr.substr(0, plus);
+        // lui base, %hi(x) goes with %lo(x)(base)
+        if (base.kind == Addr::SYMBOL && base.hi && base.symbol == expr) {
+            addr.kind = Addr::SYMBOL;
+            addr.symbol = symbol;
+            addr.offset = plus == string::npos ? 0 : strtol(expr.c_str() + plus, nullptr, 0);
+        }
+        return addr;
+    }
+    char *end;
+    long off = strtol(offset.c_str(), &end, 0);
+    if (offset.empty() || *end != '\0')
+        return addr;
+    if (base.kind == Addr::STACK || (base.kind == Addr::SYMBOL && !base.hi)) {
+        addr = base;
+        addr.offset += off;
+    }
+    return addr;
+}
+
+static bool may_alias(const Addr &a, int a_bytes, const Addr &b, int b_bytes) {
+    if ((a.kind == Addr::STACK && b.kind == Addr::SYMBOL) ||
+        (a.kind == Addr::SYMBOL && b.kind == Addr::STACK))
+        return false;
+    bool same_base = (a.kind == Addr::STACK && b.kind == Addr::STACK && a.sp_value == b.sp_value) ||
+                     (a.kind == Addr::SYMBOL && b.kind == Addr::SYMBOL && a.symbol == b.symbol);
+    if (a.kind == Addr::SYMBOL && b.kind == Addr::SYMBOL && !same_base)
+        return false;
+    if (!same_base)
+        return true;
+    return a.offset < b.offset + b_bytes && b.offset < a.offset + a_bytes;
+}
+
+/* What a value written by an instruction holds, for addresses */
+static Addr value_addr(const Inst &inst, const vector<Value> &values) {
+    Addr res;
+    const string &m = inst.mnemonic;
+    static const Addr unknown;
+    auto operand = [&](size_t k) -> const Addr & {
+        return k < inst.use_values.size() && inst.use_values[k] >= 0 ?
+               values[inst.use_values[k]].addr : unknown;
+    };
+    char *end;
+    if (m == "li") {
+        long val = strtol(inst.ops[1].text.c_str(), &end, 0);
+        if (*end == '\0') {
+            res.kind = Addr::CONST;
+            res.offset = val;
+        }
+    } else if (m == "lui" && inst.ops[1].text.compare(0, 4, "%hi(") == 0) {
+        res.kind = Addr::SYMBOL;
+        res.symbol = inst.ops[1].text.substr(4, inst.ops[1].text.size() - 5);
+        res.hi = true;
+    } else if (m == "la") {
+        res.kind = Addr::SYMBOL;
+        res.symbol = inst.ops[1].text;
+    } else if (m == "mv") {
+        res = operand(1);
+    } else if (m == "addi" && operand(1).kind == Addr::STACK) {
+        long val = strtol(inst.ops[2].text.c_str(), &end, 0);
+        if (*end == '\0') {
+            res = operand(1);
+            res.offset += val;
+        }
+    } else if (m == "add") {
+        const Addr &a = operand(1), &b = operand(2);
+        if (a.kind == Addr::STACK && b.kind == Addr::CONST) {
+            res = a;
+            res.offset += b.offset;
+        } else if (b.kind == Addr::STACK && a.kind == Addr::CONST) {
+            res = b;
+            res.offset += a.offset;
+        }
+    }
+    return res;
+}
+
+/*
+ * Schedule a run of instructions into order, renaming the temporaries,
+ * false if it is left as it is
+ */
+static bool schedule_run(vector<Inst> &run, vector<string> &out) {
+    int n = run.size();
+    if (n < 2)
+        return false;
+    // Values, and the register each holds in the run
+    vector<Value> values;
+    int curr[32];
+    for (int r = 0; r < 32; ++r)
+        curr[r] = -1;
+    auto reg_value = [&](int r) {
+        if (curr[r] < 0) {
+            Value v;
+            v.reg = r;
+            if (r == SP)
+                v.addr.kind = Addr::STACK;
+            values.push_back(v);
+            curr[r] = values.size() - 1;
+            if (r == SP)
+                values[curr[r]].addr.sp_value = curr[r];
+        }
+        return curr[r];
+    };
+    vector<bool> defined(32, false);
+    for (int i = 0; i < n; ++i) {
+        Inst &inst = run[i];
+        inst.use_values.assign(inst.ops.size(), -1);
+        for (size_t k = inst.def ? 1 : 0; k < inst.ops.size(); ++k) {
+            if (inst.ops[k].reg < 0)
+                continue;
+            int v = reg_value(inst.ops[k].reg);
+            inst.use_values[k] = v;
+            auto &users = values[v].users;
+            if (users.empty() || users.back() != i)
+                users.push_back(i);
+        }
+        if (!inst.def)
+            continue;
+        int r = inst.ops[0].reg;
+        // a temporary written again later in the run only lives in the run
+        if (curr[r] >= 0 && values[curr[r]].def >= 0 && is_temp(r))
+            values[curr[r]].fixed = false;
+        Value v;
+        v.reg = r;
+        v.def = i;
+        values.push_back(v);
+        inst.def_value = values.size() - 1;
+        values.back().addr = value_addr(inst, values);
+        curr[r] = inst.def_value;
+        defined[r] = true;
+    }
+    vector<bool> live_out(values.size(), false);
+    for (int r = 0; r < 32; ++r) {
+        if (curr[r] >= 0)
+            live_out[curr[r]] = true;
+    }
+
+    // Dependences
+    vector<vector<Edge> > succs(n);
+    vector<vector<int> > preds(n);
+    auto add_edge = [&](int from, int to, unsigned latency) {
+        if (from < 0 || from == to)
+            return;
+        succs[from].push_back(Edge{to, latency});
+        preds[to].push_back(from);
+    };
+    for (auto &v : values) {
+        for (int user : v.users)
+            add_edge(v.def, user, run[v.def < 0 ? 0 : v.def].latency);
+    }
+    // values which keep their register are written in order, after the reads of the previous one
+    int last_fixed[32];
+    for (int r = 0; r < 32; ++r)
+        last_fixed[r] = -1;
+    for (size_t id = 0; id < values.size(); ++id) {
+        const Value &v = values[id];
+        if (!v.fixed)
+            continue;
+        if (v.def >= 0 && last_fixed[v.reg] >= 0) {
+            const Value &prev = values[last_fixed[v.reg]];
+            add_edge(prev.def, v.def, 0);
+            for (int user : prev.users)
+                add_edge(user, v.def, 0);
+        }
+        last_fixed[v.reg] = id;
+    }
+    vector<Addr> addrs(n);
+    for (int i = 0; i < n; ++i) {
+        if (run[i].kind == ALU)
+            continue;
+        addrs[i] = mem_addr(values[run[i].use_values[1]].addr, run[i].ops[1].text);
+        for (int j = 0; j < i; ++j) {
+            if (run[j].kind == ALU || (run[j].kind == LOAD && run[i].kind == LOAD))
+                continue;
+            if (may_alias(addrs[j], run[j].bytes, addrs[i], run[i].bytes))
+                add_edge(j, i, 0);
+        }
+    }
+    // ancestors, and the length of the longest path to the end of the run
+    vector<bitset<MAX_RUN> > anc(n);
+    for (int i = 0; i < n; ++i) {
+        for (int p : preds[i]) {
+            anc[i] |= anc[p];
+            anc[i].set(p);
+        }
+    }
+    vector<unsigned> prio(n, 0);
+    for (int i = n - 1; i >= 0; --i) {
+        prio[i] = run[i].latency;
+        for (auto &e : succs[i])
+            prio[i] = max(prio[i], e.latency + prio[e.to]);
+    }
+
+    // Registers: which value each holds, temporaries not read as live in are free to use
+    RegState state;
+    state.holder.assign(32, -1);
+    state.assigned.assign(values.size(), -1);
+    state.remaining.resize(values.size());
+    state.done.assign(n, false);
+    for (size_t id = 0; id < values.size(); ++id) {
+        state.remaining[id] = values[id].users.size();
+        if (values[id].def < 0 && !values[id].users.empty()) {
+            state.holder[values[id].reg] = id;
+            state.assigned[id] = values[id].reg;
+        }
+    }
+    // the value which finally holds each register
+    vector<int> final_def(32, -1);
+    for (int r = 0; r < 32; ++r) {
+        if (curr[r] >= 0 && values[curr[r]].def >= 0)
+            final_def[r] = values[curr[r]].def;
+    }
+
+    // Register a value gets if the instruction is issued now, -1 if none fits
+    auto pick_reg = [&](const RegState &st, int i) {
+        const Inst &inst = run[i];
+        if (!inst.def)
+            return 0;
+        const Value &v = values[inst.def_value];
+        auto is_free = [&](int r) {
+            int h = st.holder[r];
+            if (h < 0)
+                return true;
+            // read for the last time by this instruction
+            return !live_out[h] && st.remaining[h] == 1 &&
+                   find(values[h].users.begin(), values[h].users.end(), i) != values[h].users.end();
+        };
+        if (v.fixed)
+            return is_free(v.reg) ? v.reg : -1;
+        // a temporary the run does not write is free once no value live into
+        // the run is read from it; one it writes must be given back before it
+        // is written for the last time, at the latest by that write reading the value
+        auto fits = [&](int r) {
+            if (!is_free(r))
+                return false;
+            int last = final_def[r];
+            if (last < 0 || st.done[last])
+                return last < 0;
+            for (int user : v.users) {
+                if (anc[user].test(last))
+                    return false;
+            }
+            return true;
+        };
+        if (fits(v.reg))
+            return v.reg;
+        // those not written by the run first, they never hold anything up
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int r = 0; r < 32; ++r) {
+                if (is_temp(r) && defined[r] == (pass == 1) && fits(r))
+                    return r;
+            }
+        }
+        return -1;
+    };
+    auto issue = [&](RegState &st, int i, int reg) {
+        const Inst &inst = run[i];
+        st.done[i] = true;
+        for (size_t k = 0; k < inst.ops.size(); ++k) {
+            int v = inst.use_values[k];
+            if (v < 0 || find(inst.use_values.begin(), inst.use_values.begin() + k, v) !=
+                             inst.use_values.begin() + k)
+                continue;
+            if (--st.remaining[v] == 0 && !live_out[v])
+                st.holder[st.assigned[v]] = -1;
+        }
+        if (inst.def) {
+            int v = inst.def_value;
+            st.assigned[v] = reg;
+            st.holder[reg] = v;
+            if (st.remaining[v] == 0 && !live_out[v])
+                st.holder[reg] = -1;
+        }
+    };
+    // whether the rest of the run still fits in the registers in its own order
+    auto completes = [&](RegState st) {
+        for (int i = 0; i < n; ++i) {
+            if (st.done[i])
+                continue;
+            int reg = pick_reg(st, i);
+            if (reg < 0)
+                return false;
+            issue(st, i, reg);
+        }
+        return true;
+    };
+
+    vector<int> num_preds(n), order, cands;
+    vector<uint64_t> earliest(n, 0);
+    for (int i = 0; i < n; ++i)
+        num_preds[i] = preds[i].size();
+    uint64_t cycle = 0;
+    int next = 0;  // first instruction not issued yet
+    for (int step = 0; step < n; ++step) {
+        while (state.done[next])
+            next++;
+        // operands ready first, then the longest way to the end, then the original order
+        cands.clear();
+        for (int i = next; i < n; ++i) {
+            if (!state.done[i] && num_preds[i] == 0)
+                cands.push_back(i);
+        }
+        sort(cands.begin(), cands.end(), [&](int a, int b) {
+            bool ready_a = earliest[a] <= cycle, ready_b = earliest[b] <= cycle;
+            if (ready_a != ready_b)
+                return ready_a;
+            if (!ready_a && earliest[a] != earliest[b])
+                return earliest[a] < earliest[b];
+            if (prio[a] != prio[b])
+                return prio[a] > prio[b];
+            return a < b;
+        });
+        // issuing the first one in order always leaves a way to finish
+        int best = next;
+        for (int i : cands) {
+            if (i == next)
+                break;
+            int reg = pick_reg(state, i);
+            if (reg < 0)
+                continue;
+            // stores only give registers back
+            if (!run[i].def) {
+                best = i;
+                break;
+            }
+            RegState tried = state;
+            issue(tried, i, reg);
+            if (completes(tried)) {
+                best = i;
+                break;
+            }
+        }
+        int reg = pick_reg(state, best);
+        if (reg < 0)
+            return false;
+        issue(state, best, reg);
+        order.push_back(best);
+        uint64_t at = max(cycle, earliest[best]);
+        cycle = at + 1;
+        for (auto &e : succs[best]) {
+            num_preds[e.to]--;
+            earliest[e.to] = max(earliest[e.to], at + e.latency);
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < n; ++i)
+        changed = changed || order[i] != i;
+    for (size_t id = 0; id < values.size(); ++id)
+        changed = changed || (state.assigned[id] >= 0 && state.assigned[id] != values[id].reg);
+    if (!changed)
+        return false;
+    for (int i : order) {
+        Inst &inst = run[i];
+        bool renamed = false;
+        for (size_t k = 0; k < inst.ops.size(); ++k) {
+            int v = k == 0 && inst.def ? inst.def_value : inst.use_values[k];
+            if (v >= 0 && state.assigned[v] != inst.ops[k].reg) {
+                inst.ops[k].reg = state.assigned[v];
+                renamed = true;
+            }
+        }
+        if (!renamed) {
+            out.push_back(inst.line);
+            continue;
+        }
+        string line = "  " + inst.mnemonic + " ";
+        for (size_t k = 0; k < inst.ops.size(); ++k) {
+            const Operand &op = inst.ops[k];
+            if (k > 0)
+                line += ", ";
+            if (op.mem)
+                line += op.text + "(" + reg_names[op.reg] + ")";
+            else
+                line += op.reg >= 0 ? string(reg_names[op.reg]) : op.text;
+        }
+        out.push_back(line);
+    }
+    return true;
+}
+
+void schedule_code(string &code, const PipelineConfig &timing) {
+    vector<string> out;
+    vector<Inst> run;
+    auto flush = [&]() {
+        if (!schedule_run(run, out)) {
+            for (auto &inst : run)
+                out.push_back(inst.line);
+        }
+        run.clear();
+    };
+    size_t pos = 0;
+    while (pos < code.size()) {
+        size_t end = code.find('\n', pos);
+        if (end == string::npos)
+            end = code.size();
+        string line = code.substr(pos, end - pos);
+        pos = end + 1;
+        // empty lines inside a run are dropped
+        if (trim(line).empty()) {
+            if (run.empty())
+                out.push_back(line);
+            continue;
+        }
+        Inst inst;
+        if (parse_inst(line, inst, timing)) {
+            run.push_back(inst);
+            if ((int)run.size() == MAX_RUN)
+                flush();
+            continue;
+        }
+        flush();
+        out.push_back(line);
+    }
+    flush();
+    code.clear();
+    for (auto &line : out)
+        code += line + "\n";
+}
@@ -0,0 +1,19 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <string>
+#include "sim.h"
+using namespace std;
+
+/*
+ * List scheduling of the generated assembly of a function. Straight-line
+ * runs of code between labels, branches, jumps and calls are reordered so
+ * that independent instructions fill the cycles an in-order core waits
+ * for a load or a multiply / divide, with the latencies of the pipeline
+ * model. The temporaries t0-t6 only carry values inside such a run, so
+ * their values are renamed on the way to free the order from the reuse
+ * of a few registers; what is live at the ends of a run stays in place.
+ */
+void schedule_code(string &code, const PipelineConfig &timing = PipelineConfig());
+
+#endif
@@ -0,0 +1,1168 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include "sim.h"
+using namespace std;
+
+// SysY runtime library, in the order of import_sysy_lib
+static const char *runtime_funcs[] = {"getint", "getch", "getarray", "putint", "putch",
+                                      "putarray", "starttime", "stoptime"};
+const int NUM_RUNTIME_FUNCS = 8;
+
+static const char *reg_names[32] = {"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+                                    "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+                                    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+                                    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+const int RA = 1, SP = 2, GP = 3, A0 = 10, A1 = 11;
+
+// Data sections, laid out in this order so that .sdata and .sbss are together
+enum { SEC_DATA, SEC_SDATA, SEC_SBSS, SEC_BSS, NUM_DATA_SECS, SEC_TEXT = NUM_DATA_SECS };
+
+/* Register number of a name, -1 if it is not a register */
+static int reg_id(const string &name) {
+    for (int i = 0; i < 32; ++i) {
+        if (name == reg_names[i])
+            return i;
+    }
+    if (name == "fp")
+        return 8;
+    if (name.size() >= 2 && name[0] == 'x' && isdigit((unsigned char)name[1])) {
+        int id = atoi(name.c_str() + 1);
+        if (id < 32 && name == "x" + to_string(id))
+            return id;
+    }
+    return -1;
+}
+
+static string trim(const string &s) {
+    size_t b = s.find_first_not_of(" \t\r");
+    if (b == string::npos)
+        return string("");
+    size_t e = s.find_last_not_of(" \t\r");
+    return s.substr(b, e - b + 1);
+}
+
+/* Split operands at top level commas */
+static vector<string> split_operands(const string &s) {
+    vector<string> res;
+    int depth = 0;
+    string curr("");
+    for (char c : s) {
+        if (c == '(')
+            depth++;
+        else if (c == ')')
+            depth--;
+        if (c == ',' && depth == 0) {
+            res.push_back(trim(curr));
+            curr.clear();
+        } else {
+            curr += c;
+        }
+    }
+    curr = trim(curr);
+    if (!curr.empty())
+        res.push_back(curr);
+    return res;
+}
+
+static bool is_symbol_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+/*
+ * Assembler state: symbols and the evaluation of operand expressions,
+ * which are sums of numbers and symbols, %hi() and %lo().
+ */
+struct Assembler {
+    struct Symbol {
+        int section;      // SEC_TEXT or a data section
+        uint32_t offset;  // instruction index in text, byte offset in data
+    };
+    unordered_map<string, Symbol> symbols;
+    uint32_t sec_base[NUM_DATA_SECS];  // address of each data section
+    uint32_t global_pointer = 0;
+    bool resolved = false;  // addresses are known
+    string error;
+    // small data symbols the linker reaches from gp, their lui is relaxed away
+    unordered_set<string> gp_symbols;
+
+    uint32_t address(const Symbol &sym) const {
+        if (sym.section == SEC_TEXT)
+            return SIM_TEXT_BASE + 4 * sym.offset;
+        return sec_base[sym.section] + sym.offset;
+    }
+
+    // Value of an expression; before layout symbols count as unknown
+    bool eval(const string &expr, int64_t &val, bool &known) {
+        size_t pos = 0;
+        known = true;
+        return eval_sum(trim(expr), pos, val, known) && pos == trim(expr).size();
+    }
+
+    bool eval_sum(const string &s, size_t &pos, int64_t &val, bool &known) {
+        val = 0;
+        int sign = 1;
+        while (true) {
+            while (pos < s.size() && s[pos] == ' ')
+                pos++;
+            int64_t term;
+            if (!eval_term(s, pos, term, known))
+                return false;
+            val += sign * term;
+            while (pos < s.size() && s[pos] == ' ')
+                pos++;
+            if (pos < s.size() && (s[pos] == '+' || s[pos] == '-')) {
+                sign = s[pos] == '+' ? 1 : -1;
+                pos++;
+                continue;
+            }
+            return true;
+        }
+    }
+
+    bool eval_term(const string &s, size_t &pos, int64_t &val, bool &known) {
+        if (pos >= s.size())
+            return false;
+        if (s[pos] == '-') {
+            pos++;
+            if (!eval_term(s, pos, val, known))
+                return false;
+            val = -val;
+            return true;
+        }
+        if (s[pos] == '(') {
+            pos++;
+            if (!eval_sum(s, pos, val, known) || pos >= s.size() || s[pos] != ')')
+                return false;
+            pos++;
+            return true;
+        }
+        if (s[pos] == '%') {
+            size_t open = s.find('(', pos);
+            if (open == string::npos)
+                return false;
+            string func = s.substr(pos + 1, open - pos - 1);
+            pos = open + 1;
+            int64_t inner;
+            if (!eval_sum(s, pos, inner, known) || pos >= s.size() || s[pos] != ')')
+                return false;
+            pos++;
+            int64_t hi = ((inner + 0x800) >> 12) & 0xfffff;
+            if (func == "hi")
+                val = hi;
+            else if (func == "lo")
+                val = int32_t(uint32_t(inner) - (uint32_t(hi) << 12));
+            else
+                return false;
+            return true;
+        }
+        if (isdigit((unsigned char)s[pos])) {
+            char *end;
+            val = strtoll(s.c_str() + pos, &end, 0);
+            pos = end - s.c_str();
+            return true;
+        }
+        size_t start = pos;
+        while (pos < s.size() && is_symbol_char(s[pos]))
+            pos++;
+        if (start == pos)
+            return false;
+        string name = s.substr(start, pos - start);
+        val = 0;
+        if (name == "__global_pointer$") {
+            val = global_pointer;
+            known = known && resolved;
+            return true;
+        }
+        auto it = symbols.find(name);
+        if (it == symbols.end()) {
+            if (resolved) {
+                error = "undefined symbol " + name;
+                return false;
+            }
+            known = false;
+            return true;
+        }
+        if (!resolved) {
+            known = false;
+            return true;
+        }
+        val = address(it->second);
+        return true;
+    }
+};
+
+// An instruction waiting for symbols to be laid out
+struct PendingInst {
+    string mnemonic;
+    vector<string> ops;
+    int line;
+    uint32_t index;  // of its first instruction
+    uint32_t size;   // number of instructions it expands to
+};
+
+// A .word whose value is only known after layout
+struct PendingWord {
+    int section;
+    uint32_t offset;
+    string expr;
+    int line;
+};
+
+/* Number of instructions a li expands to */
+static int li_size(int64_t val) {
+    int32_t v = int32_t(val);
+    if (v >= -2048 && v < 2048)
+        return 1;
+    return (v & 0xfff) == 0 ? 1 : 2;
+}
+
+/* Symbol of "%hi(sym+off)", "%lo(sym+off)" or "sym+off", empty if there is none */
+static string base_symbol(const string &expr, const string &func) {
+    string e = trim(expr);
+    if (!func.empty()) {
+        string prefix = "%" + func + "(";
+        if (e.compare(0, prefix.size(), prefix) != 0 || e.back() != ')')
+            return string("");
+        e = trim(e.substr(prefix.size(), e.size() - prefix.size() - 1));
+    }
+    size_t i = 0;
+    while (i < e.size() && is_symbol_char(e[i]))
+        i++;
+    if (i == 0 || isdigit((unsigned char)e[0]))
+        return string("");
+    return e.substr(0, i);
+}
+
+/*
+ * Linker relaxation of small data: a symbol of .sdata / .sbss within reach
+ * of gp (which points 0x800 into .sdata) is accessed off gp, dropping the
+ * lui of %hi / %lo pairs and the auipc of la. Decided when the symbol is
+ * first referenced, so the data should come before the code as we emit it.
+ */
+static bool gp_relative(Assembler &as, const string &name, const vector<uint8_t> *secs) {
+    if (name.empty())
+        return false;
+    if (as.gp_symbols.count(name))
+        return true;
+    auto it = as.symbols.find(name);
+    if (it == as.symbols.end())
+        return false;
+    const auto &sym = it->second;
+    int64_t from_gp;
+    if (sym.section == SEC_SDATA)
+        from_gp = int64_t(sym.offset) - 0x800;
+    else if (sym.section == SEC_SBSS)
+        from_gp = int64_t((secs[SEC_SDATA].size() + 15) & ~size_t(15)) + sym.offset - 0x800;
+    else
+        return false;
+    // with some margin for offsets added to the symbol
+    if (from_gp < -2048 || from_gp + 64 >= 2048)
+        return false;
+    as.gp_symbols.insert(name);
+    return true;
+}
+
+/* Number of real instructions an assembly instruction expands to */
+static int inst_size(Assembler &as, const string &mnemonic, const vector<string> &ops,
+                     const vector<uint8_t> *secs) {
+    if (mnemonic == "la")
+        return ops.size() == 2 && gp_relative(as, base_symbol(ops[1], ""), secs) ? 1 : 2;
+    if (mnemonic == "lui" && ops.size() == 2 && gp_relative(as, base_symbol(ops[1], "hi"), secs))
+        return 0;
+    if (mnemonic == "li" && ops.size() == 2) {
+        int64_t val;
+        bool known;
+        if (!as.eval(ops[1], val, known) || !known)
+            return 2;
+        return li_size(val);
+    }
+    return 1;
+}
+
+bool PipelineConfig::parse(const string &spec, string &error) {
+    struct Field {
+        const char *key;
+        unsigned *val;
+    } fields[] = {
+        {"alu", &alu_latency}, {"load", &load_latency}, {"mul", &mul_latency},
+        {"div", &div_latency}, {"taken", &taken_penalty}, {"mispredict", &mispredict_penalty},
+        {"bht", &bht_entries}, {"btb", &btb_entries}, {"ras", &ras_entries},
+        {"dcache", &dcache_bytes}, {"line", &dcache_line}, {"ways", &dcache_ways},
+        {"miss", &miss_penalty}};
+    for (auto &item : split_operands(spec)) {
+        size_t eq = item.find('=');
+        string key = trim(item.substr(0, eq));
+        bool found = false;
+        for (auto &field : fields) {
+            if (key == field.key && eq != string::npos) {
+                *field.val = strtoul(item.c_str() + eq + 1, nullptr, 0);
+                found = true;
+            }
+        }
+        if (!found) {
+            error = "unknown pipeline parameter " + item;
+            return false;
+        }
+    }
+    if (bht_entries == 0) {
+        error = "bht must not be empty";
+        return false;
+    }
+    if (dcache_bytes && (dcache_line == 0 || dcache_ways == 0 ||
+                         dcache_bytes % (dcache_line * dcache_ways) != 0)) {
+        error = "dcache must hold a whole number of sets";
+        return false;
+    }
+    return true;
+}
+
+Simulator::Simulator() {
+    memset(regs, 0, sizeof(regs));
+}
+
+bool Simulator::load(const string &assembly, string &error) {
+    Assembler as;
+    vector<PendingInst> pending;
+    vector<PendingWord> words;
+    vector<uint8_t> secs[NUM_DATA_SECS];
+    int section = SEC_TEXT;
+    uint32_t num_insts = 0;
+    size_t pos = 0;
+    int line_no = 0;
+    auto fail = [&](int line, const string &msg) {
+        error = "line " + to_string(line) + ": " + msg;
+        return false;
+    };
+    auto append = [&](uint32_t bytes) {
+        secs[section].resize(secs[section].size() + bytes, 0);
+    };
+
+    // Pass 1: collect symbols, data and instruction sizes
+    while (pos < assembly.size()) {
+        size_t end = assembly.find('\n', pos);
+        if (end == string::npos)
+            end = assembly.size();
+        string line = assembly.substr(pos, end - pos);
+        pos = end + 1;
+        line_no++;
+        size_t comment = line.find('#');
+        if (comment != string::npos)
+            line = line.substr(0, comment);
+        line = trim(line);
+        // labels
+        while (!line.empty()) {
+            size_t i = 0;
+            while (i < line.size() && is_symbol_char(line[i]))
+                i++;
+            if (i == 0 || i >= line.size() || line[i] != ':')
+                break;
+            string name = line.substr(0, i);
+            if (as.symbols.count(name))
+                return fail(line_no, "duplicate label " + name);
+            Assembler::Symbol sym;
+            sym.section = section;
+            sym.offset = section == SEC_TEXT ? num_insts : secs[section].size();
+            as.symbols[name] = sym;
+            if (section == SEC_TEXT && name[0] != '.') {
+                func_names.push_back(name);
+                func_starts.push_back(num_insts);
+            }
+            line = trim(line.substr(i + 1));
+        }
+        if (line.empty())
+            continue;
+        size_t split = line.find_first_of(" \t");
+        string mnemonic = line.substr(0, split);
+        string rest = split == string::npos ? string("") : trim(line.substr(split));
+        vector<string> ops = split_operands(rest);
+
+        if (mnemonic[0] == '.') {
+            string dir = mnemonic;
+            if (dir == ".section" && !ops.empty()) {
+                dir = ops[0];
+                if (dir.compare(0, 6, ".text.") == 0)
+                    dir = ".text";
+            }
+            if (dir == ".text") {
+                section = SEC_TEXT;
+            } else if (dir == ".data" || dir == ".rodata") {
+                section = SEC_DATA;
+            } else if (dir == ".sdata") {
+                section = SEC_SDATA;
+            } else if (dir == ".sbss") {
+                section = SEC_SBSS;
+            } else if (dir == ".bss") {
+                section = SEC_BSS;
+            } else if (dir == ".word" || dir == ".half" || dir == ".byte" ||
+                       dir == ".zero" || dir == ".space" || dir == ".align" ||
+                       dir == ".p2align" || dir == ".balign") {
+                if (section == SEC_TEXT) {
+                    if (dir == ".align" || dir == ".p2align" || dir == ".balign")
+                        continue;
+                    return fail(line_no, "data in .text");
+                }
+                if (dir == ".word" || dir == ".half" || dir == ".byte") {
+                    uint32_t size = dir == ".word" ? 4 : dir == ".half" ? 2 : 1;
+                    for (auto &op : ops) {
+                        PendingWord word;
+                        word.section = section;
+                        word.offset = secs[section].size();
+                        word.expr = op;
+                        word.line = line_no;
+                        append(size);
+                        int64_t val;
+                        bool known;
+                        if (!as.eval(op, val, known))
+                            return fail(line_no, "bad expression " + op);
+                        if (known) {
+                            for (uint32_t b = 0; b < size; ++b)
+                                secs[section][word.offset + b] = uint8_t(val >> (8 * b));
+                        } else {
+                            if (size != 4)
+                                return fail(line_no, "symbol in a narrow data word");
+                            words.push_back(word);
+                        }
+                    }
+                } else {
+                    int64_t val;
+                    bool known;
+                    if (ops.empty() || !as.eval(ops[0], val, known) || !known || val < 0)
+                        return fail(line_no, "bad operand of " + dir);
+                    if (dir == ".zero" || dir == ".space") {
+                        append(val);
+                    } else {
+                        uint32_t align = dir == ".balign" ? val : 1u << val;
+                        if (align == 0)
+                            align = 1;
+                        while (secs[section].size() % align)
+                            append(1);
+                    }
+                }
+            }
+            // .globl, .type, .size, .option and the like do not matter here
+            continue;
+        }
+        if (section != SEC_TEXT)
+            return fail(line_no, "instruction outside .text");
+        PendingInst inst;
+        inst.mnemonic = mnemonic;
+        inst.ops = ops;
+        inst.line = line_no;
+        inst.index = num_insts;
+        inst.size = inst_size(as, mnemonic, ops, secs);
+        pending.push_back(inst);
+        num_insts += inst.size;
+    }
+
+    // The runtime library follows the program, one instruction per function
+    uint32_t runtime_base = num_insts;
+    for (int i = 0; i < NUM_RUNTIME_FUNCS; ++i) {
+        if (!as.symbols.count(runtime_funcs[i])) {
+            Assembler::Symbol sym;
+            sym.section = SEC_TEXT;
+            sym.offset = runtime_base + i;
+            as.symbols[runtime_funcs[i]] = sym;
+        }
+        func_names.push_back(runtime_funcs[i]);
+        func_starts.push_back(runtime_base + i);
+    }
+    num_insts += NUM_RUNTIME_FUNCS;
+
+    // Layout: data starts on the page after the text
+    data_base = (SIM_TEXT_BASE + 4 * num_insts + 0xfff) & ~0xfffu;
+    uint32_t addr = data_base;
+    for (int s = 0; s < NUM_DATA_SECS; ++s) {
+        addr = (addr + 15) & ~15u;
+        as.sec_base[s] = addr;
+        addr += secs[s].size();
+    }
+    as.global_pointer = as.sec_base[SEC_SDATA] + 0x800;
+    as.resolved = true;
+    global_pointer = as.global_pointer;
+    data.assign(addr - data_base, 0);
+    for (int s = 0; s < NUM_DATA_SECS; ++s) {
+        if (!secs[s].empty())
+            memcpy(&data[as.sec_base[s] - data_base], secs[s].data(), secs[s].size());
+    }
+    for (auto &word : words) {
+        int64_t val;
+        bool known;
+        if (!as.eval(word.expr, val, known))
+            return fail(word.line, as.error.empty() ? "bad expression " + word.expr : as.error);
+        uint32_t at = as.sec_base[word.section] - data_base + word.offset;
+        for (int b = 0; b < 4; ++b)
+            data[at + b] = uint8_t(val >> (8 * b));
+    }
+
+    // Pass 2: encode instructions
+    text.assign(num_insts, SimInst());
+    for (auto &p : pending) {
+        const string &m = p.mnemonic;
+        const vector<string> &ops = p.ops;
+        uint32_t at = p.index;
+        string msg("");
+        auto reg = [&](size_t i, uint8_t &r) {
+            if (i >= ops.size() || reg_id(ops[i]) < 0) {
+                msg = "expected a register";
+                return false;
+            }
+            r = reg_id(ops[i]);
+            return true;
+        };
+        auto imm = [&](const string &expr, int32_t &v) {
+            int64_t val;
+            bool known;
+            if (!as.eval(expr, val, known)) {
+                msg = as.error.empty() ? "bad expression " + expr : as.error;
+                return false;
+            }
+            v = int32_t(val);
+            return true;
+        };
+        auto target = [&](size_t i, int32_t &v) {
+            if (i >= ops.size()) {
+                msg = "expected a label";
+                return false;
+            }
+            auto it = as.symbols.find(ops[i]);
+            if (it == as.symbols.end() || it->second.section != SEC_TEXT) {
+                msg = "unknown label " + ops[i];
+                return false;
+            }
+            v = it->second.offset;
+            return true;
+        };
+        // "off(reg)" operands
+        auto mem = [&](size_t i, uint8_t &base, int32_t &off) {
+            if (i >= ops.size() || ops[i].empty() || ops[i].back() != ')') {
+                msg = "expected a memory operand";
+                return false;
+            }
+            size_t open = ops[i].rfind('(');
+            string r = ops[i].substr(open + 1, ops[i].size() - open - 2);
+            string o = trim(ops[i].substr(0, open));
+            if (reg_id(r) < 0) {
+                msg = "expected a register";
+                return false;
+            }
+            base = reg_id(r);
+            off = 0;
+            string sym = base_symbol(o, "lo");
+            if (!sym.empty() && as.gp_symbols.count(sym)) {
+                // %lo(sym) off the relaxed lui becomes an offset to gp
+                base = GP;
+                if (!imm(o.substr(4, o.size() - 5) + " - __global_pointer$", off))
+                    return false;
+                if (off < -2048 || off >= 2048) {
+                    msg = sym + " is out of reach of gp";
+                    return false;
+                }
+                return true;
+            }
+            return o.empty() || imm(o, off);
+        };
+        auto emit = [&](SimOp op, uint8_t rd, uint8_t rs1, uint8_t rs2, int32_t v) {
+            SimInst &inst = text[at++];
+            inst.op = op;
+            inst.rd = rd;
+            inst.rs1 = rs1;
+            inst.rs2 = rs2;
+            inst.imm = v;
+            inst.line = p.line;
+        };
+        static const map<string, SimOp> r_ops = {
+            {"add", SimOp::ADD}, {"sub", SimOp::SUB}, {"and", SimOp::AND}, {"or", SimOp::OR},
+            {"xor", SimOp::XOR}, {"sll", SimOp::SLL}, {"srl", SimOp::SRL}, {"sra", SimOp::SRA},
+            {"slt", SimOp::SLT}, {"sltu", SimOp::SLTU}, {"mul", SimOp::MUL},
+            {"mulh", SimOp::MULH}, {"mulhu", SimOp::MULHU}, {"div", SimOp::DIV},
+            {"divu", SimOp::DIVU}, {"rem", SimOp::REM}, {"remu", SimOp::REMU}};
+        static const map<string, SimOp> i_ops = {
+            {"addi", SimOp::ADDI}, {"andi", SimOp::ANDI}, {"ori", SimOp::ORI},
+            {"xori", SimOp::XORI}, {"slli", SimOp::SLLI}, {"srli", SimOp::SRLI},
+            {"srai", SimOp::SRAI}, {"slti", SimOp::SLTI}, {"sltiu", SimOp::SLTIU}};
+        static const map<string, SimOp> load_ops = {
+            {"lw", SimOp::LW}, {"lh", SimOp::LH}, {"lhu", SimOp::LHU}, {"lb", SimOp::LB},
+            {"lbu", SimOp::LBU}};
+        static const map<string, SimOp> store_ops = {
+            {"sw", SimOp::SW}, {"sh", SimOp::SH}, {"sb", SimOp::SB}};
+        static const map<string, SimOp> branch_ops = {
+            {"beq", SimOp::BEQ}, {"bne", SimOp::BNE}, {"blt", SimOp::BLT},
+            {"bge", SimOp::BGE}, {"bltu", SimOp::BLTU}, {"bgeu", SimOp::BGEU}};
+        // branches on swapped operands: bgt a, b is blt b, a
+        static const map<string, SimOp> swapped_branch_ops = {
+            {"bgt", SimOp::BLT}, {"ble", SimOp::BGE}, {"bgtu", SimOp::BLTU},
+            {"bleu", SimOp::BGEU}};
+        // branches comparing with zero: (op, register is rs1)
+        static const map<string, pair<SimOp, bool>> zero_branch_ops = {
+            {"beqz", {SimOp::BEQ, true}}, {"bnez", {SimOp::BNE, true}},
+            {"bltz", {SimOp::BLT, true}}, {"bgez", {SimOp::BGE, true}},
+            {"bgtz", {SimOp::BLT, false}}, {"blez", {SimOp::BGE, false}}};
+
+        uint8_t rd = 0, rs1 = 0, rs2 = 0;
+        int32_t v = 0;
+        bool ok = true;
+        if (r_ops.count(m)) {
+            ok = reg(0, rd) && reg(1, rs1) && reg(2, rs2);
+            if (ok)
+                emit(r_ops.at(m), rd, rs1, rs2, 0);
+        } else if (i_ops.count(m)) {
+            ok = reg(0, rd) && reg(1, rs1) && ops.size() == 3 && imm(ops[2], v);
+            if (ok)
+                emit(i_ops.at(m), rd, rs1, 0, v);
+        } else if (load_ops.count(m)) {
+            ok = reg(0, rd) && mem(1, rs1, v);
+            if (ok)
+                emit(load_ops.at(m), rd, rs1, 0, v);
+        } else if (store_ops.count(m)) {
+            ok = reg(0, rs2) && mem(1, rs1, v);
+            if (ok)
+                emit(store_ops.at(m), 0, rs1, rs2, v);
+        } else if (branch_ops.count(m)) {
+            ok = reg(0, rs1) && reg(1, rs2) && target(2, v);
+            if (ok)
+                emit(branch_ops.at(m), 0, rs1, rs2, v);
+        } else if (swapped_branch_ops.count(m)) {
+            ok = reg(0, rs2) && reg(1, rs1) && target(2, v);
+            if (ok)
+                emit(swapped_branch_ops.at(m), 0, rs1, rs2, v);
+        } else if (zero_branch_ops.count(m)) {
+            auto op = zero_branch_ops.at(m);
+            ok = reg(0, op.second ? rs1 : rs2) && target(1, v);
+            if (ok)
+                emit(op.first, 0, rs1, rs2, v);
+        } else if (m == "lui" || m == "auipc") {
+            ok = reg(0, rd) && ops.size() == 2 && imm(ops[1], v);
+            if (ok && p.size == 1)
+                emit(m == "lui" ? SimOp::LUI : SimOp::AUIPC, rd, 0, 0, v);
+        } else if (m == "li") {
+            ok = reg(0, rd) && ops.size() == 2 && imm(ops[1], v);
+            if (ok) {
+                // lui of the upper bits, then addi of the sign extended lower 12
+                int32_t lo = int32_t(uint32_t(v) << 20) >> 20;
+                int32_t hi = int32_t((uint32_t(v) - uint32_t(lo)) >> 12) & 0xfffff;
+                if (p.size == 1 && lo == v) {
+                    emit(SimOp::ADDI, rd, 0, 0, v);
+                } else {
+                    emit(SimOp::LUI, rd, 0, 0, hi);
+                    if (p.size == 2)
+                        emit(SimOp::ADDI, rd, rd, 0, lo);
+                }
+            }
+        } else if (m == "la" && p.size == 1) {
+            ok = reg(0, rd) && ops.size() == 2 && imm(ops[1] + " - __global_pointer$", v);
+            if (ok && (v < -2048 || v >= 2048)) {
+                ok = false;
+                msg = ops[1] + " is out of reach of gp";
+            }
+            if (ok)
+                emit(SimOp::ADDI, rd, GP, 0, v);
+        } else if (m == "la") {
+            ok = reg(0, rd) && ops.size() == 2 && imm("%hi(" + ops[1] + ")", v);
+            if (ok) {
+                emit(SimOp::LUI, rd, 0, 0, v);
+                ok = imm("%lo(" + ops[1] + ")", v);
+                emit(SimOp::ADDI, rd, rd, 0, v);
+            }
+        } else if (m == "mv") {
+            ok = reg(0, rd) && reg(1, rs1);
+            if (ok)
+                emit(SimOp::ADDI, rd, rs1, 0, 0);
+        } else if (m == "not") {
+            ok = reg(0, rd) && reg(1, rs1);
+            if (ok)
+                emit(SimOp::XORI, rd, rs1, 0, -1);
+        } else if (m == "neg") {
+            ok = reg(0, rd) && reg(1, rs2);
+            if (ok)
+                emit(SimOp::SUB, rd, 0, rs2, 0);
+        } else if (m == "seqz") {
+            ok = reg(0, rd) && reg(1, rs1);
+            if (ok)
+                emit(SimOp::SLTIU, rd, rs1, 0, 1);
+        } else if (m == "snez") {
+            ok = reg(0, rd) && reg(1, rs2);
+            if (ok)
+                emit(SimOp::SLTU, rd, 0, rs2, 0);
+        } else if (m == "sltz") {
+            ok = reg(0, rd) && reg(1, rs1);
+            if (ok)
+                emit(SimOp::SLT, rd, rs1, 0, 0);
+        } else if (m == "sgtz") {
+            ok = reg(0, rd) && reg(1, rs2);
+            if (ok)
+                emit(SimOp::SLT, rd, 0, rs2, 0);
+        } else if (m == "sgt" || m == "sgtu") {
+            ok = reg(0, rd) && reg(1, rs2) && reg(2, rs1);
+            if (ok)
+                emit(m == "sgt" ? SimOp::SLT : SimOp::SLTU, rd, rs1, rs2, 0);
+        } else if (m == "nop") {
+            emit(SimOp::ADDI, 0, 0, 0, 0);
+        } else if (m == "j" || m == "tail") {
+            ok = target(0, v);
+            if (ok)
+                emit(SimOp::JAL, 0, 0, 0, v);
+        } else if (m == "call") {
+            // a linker relaxes calls to one jal
+            ok = target(0, v);
+            if (ok)
+                emit(SimOp::JAL, RA, 0, 0, v);
+        } else if (m == "jal") {
+            if (ops.size() == 1) {
+                ok = target(0, v);
+                rd = RA;
+            } else {
+                ok = reg(0, rd) && target(1, v);
+            }
+            if (ok)
+                emit(SimOp::JAL, rd, 0, 0, v);
+        } else if (m == "jr") {
+            ok = reg(0, rs1);
+            if (ok)
+                emit(SimOp::JALR, 0, rs1, 0, 0);
+        } else if (m == "ret") {
+            emit(SimOp::JALR, 0, RA, 0, 0);
+        } else if (m == "jalr") {
+            if (ops.size() == 1) {
+                ok = reg(0, rs1);
+                rd = RA;
+            } else if (ops.size() == 2) {
+                ok = reg(0, rd) && mem(1, rs1, v);
+            } else {
+                ok = reg(0, rd) && reg(1, rs1) && imm(ops[2], v);
+            }
+            if (ok)
+                emit(SimOp::JALR, rd, rs1, 0, v);
+        } else {
+            return fail(p.line, "unknown instruction " + m);
+        }
+        if (!ok)
+            return fail(p.line, msg);
+    }
+    for (int i = 0; i < NUM_RUNTIME_FUNCS; ++i) {
+        text[runtime_base + i].op = SimOp::RUNTIME;
+        text[runtime_base + i].imm = i;
+    }
+
+    // Function of each instruction, for per function counts
+    func_of_inst.assign(num_insts, 0);
+    for (size_t f = 0; f < func_starts.size(); ++f) {
+        uint32_t end = f + 1 < func_starts.size() ? func_starts[f + 1] : num_insts;
+        for (uint32_t i = func_starts[f]; i < end; ++i)
+            func_of_inst[i] = f;
+    }
+    auto main_sym = as.symbols.find("main");
+    if (main_sym == as.symbols.end() || main_sym->second.section != SEC_TEXT)
+        return fail(line_no, "no main function");
+    entry = main_sym->second.offset;
+    return true;
+}
+
+/* Check a data access, stopping the run if it is out of memory or misaligned */
+bool Simulator::check_addr(uint32_t addr, uint32_t size, int32_t pc) {
+    if (addr >= data_base && addr - data_base + size <= mem.size() && addr % size == 0)
+        return true;
+    char msg[128];
+    snprintf(msg, sizeof(msg), "bad memory access of %u bytes at 0x%x, line %d",
+             size, addr, text[pc].line);
+    run_error = msg;
+    return false;
+}
+
+/* Access the data cache, true on a hit */
+bool Simulator::dcache_access(uint32_t addr) {
+    sim_stats.dcache_accesses++;
+    if (timing.dcache_bytes == 0)
+        return true;
+    uint32_t line = addr / timing.dcache_line;
+    uint32_t num_sets = timing.dcache_bytes / (timing.dcache_line * timing.dcache_ways);
+    uint32_t base = (line % num_sets) * timing.dcache_ways;
+    uint32_t victim = base;
+    dcache_clock++;
+    for (uint32_t w = base; w < base + timing.dcache_ways; ++w) {
+        if (dcache_tags[w] == line + 1) {
+            dcache_used[w] = dcache_clock;
+            return true;
+        }
+        if (dcache_used[w] < dcache_used[victim])
+            victim = w;
+    }
+    sim_stats.dcache_misses++;
+    dcache_tags[victim] = line + 1;
+    dcache_used[victim] = dcache_clock;
+    return false;
+}
+
+/* Predict the target of a jalr by the return address stack or the BTB, true if right */
+bool Simulator::predict_indirect(int32_t pc, const SimInst &inst, int32_t target) {
+    bool is_return = inst.rd == 0 && inst.rs1 == RA && inst.imm == 0;
+    if (is_return && !ras.empty()) {
+        int32_t predicted = ras.back();
+        ras.pop_back();
+        return predicted == target;
+    }
+    bool hit = false;
+    if (!btb.empty()) {
+        auto &entry = btb[pc % btb.size()];
+        hit = entry.first == uint32_t(pc) + 1 && entry.second == target;
+        entry = make_pair(uint32_t(pc) + 1, target);
+    }
+    if (inst.rd == RA && timing.ras_entries) {
+        if (ras.size() == timing.ras_entries)
+            ras.erase(ras.begin());
+        ras.push_back(pc + 1);
+    }
+    return hit;
+}
+
+/* Run a SysY library function, false if it faulted */
+bool Simulator::call_runtime(int func, FILE *in, FILE *out) {
+    sim_stats.runtime_calls++;
+    uint32_t *r = regs;
+    switch (func) {
+        case 0: {  // getint
+            int val = 0;
+            if (fscanf(in, "%d", &val) != 1)
+                val = 0;
+            r[A0] = val;
+            break;
+        }
+        case 1:  // getch
+            r[A0] = fgetc(in);
+            break;
+        case 2: {  // getarray
+            int n = 0;
+            if (fscanf(in, "%d", &n) != 1)
+                n = 0;
+            uint32_t addr = r[A0];
+            for (int i = 0; i < n; ++i) {
+                int val = 0;
+                if (fscanf(in, "%d", &val) != 1)
+                    val = 0;
+                if (!check_addr(addr + 4 * i, 4, 0))
+                    return false;
+                memcpy(&mem[addr + 4 * i - data_base], &val, 4);
+            }
+            r[A0] = n;
+            break;
+        }
+        case 3:  // putint
+            fprintf(out, "%d", int32_t(r[A0]));
+            break;
+        case 4:  // putch
+            fputc(int(r[A0]), out);
+            break;
+        case 5: {  // putarray
+            int n = r[A0];
+            uint32_t addr = r[A1];
+            fprintf(out, "%d:", n);
+            for (int i = 0; i < n; ++i) {
+                int32_t val;
+                if (!check_addr(addr + 4 * i, 4, 0))
+                    return false;
+                memcpy(&val, &mem[addr + 4 * i - data_base], 4);
+                fprintf(out, " %d", val);
+            }
+            fputc('\n', out);
+            break;
+        }
+        case 6:  // starttime
+            timer_start = sim_stats.insts;
+            break;
+        case 7:  // stoptime
+            fprintf(stderr, "Timer: %llu instructions\n",
+                    (unsigned long long)(sim_stats.insts - timer_start));
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+int Simulator::run(FILE *in, FILE *out) {
+    sim_stats = SimStats();
+    sim_stats.func_insts.assign(func_names.size(), 0);
+    sim_stats.func_cycles.assign(func_names.size(), 0);
+    run_error.clear();
+    mem.assign(data.size() + stack_size, 0);
+    memcpy(mem.data(), data.data(), data.size());
+    memset(regs, 0, sizeof(regs));
+    const uint32_t exit_addr = SIM_TEXT_BASE - 4;
+    const int32_t exit_pc = -1;
+    regs[SP] = (data_base + mem.size()) & ~15u;
+    regs[RA] = exit_addr;
+    regs[GP] = global_pointer;
+
+    // pipeline model
+    const PipelineConfig &t = timing;
+    bht.assign(t.bht_entries, 1);
+    btb.assign(t.btb_entries, make_pair(0u, 0));
+    ras.clear();
+    uint32_t dcache_entries = t.dcache_bytes ? t.dcache_bytes / t.dcache_line : 0;
+    dcache_tags.assign(dcache_entries, 0);
+    dcache_used.assign(dcache_entries, 0);
+    dcache_clock = 0;
+    uint64_t cycle = 0;
+    uint64_t reg_ready[32] = {0};  // cycle from which each register can be read
+
+    uint32_t *r = regs;
+    int32_t pc = entry;
+    int32_t num_insts = text.size();
+    while (true) {
+        if (pc == exit_pc)
+            return r[A0] & 0xff;
+        if (pc < 0 || pc >= num_insts) {
+            run_error = "jump out of the program";
+            break;
+        }
+        const SimInst &inst = text[pc];
+        int32_t next = pc + 1;
+        if (inst.op == SimOp::RUNTIME) {
+            // library calls are free, they return like a leaf function
+            if (!call_runtime(inst.imm, in, out))
+                return -1;
+            uint32_t ret_addr = r[RA];
+            if (t.ras_entries && !ras.empty())
+                ras.pop_back();
+            pc = ret_addr == exit_addr ? exit_pc : int32_t(ret_addr - SIM_TEXT_BASE) / 4;
+            continue;
+        }
+        sim_stats.insts++;
+        // issue once the operands are ready, unused operands are x0
+        uint64_t issue = max(cycle, max(reg_ready[inst.rs1], reg_ready[inst.rs2]));
+        sim_stats.stall_cycles += issue - cycle;
+        unsigned latency = t.alu_latency;
+        uint64_t penalty = 0;
+
+        uint32_t a = r[inst.rs1], b = r[inst.rs2];
+        uint32_t res = 0;
+        bool write = true;
+        switch (inst.op) {
+            case SimOp::ADD: res = a + b; break;
+            case SimOp::SUB: res = a - b; break;
+            case SimOp::AND: res = a & b; break;
+            case SimOp::OR: res = a | b; break;
+            case SimOp::XOR: res = a ^ b; break;
+            case SimOp::SLL: res = a << (b & 31); break;
+            case SimOp::SRL: res = a >> (b & 31); break;
+            case SimOp::SRA: res = int32_t(a) >> (b & 31); break;
+            case SimOp::SLT: res = int32_t(a) < int32_t(b); break;
+            case SimOp::SLTU: res = a < b; break;
+            case SimOp::MUL:
+                res = a * b;
+                latency = t.mul_latency;
+                break;
+            case SimOp::MULH:
+                res = uint32_t((int64_t(int32_t(a)) * int32_t(b)) >> 32);
+                latency = t.mul_latency;
+                break;
+            case SimOp::MULHU:
+                res = uint32_t((uint64_t(a) * b) >> 32);
+                latency = t.mul_latency;
+                break;
+            case SimOp::DIV:
+                if (b == 0)
+                    res = uint32_t(-1);
+                else if (a == 0x80000000u && b == uint32_t(-1))
+                    res = a;
+                else
+                    res = int32_t(a) / int32_t(b);
+                latency = t.div_latency;
+                break;
+            case SimOp::DIVU:
+                res = b ? a / b : uint32_t(-1);
+                latency = t.div_latency;
+                break;
+            case SimOp::REM:
+                if (b == 0)
+                    res = a;
+                else if (a == 0x80000000u && b == uint32_t(-1))
+                    res = 0;
+                else
+                    res = int32_t(a) % int32_t(b);
+                latency = t.div_latency;
+                break;
+            case SimOp::REMU:
+                res = b ? a % b : a;
+                latency = t.div_latency;
+                break;
+            case SimOp::ADDI: res = a + inst.imm; break;
+            case SimOp::ANDI: res = a & inst.imm; break;
+            case SimOp::ORI: res = a | inst.imm; break;
+            case SimOp::XORI: res = a ^ inst.imm; break;
+            case SimOp::SLLI: res = a << (inst.imm & 31); break;
+            case SimOp::SRLI: res = a >> (inst.imm & 31); break;
+            case SimOp::SRAI: res = int32_t(a) >> (inst.imm & 31); break;
+            case SimOp::SLTI: res = int32_t(a) < inst.imm; break;
+            case SimOp::SLTIU: res = a < uint32_t(inst.imm); break;
+            case SimOp::LUI: res = uint32_t(inst.imm) << 12; break;
+            case SimOp::AUIPC: res = SIM_TEXT_BASE + 4 * pc + (uint32_t(inst.imm) << 12); break;
+            case SimOp::LW:
+            case SimOp::LH:
+            case SimOp::LHU:
+            case SimOp::LB:
+            case SimOp::LBU: {
+                uint32_t addr = a + inst.imm;
+                uint32_t size = inst.op == SimOp::LW ? 4 :
+                                (inst.op == SimOp::LH || inst.op == SimOp::LHU) ? 2 : 1;
+                if (!check_addr(addr, size, pc))
+                    return -1;
+                const uint8_t *p = &mem[addr - data_base];
+                if (inst.op == SimOp::LW) {
+                    memcpy(&res, p, 4);
+                } else if (size == 2) {
+                    uint16_t h;
+                    memcpy(&h, p, 2);
+                    res = inst.op == SimOp::LH ? uint32_t(int32_t(int16_t(h))) : h;
+                } else {
+                    res = inst.op == SimOp::LB ? uint32_t(int32_t(int8_t(*p))) : *p;
+                }
+                sim_stats.loads++;
+                latency = t.load_latency;
+                if (!dcache_access(addr))
+                    penalty += t.miss_penalty;
+                break;
+            }
+            case SimOp::SW:
+            case SimOp::SH:
+            case SimOp::SB: {
+                uint32_t addr = a + inst.imm;
+                uint32_t size = inst.op == SimOp::SW ? 4 : inst.op == SimOp::SH ? 2 : 1;
+                if (!check_addr(addr, size, pc))
+                    return -1;
+                memcpy(&mem[addr - data_base], &b, size);
+                sim_stats.stores++;
+                // write allocate
+                if (!dcache_access(addr))
+                    penalty += t.miss_penalty;
+                write = false;
+                break;
+            }
+            case SimOp::BEQ:
+            case SimOp::BNE:
+            case SimOp::BLT:
+            case SimOp::BGE:
+            case SimOp::BLTU:
+            case SimOp::BGEU: {
+                bool taken = false;
+                switch (inst.op) {
+                    case SimOp::BEQ: taken = a == b; break;
+                    case SimOp::BNE: taken = a != b; break;
+                    case SimOp::BLT: taken = int32_t(a) < int32_t(b); break;
+                    case SimOp::BGE: taken = int32_t(a) >= int32_t(b); break;
+                    case SimOp::BLTU: taken = a < b; break;
+                    default: taken = a >= b; break;
+                }
+                sim_stats.branches++;
+                uint8_t &counter = bht[pc % bht.size()];
+                if ((counter >= 2) != taken) {
+                    sim_stats.mispredicts++;
+                    penalty += t.mispredict_penalty;
+                } else if (taken) {
+                    penalty += t.taken_penalty;
+                }
+                if (taken && counter < 3)
+                    counter++;
+                else if (!taken && counter > 0)
+                    counter--;
+                if (taken) {
+                    sim_stats.taken_branches++;
+                    next = inst.imm;
+                }
+                write = false;
+                break;
+            }
+            case SimOp::JAL:
+                res = SIM_TEXT_BASE + 4 * next;
+                next = inst.imm;
+                sim_stats.jumps++;
+                penalty += t.taken_penalty;
+                if (inst.rd == RA && t.ras_entries) {
+                    if (ras.size() == t.ras_entries)
+                        ras.erase(ras.begin());
+                    ras.push_back(pc + 1);
+                }
+                break;
+            case SimOp::JALR: {
+                uint32_t addr = (a + inst.imm) & ~1u;
+                res = SIM_TEXT_BASE + 4 * next;
+                sim_stats.jumps++;
+                if (addr == exit_addr) {
+                    next = exit_pc;
+                } else if (addr < SIM_TEXT_BASE || addr % 4) {
+                    run_error = "bad jump target, line " + to_string(inst.line);
+                    return -1;
+                } else {
+                    next = (addr - SIM_TEXT_BASE) / 4;
+                }
+                if (predict_indirect(pc, inst, next)) {
+                    penalty += t.taken_penalty;
+                } else {
+                    sim_stats.mispredicts++;
+                    penalty += t.mispredict_penalty;
+                }
+                break;
+            }
+            case SimOp::RUNTIME:
+                break;
+        }
+        if (write && inst.rd) {
+            r[inst.rd] = res;
+            reg_ready[inst.rd] = issue + penalty + latency;
+        }
+        uint64_t end_cycle = issue + 1 + penalty;
+        sim_stats.func_insts[func_of_inst[pc]]++;
+        sim_stats.func_cycles[func_of_inst[pc]] += end_cycle - cycle;
+        cycle = end_cycle;
+        sim_stats.cycles = cycle;
+        if (max_insts && sim_stats.insts >= max_insts) {
+            run_error = "instruction limit reached";
+            return -1;
+        }
+        pc = next;
+    }
+    return -1;
+}
+
+string Simulator::report() const {
+    string res("");
+    char line[256];
+    auto row = [&](const char *name, uint64_t val) {
+        snprintf(line, sizeof(line), "%-24s %14llu\n", name, (unsigned long long)val);
+        res += line;
+    };
+    row("instructions", sim_stats.insts);
+    row("loads", sim_stats.loads);
+    row("stores", sim_stats.stores);
+    row("branches", sim_stats.branches);
+    row("taken branches", sim_stats.taken_branches);
+    row("jumps", sim_stats.jumps);
+    row("runtime calls", sim_stats.runtime_calls);
+    row("cycles", sim_stats.cycles);
+    row("stall cycles", sim_stats.stall_cycles);
+    row("mispredicts", sim_stats.mispredicts);
+    row("dcache accesses", sim_stats.dcache_accesses);
+    row("dcache misses", sim_stats.dcache_misses);
+    if (sim_stats.insts) {
+        snprintf(line, sizeof(line), "%-24s %14.3f\n", "cycles per instruction",
+                 double(sim_stats.cycles) / sim_stats.insts);
+        res += line;
+    }
+    snprintf(line, sizeof(line), "%-24s %14s %14s\n", "function", "instructions", "cycles");
+    res += line;
+    for (size_t f = 0; f < func_names.size() && f < sim_stats.func_insts.size(); ++f) {
+        if (sim_stats.func_insts[f] == 0)
+            continue;
+        snprintf(line, sizeof(line), "  %-22s %14llu %14llu\n", func_names[f].c_str(),
+                 (unsigned long long)sim_stats.func_insts[f],
+                 (unsigned long long)sim_stats.func_cycles[f]);
+        res += line;
+    }
+    return res;
+}
@@ -0,0 +1,136 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+using namespace std;
+
+/*
+ * RV32IM simulator for the code we emit. It assembles the text of an
+ * assembly file (with the usual pseudo instructions expanded to what an
+ * assembler would produce), provides the SysY runtime library itself and
+ * counts what the program executes, so the quality of generated code can
+ * be measured without a RISC-V toolchain.
+ */
+
+enum class SimOp : uint8_t {
+    // register-register
+    ADD, SUB, AND, OR, XOR, SLL, SRL, SRA, SLT, SLTU,
+    MUL, MULH, MULHU, DIV, DIVU, REM, REMU,
+    // register-immediate
+    ADDI, ANDI, ORI, XORI, SLLI, SRLI, SRAI, SLTI, SLTIU, LUI, AUIPC,
+    // memory
+    LW, LH, LHU, LB, LBU, SW, SH, SB,
+    // control flow
+    BEQ, BNE, BLT, BGE, BLTU, BGEU, JAL, JALR,
+    // call into the SysY runtime, imm is the function
+    RUNTIME,
+};
+
+// One decoded instruction
+struct SimInst {
+    SimOp op;
+    uint8_t rd = 0, rs1 = 0, rs2 = 0;
+    int32_t imm = 0;  // immediate, or target instruction index of branches and jal
+    int line = 0;     // source line, for error messages
+};
+
+/*
+ * Timing of an in-order, single issue pipeline. Every instruction takes
+ * one cycle, plus stalls for operands which are not ready yet, branch and
+ * jump penalties and data cache misses, which block the pipeline.
+ */
+struct PipelineConfig {
+    // cycles until a result can be used by the next instructions
+    unsigned alu_latency = 1;
+    unsigned load_latency = 2;       // one cycle load-use stall
+    unsigned mul_latency = 3;
+    unsigned div_latency = 20;       // div, divu, rem, remu
+    // bubble of a correctly predicted taken branch or jump
+    unsigned taken_penalty = 1;
+    unsigned mispredict_penalty = 3;
+    unsigned bht_entries = 512;      // 2-bit counters of conditional branches
+    unsigned btb_entries = 16;       // targets of indirect jumps, 0 for none
+    unsigned ras_entries = 8;        // return address stack
+    unsigned dcache_bytes = 4096;    // 0 for a perfect cache
+    unsigned dcache_line = 32;
+    unsigned dcache_ways = 2;
+    unsigned miss_penalty = 20;
+
+    // Set fields from "key=value,..." (keys as the fields without units), false on errors
+    bool parse(const string &spec, string &error);
+};
+
+// Counts of what was executed
+struct SimStats {
+    uint64_t insts = 0;           // instructions retired, runtime calls excluded
+    uint64_t loads = 0;
+    uint64_t stores = 0;
+    uint64_t branches = 0;        // conditional branches
+    uint64_t taken_branches = 0;
+    uint64_t jumps = 0;           // jal and jalr, calls and returns included
+    uint64_t runtime_calls = 0;   // calls of SysY library functions
+    vector<uint64_t> func_insts;  // instructions retired in each function
+    // estimates of the pipeline model
+    uint64_t cycles = 0;
+    uint64_t stall_cycles = 0;    // waiting for operands
+    uint64_t mispredicts = 0;     // branches and indirect jumps
+    uint64_t dcache_accesses = 0;
+    uint64_t dcache_misses = 0;
+    vector<uint64_t> func_cycles; // cycles spent in each function
+};
+
+class Simulator {
+public:
+    Simulator();
+    // Assemble a program, false and a message in error if it can not be loaded
+    bool load(const string &assembly, string &error);
+    // Run main, reading and writing through the SysY runtime; returns the exit code
+    int run(FILE *in, FILE *out);
+    // Why the last run stopped early, empty if main returned
+    const string &error() const { return run_error; }
+    const SimStats &stats() const { return sim_stats; }
+    string report() const;
+
+    // Stop after this many instructions, 0 for no limit
+    uint64_t max_insts = 0;
+    // Bytes of stack below the data
+    uint32_t stack_size = 64u << 20;
+    PipelineConfig timing;
+
+private:
+    vector<SimInst> text;
+    vector<uint8_t> data;            // initial contents of the data sections
+    uint32_t data_base = 0;
+    uint32_t global_pointer = 0;
+    vector<string> func_names;       // functions by start, in address order
+    vector<uint32_t> func_starts;    // instruction index of each function
+    vector<uint32_t> func_of_inst;   // function of each instruction
+    int32_t entry = -1;              // instruction index of main
+    vector<uint8_t> mem;
+    uint32_t regs[32];
+    SimStats sim_stats;
+    uint64_t timer_start = 0;        // instructions when starttime was called
+    string run_error;
+
+    // state of the pipeline model
+    vector<uint8_t> bht;
+    vector<pair<uint32_t, int32_t>> btb;  // (pc + 1, target), 0 for empty
+    vector<int32_t> ras;
+    vector<uint32_t> dcache_tags;         // line address + 1, 0 for invalid
+    vector<uint64_t> dcache_used;         // for LRU replacement
+    uint64_t dcache_clock = 0;
+
+    bool check_addr(uint32_t addr, uint32_t size, int32_t pc);
+    bool dcache_access(uint32_t addr);
+    bool predict_indirect(int32_t pc, const SimInst &inst, int32_t target);
+    bool call_runtime(int func, FILE *in, FILE *out);
+};
+
+// Text address of instruction 0
+const uint32_t SIM_TEXT_BASE = 0x10000;
+
+#endif
@@ -3,9 +3,10 @@
   #include <string>
   #include <vector>
   #include "ast.h"
+  typedef void *yyscan_t;
 }
 
-%{
+%code {
 
 #include <iostream>
 #include <memory>
@@ -14,13 +15,17 @@
 #include "ast.h"
 
 // declare lexer function and error handling function
-int yylex();
-void yyerror(std::unique_ptr<BaseAST> &ast, const char *s);
+int yylex(YYSTYPE *yylval, yyscan_t scanner);
+void yyerror(yyscan_t scanner, std::unique_ptr<BaseAST> &ast, const char *s);
 
 using namespace std;
 
-%}
+}
 
+// reentrant parser, all state lives in the scanner and the parser's stack
+%define api.pure full
+%lex-param { yyscan_t scanner }
+%parse-param { yyscan_t scanner }
 %parse-param { std::unique_ptr<BaseAST> &ast }
 
 // definition of yyval
@@ -821,6 +826,6 @@ ConstExp
 
 %%
 
-void yyerror(unique_ptr<BaseAST> &ast, const char *s) {
+void yyerror(yyscan_t scanner, unique_ptr<BaseAST> &ast, const char *s) {
   cerr << "error: " << s << endl;
 }
@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <sys/resource.h>
+#include "timer.h"
+using namespace std;
+
+thread_local TimeReport *time_report = nullptr;
+// phases of workers overlap, each counts the cpu time of its own thread
+static thread_local bool on_worker = false;
+
+static double wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cpu_time() {
+    struct timespec ts;
+    clock_gettime(on_worker ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long peak_rss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+size_t TimeReport::phase(const string &name) {
+    lock_guard<mutex> guard(lock);
+    for (size_t i = 0; i < phases.size(); ++i) {
+        if (phases[i].name == name)
+            return i;
+    }
+    phases.push_back(PhaseStats());
+    phases.back().name = name;
+    return phases.size() - 1;
+}
+
+void TimeReport::record(size_t slot, double wall, double cpu, long rss) {
+    lock_guard<mutex> guard(lock);
+    PhaseStats &stats = phases[slot];
+    stats.count++;
+    stats.wall += wall;
+    stats.cpu += cpu;
+    if (stats.peak_rss < rss)
+        stats.peak_rss = rss;
+}
+
+string TimeReport::table() const {
+    lock_guard<mutex> guard(lock);
+    string res("");
+    char line[256];
+    snprintf(line, sizeof(line), "%-32s %8s %12s %12s %14s\n",
+             "phase", "count", "wall (ms)", "cpu (ms)", "peak rss (KB)");
+    res += line;
+    for (auto &stats : phases) {
+        snprintf(line, sizeof(line), "%-32s %8lu %12.3f %12.3f %14ld\n",
+                 stats.name.c_str(), stats.count, stats.wall * 1e3, stats.cpu * 1e3,
+                 stats.peak_rss);
+        res += line;
+    }
+    return res;
+}
+
+string TimeReport::json() const {
+    lock_guard<mutex> guard(lock);
+    string res("{\"phases\": [");
+    char item[512];
+    for (size_t i = 0; i < phases.size(); ++i) {
+        const PhaseStats &stats = phases[i];
+        // phase names are plain identifiers and pass names, nothing to escape
+        snprintf(item, sizeof(item),
+                 "%s\n  {\"name\": \"%s\", \"count\": %lu, \"wall_ms\": %.3f, "
+                 "\"cpu_ms\": %.3f, \"peak_rss_kb\": %ld}",
+                 i ? "," : "", stats.name.c_str(), stats.count, stats.wall * 1e3,
+                 stats.cpu * 1e3, stats.peak_rss);
+        res += item;
+    }
+    res += "\n]}\n";
+    return res;
+}
+
+WorkerTimes::WorkerTimes(TimeReport *report) : prev_report(time_report), prev_worker(on_worker) {
+    time_report = report;
+    on_worker = true;
+}
+
+WorkerTimes::~WorkerTimes() {
+    time_report = prev_report;
+    on_worker = prev_worker;
+}
+
+PhaseTimer::PhaseTimer(const string &name) : report(time_report) {
+    if (!report)
+        return;
+    slot = report->phase(name);
+    wall_start = wall_time();
+    cpu_start = cpu_time();
+}
+
+PhaseTimer::~PhaseTimer() {
+    if (!report)
+        return;
+    report->record(slot, wall_time() - wall_start, cpu_time() - cpu_start, peak_rss());
+}
@@ -0,0 +1,70 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+/*
+ * Compile time instrumentation, like -ftime-report of gcc. Phases are
+ * timed by PhaseTimer objects into the TimeReport of the current thread,
+ * which costs nothing unless a report has been installed. Worker threads
+ * of a compile time into its report through a WorkerTimes; their phases
+ * add up the time of every thread that ran them.
+ */
+
+// Accumulated measurements of one phase
+struct PhaseStats {
+    string name;
+    unsigned long count = 0;  // times the phase ran
+    double wall = 0;          // wall time, seconds
+    double cpu = 0;           // user + system time of the process (of the thread on workers), seconds
+    long peak_rss = 0;        // peak resident set size of the process at the end, KB
+};
+
+class TimeReport {
+public:
+    // Slot of a phase, created on the first start so phases are reported in order
+    size_t phase(const string &name);
+    void record(size_t slot, double wall, double cpu, long peak_rss);
+    string table() const;
+    string json() const;
+
+private:
+    mutable mutex lock;
+    vector<PhaseStats> phases;
+};
+
+// report of the compile running on this thread, nullptr if not wanted
+extern thread_local TimeReport *time_report;
+
+/* Installs the report of a compile on a worker thread for its lifetime */
+class WorkerTimes {
+public:
+    explicit WorkerTimes(TimeReport *report);
+    ~WorkerTimes();
+    WorkerTimes(const WorkerTimes &) = delete;
+    WorkerTimes &operator=(const WorkerTimes &) = delete;
+
+private:
+    TimeReport *prev_report;
+    bool prev_worker;
+};
+
+/* Times its own lifetime as one run of a phase */
+class PhaseTimer {
+public:
+    explicit PhaseTimer(const string &name);
+    ~PhaseTimer();
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+    TimeReport *report;
+    size_t slot = 0;
+    double wall_start = 0;
+    double cpu_start = 0;
+};
+
+#endif
@@ -0,0 +1,60 @@
+// Stores and loads through array parameters that may be the same array
+int g[8];
+
+int store_both(int a[], int b[]) {
+    a[0] = 1;
+    b[0] = 2;
+    return a[0];
+}
+
+int read_after_param_store(int p[]) {
+    g[2] = 7;
+    p[2] = 9;
+    return g[2];
+}
+
+int overwrite(int a[], int b[]) {
+    a[1] = 10;
+    b[1] = a[1] + 5;
+    a[1] = 20;
+    return b[1];
+}
+
+void shift(int dst[], int src[], int n) {
+    int i = 0;
+    while (i < n) {
+        dst[i] = src[i + 1] * 2;
+        i = i + 1;
+    }
+}
+
+int main() {
+    int m[3][4] = {{1, 2, 3, 4}, {5, 6, 7, 8}, {9, 10, 11, 12}};
+    putint(store_both(m[1], m[1]));
+    putch(10);
+    putint(store_both(m[0], m[2]));
+    putch(10);
+    putint(read_after_param_store(g));
+    putch(10);
+    int l[4];
+    putint(read_after_param_store(l));
+    putch(10);
+    putint(overwrite(g, g));
+    putch(10);
+    putint(overwrite(m[0], m[1]));
+    putch(10);
+    shift(m[2], m[2], 3);
+    putarray(4, m[2]);
+    int total = 0, i = 0;
+    while (i < 3) {
+        int j = 0;
+        while (j < 4) {
+            total = total + m[i][j] * (i + 1);
+            j = j + 1;
+        }
+        i = i + 1;
+    }
+    putint(total);
+    putch(10);
+    return g[1] + m[1][1];
+}
@@ -0,0 +1,125 @@
+// Long runs of straight-line code, mixing loads, multiplies and divides
+int w[16];
+
+int mix(int a, int b, int c, int d) {
+    int x[8];
+    x[0] = a * 3 + b - c / 2 + d;
+    x[1] = a * 4 + b - c / 3 + d;
+    x[2] = a * 5 + b - c / 4 + d;
+    x[3] = a * 6 + b - c / 5 + d;
+    x[4] = a * 7 + b - c / 6 + d;
+    x[5] = a * 8 + b - c / 7 + d;
+    x[6] = a * 9 + b - c / 8 + d;
+    x[7] = a * 10 + b - c / 9 + d;
+    x[0] = (x[5] * d) / 2 + x[2] % 4;
+    x[1] = x[1] * x[5] * 2 - a;
+    x[2] = x[0] - x[1] * 1 - d;
+    x[3] = x[3] + x[1] * 1 - d;
+    x[4] = x[3] + x[0] * 2 - d;
+    x[5] = (x[0] - c) / 3 + x[2] % 4;
+    x[6] = x[4] * x[2] * 2 - a;
+    x[7] = x[5] * x[1] * 1 - a;
+    b = (x[7] + x[6]) % 1000;
+    x[0] = x[5] - x[7] * 3 - d;
+    x[1] = x[3] + x[2] * 3 - b;
+    x[2] = (x[7] - d) / 6 + x[5] % 4;
+    x[3] = x[1] - x[6] * 2 - b;
+    x[4] = x[7] * x[6] * 1 - a;
+    x[5] = x[5] * x[5] * 4 - c;
+    x[6] = x[7] - x[1] * 4 - a;
+    x[7] = (x[1] * c) / 6 + x[0] % 10;
+    c = (x[6] + x[5]) % 1000;
+    x[0] = x[0] + x[7] * 1 - c;
+    x[1] = x[7] - x[0] * 2 - b;
+    x[2] = x[3] - x[6] * 1 - d;
+    x[3] = x[2] * x[7] * 3 - d;
+    x[4] = (x[2] * c) / 5 + x[6] % 8;
+    x[5] = x[6] + x[3] * 2 - b;
+    x[6] = x[2] + x[3] * 4 - b;
+    x[7] = x[2] + x[4] * 2 - c;
+    d = (x[5] + x[5]) % 1000;
+    x[0] = x[2] * x[0] * 4 - d;
+    x[1] = (x[6] + d) / 5 + x[6] % 9;
+    x[2] = x[0] + x[3] * 4 - a;
+    x[3] = x[2] * x[1] * 1 - c;
+    x[4] = x[1] * x[0] * 1 - b;
+    x[5] = x[5] + x[0] * 4 - a;
+    x[6] = (x[2] * c) / 4 + x[4] % 10;
+    x[7] = x[1] - x[1] * 4 - d;
+    d = (x[4] + x[1]) % 1000;
+    x[0] = x[2] * x[1] * 3 - c;
+    x[1] = x[7] + x[2] * 3 - a;
+    x[2] = x[2] * x[0] * 1 - c;
+    x[3] = (x[4] - b) / 8 + x[5] % 6;
+    x[4] = x[5] + x[3] * 4 - b;
+    x[5] = x[3] - x[3] * 1 - d;
+    x[6] = x[0] - x[4] * 2 - d;
+    x[7] = x[5] - x[7] * 1 - c;
+    b = (x[1] + x[3]) % 1000;
+    x[0] = (x[7] + c) / 5 + x[3] % 3;
+    x[1] = x[7] * x[5] * 1 - a;
+    x[2] = x[6] + x[3] * 4 - d;
+    x[3] = x[5] - x[1] * 4 - d;
+    x[4] = x[1] + x[2] * 1 - b;
+    x[5] = (x[2] * b) / 8 + x[7] % 10;
+    x[6] = x[5] + x[2] * 1 - b;
+    x[7] = x[1] + x[2] * 2 - d;
+    a = (x[4] + x[3]) % 1000;
+    return (x[0] + x[1] + x[2] + x[3] + x[4] + x[5] + x[6] + x[7]) % 100000;
+}
+
+int main() {
+    int i = 0;
+    while (i < 16) {
+        w[i] = i * i - 3 * i + 1;
+        i = i + 1;
+    }
+    w[9] = (w[8] * w[3] + 0) / 6;
+    w[10] = w[4] - w[8] * 2 + w[10] % 13;
+    w[4] = w[0] - w[11] * 2 + w[4] % 13;
+    w[14] = w[10] - w[9] * 3 + w[14] % 13;
+    w[13] = (w[15] * w[8] + 4) / 3;
+    w[4] = w[8] - w[14] * 1 + w[4] % 13;
+    w[14] = w[12] - w[2] * 3 + w[14] % 13;
+    w[0] = w[12] - w[14] * 1 + w[0] % 13;
+    w[5] = (w[2] * w[7] + 8) / 6;
+    w[3] = w[8] - w[0] * 2 + w[3] % 13;
+    w[15] = w[12] - w[14] * 1 + w[15] % 13;
+    w[1] = w[3] - w[14] * 2 + w[1] % 13;
+    w[1] = (w[12] * w[15] + 12) / 6;
+    w[14] = w[8] - w[0] * 1 + w[14] % 13;
+    w[14] = w[5] - w[9] * 3 + w[14] % 13;
+    w[6] = w[11] - w[4] * 2 + w[6] % 13;
+    w[15] = (w[8] * w[3] + 16) / 6;
+    w[8] = w[14] - w[15] * 1 + w[8] % 13;
+    w[14] = w[2] - w[6] * 1 + w[14] % 13;
+    w[12] = w[7] - w[5] * 1 + w[12] % 13;
+    w[7] = (w[6] * w[1] + 20) / 3;
+    w[9] = w[12] - w[1] * 1 + w[9] % 13;
+    w[11] = w[2] - w[4] * 1 + w[11] % 13;
+    w[14] = w[3] - w[11] * 1 + w[14] % 13;
+    w[12] = (w[14] * w[7] + 24) / 3;
+    w[7] = w[2] - w[11] * 2 + w[7] % 13;
+    w[12] = w[5] - w[6] * 1 + w[12] % 13;
+    w[11] = w[5] - w[1] * 3 + w[11] % 13;
+    w[11] = (w[0] * w[5] + 28) / 6;
+    w[14] = w[7] - w[11] * 1 + w[14] % 13;
+    w[12] = w[5] - w[8] * 3 + w[12] % 13;
+    w[9] = w[8] - w[1] * 1 + w[9] % 13;
+    w[7] = (w[14] * w[1] + 32) / 2;
+    w[8] = w[4] - w[0] * 1 + w[8] % 13;
+    w[8] = w[12] - w[2] * 2 + w[8] % 13;
+    w[8] = w[6] - w[2] * 3 + w[8] % 13;
+    w[15] = (w[11] * w[5] + 36) / 2;
+    w[8] = w[0] - w[12] * 3 + w[8] % 13;
+    w[5] = w[6] - w[1] * 2 + w[5] % 13;
+    w[0] = w[10] - w[1] * 2 + w[0] % 13;
+    putarray(16, w);
+    int r = mix(w[0], w[5], w[10], w[15]);
+    putint(r);
+    putch(10);
+    r = r + mix(-7, 13, 1000, 3);
+    putint(r);
+    putch(10);
+    return r % 256;
+}
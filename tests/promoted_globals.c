@@ -0,0 +1,67 @@
+// Globals kept in registers across loops whose calls read or write them
+int counter;
+int total;
+int hist[4];
+
+void bump() {
+    counter = counter + 1;
+}
+
+int peek() {
+    return total;
+}
+
+void reset() {
+    total = 0;
+}
+
+void add_to(int p[], int v) {
+    p[0] = p[0] + v;
+}
+
+int main() {
+    int i = 0;
+    while (i < 100) {
+        total = total + i;
+        if (i % 10 == 0)
+            bump();
+        if (i == 50)
+            reset();
+        if (i % 25 == 0) {
+            putint(peek());
+            putch(32);
+        }
+        i = i + 1;
+    }
+    putch(10);
+    putint(counter);
+    putch(32);
+    putint(total);
+    putch(10);
+
+    // leaving the loop by break and skipping by continue must write back
+    i = 0;
+    while (1) {
+        counter = counter + 2;
+        if (counter > 40)
+            break;
+        if (counter % 3 == 0)
+            continue;
+        total = total + counter;
+    }
+    putint(counter);
+    putch(32);
+    putint(total);
+    putch(10);
+
+    // the global array changes only through a pointer in the callee
+    i = 0;
+    while (i < 20) {
+        hist[i % 4] = hist[i % 4] + 1;
+        add_to(hist, i);
+        add_to(hist, hist[3]);
+        i = i + 1;
+    }
+    putarray(4, hist);
+    return (counter + total + hist[0]) % 256;
+}
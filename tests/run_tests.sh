@@ -0,0 +1,47 @@
+#!/bin/bash
+
+# Regression tests of the backend against the KoopaIR interpreter.
+# Each tests/NAME.c (with stdin from NAME.in if present) is compiled and
+# run on the simulator and on the interpreter; both must print NAME.out,
+# the output of the program followed by a line with its exit code.
+# usage: tests/run_tests.sh [compiler]
+
+compiler=${1:-./build/compiler}
+test_dir=$(dirname "$0")
+work_dir=${TEST_DIR:-./build/tests}
+
+# output of a run and its exit code, in the format of the .out files
+result() {
+    local code=$1 out=$2
+    cat "$out"
+    if [ -s "$out" ] && [ -n "$(tail -c 1 "$out")" ]; then
+        echo
+    fi
+    echo "$code"
+}
+
+mkdir -p "$work_dir"
+passed=0
+failed=0
+for src in "$test_dir"/*.c; do
+    name=$(basename "$src" .c)
+    input=$test_dir/$name.in
+    [ -f "$input" ] || input=/dev/null
+    # bypass the compile cache, it may hold code of an older build
+    SYSY_CACHE_DIR= "$compiler" -sim "$src" < "$input" > "$work_dir/$name.sim" 2> /dev/null
+    result $? "$work_dir/$name.sim" > "$work_dir/$name.sim.out"
+    SYSY_CACHE_DIR= "$compiler" -interp "$src" < "$input" > "$work_dir/$name.interp" 2> /dev/null
+    result $? "$work_dir/$name.interp" > "$work_dir/$name.interp.out"
+    if ! cmp -s "$work_dir/$name.interp.out" "$test_dir/$name.out"; then
+        echo "FAIL $name: interpreter output differs from $name.out"
+        failed=$((failed + 1))
+    elif ! cmp -s "$work_dir/$name.sim.out" "$work_dir/$name.interp.out"; then
+        echo "FAIL $name: simulator output differs from the interpreter"
+        diff "$work_dir/$name.interp.out" "$work_dir/$name.sim.out" | head -5
+        failed=$((failed + 1))
+    else
+        passed=$((passed + 1))
+    fi
+done
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]